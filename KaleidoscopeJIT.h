@@ -14,23 +14,36 @@
 #define LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
 
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/iterator_range.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Mangler.h"
+#include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
+#include "jit_memory.hpp"
+#include "symbol_index.hpp"
 #include <algorithm>
+#include <functional>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -41,44 +54,215 @@ class KaleidoscopeJIT {
 public:
   using ObjLayerT = LegacyRTDyldObjectLinkingLayer;
   using CompileLayerT = LegacyIRCompileLayer<ObjLayerT, SimpleCompiler>;
+  using OptimizeFunction =
+      std::function<std::unique_ptr<Module>(std::unique_ptr<Module>)>;
+  using OptimizeLayerT =
+      LegacyIRTransformLayer<CompileLayerT, OptimizeFunction>;
+  using CODLayerT = LegacyCompileOnDemandLayer<OptimizeLayerT>;
 
-  KaleidoscopeJIT()
+  // The CPU to generate code for, as given by --mcpu and --mattr: "native"
+  // is the host CPU with its features, any other name that CPU, and empty
+  // the default of createTargetMachine. Attrs such as "+avx2" or "-fma" then
+  // adjust the features.
+  struct TargetCPU {
+    std::string CPU;
+    std::vector<std::string> Attrs;
+  };
+
+  explicit KaleidoscopeJIT(TargetCPU Target = TargetCPU())
       : Resolver(createLegacyLookupResolver(
             ES,
             [this](const std::string &Name) { return findMangledSymbol(Name); },
             [](Error Err) { cantFail(std::move(Err), "lookupFlags failed"); })),
-        TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
+        Target(std::move(Target)), TM(createTargetMachine(this->Target)),
+        DL(TM->createDataLayout()),
         ObjectLayer(AcknowledgeORCv1Deprecation, ES,
-                    [this](VModuleKey) {
+                    [this](VModuleKey K) {
                       return ObjLayerT::Resources{
-                          std::make_shared<SectionMemoryManager>(), Resolver};
+                          std::make_shared<PooledMemoryManager>(Memory),
+                          getResolver(K)};
+                    },
+                    /*NotifyLoaded=*/nullptr,
+                    [this](VModuleKey K, const object::ObjectFile &Obj,
+                           const RuntimeDyld::LoadedObjectInfo &Info) {
+                      for (auto *L : EventListeners)
+                        L->notifyObjectLoaded(K, Obj, Info);
+                    },
+                    [this](VModuleKey K, const object::ObjectFile &) {
+                      for (auto *L : EventListeners) L->notifyFreeingObject(K);
                     }),
         CompileLayer(AcknowledgeORCv1Deprecation, ObjectLayer,
-                     SimpleCompiler(*TM)) {
+                     SimpleCompiler(*TM, &Cache)),
+        OptimizeLayer(AcknowledgeORCv1Deprecation, CompileLayer,
+                      [this](std::unique_ptr<Module> M) {
+                        if (Optimizer) Optimizer(*M);
+                        return M;
+                      }),
+        CompileCallbackManager(cantFail(createLocalCompileCallbackManager(
+            TM->getTargetTriple(), ES, 0))),
+        CODLayer(AcknowledgeORCv1Deprecation, ES, OptimizeLayer,
+                 [this](VModuleKey K) { return getResolver(K); },
+                 [this](VModuleKey K, std::shared_ptr<SymbolResolver> R) {
+                   Resolvers[K] = std::move(R);
+                 },
+                 [this](Function &F) {
+                   // Called the first time a lazy definition is executed.
+                   ++NumMaterialized;
+                   return std::set<Function *>({&F});
+                 },
+                 *CompileCallbackManager,
+                 createLocalIndirectStubsManagerBuilder(
+                     TM->getTargetTriple())),
+        Stubs(createLocalIndirectStubsManagerBuilder(
+            TM->getTargetTriple())()) {
     llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
   }
 
   TargetMachine &getTargetMachine() { return *TM; }
 
+  // Where the code and data of every module are placed.
+  const JITMemoryPool &getMemoryPool() const { return *Memory; }
+
+  // A TargetMachine configured like the JIT's own. TargetMachines are not
+  // thread-safe, so each compile thread needs its own.
+  std::unique_ptr<TargetMachine> createTargetMachine() const {
+    return createTargetMachine(Target);
+  }
+
+  // A TargetMachine tuned for this machine, e.g. for the loops of batch
+  // wrappers: for the JIT's CPU if one was chosen, or else the host CPU.
+  std::unique_ptr<TargetMachine> createHostTargetMachine() const {
+    return createTargetMachine(Target, None, /*ForHost=*/true);
+  }
+
+  // A TargetMachine for Target. RM overrides the relocation model, e.g. PIC
+  // for code loaded outside the JIT. ForHost makes an empty Target.CPU the
+  // host CPU with all its features, such as its SIMD width, rather than the
+  // generic CPU for the host triple.
+  static std::unique_ptr<TargetMachine>
+  createTargetMachine(const TargetCPU &Target,
+                      Optional<Reloc::Model> RM = None, bool ForHost = false) {
+    EngineBuilder EB;
+    if (RM) EB.setRelocationModel(*RM);
+    SmallVector<std::string, 64> Attrs;
+    if (Target.CPU.empty() ? ForHost : Target.CPU == "native") {
+      StringMap<bool> Features;
+      if (sys::getHostCPUFeatures(Features))
+        for (auto &F : Features)
+          Attrs.push_back((F.second ? "+" : "-") + F.first().str());
+      EB.setMCPU(sys::getHostCPUName());
+    } else if (!Target.CPU.empty()) {
+      EB.setMCPU(Target.CPU);
+    }
+    Attrs.append(Target.Attrs.begin(), Target.Attrs.end());
+    EB.setMAttrs(Attrs);
+    return std::unique_ptr<TargetMachine>(EB.selectTarget());
+  }
+
   VModuleKey addModule(std::unique_ptr<Module> M) {
     auto K = ES.allocateVModule();
+    track(K, LayerKind::Compiled, definedNames(*M));
     cantFail(CompileLayer.addModule(K, std::move(M)));
-    ModuleKeys.push_back(K);
+    return K;
+  }
+
+  // Add M behind lazy-compilation stubs: each definition is optimized (with
+  // the function set by setOptimizer) and compiled on its first call. The
+  // LLVMContext of M must outlive the JIT.
+  VModuleKey addLazyModule(std::unique_ptr<Module> M) {
+    for (auto &F : *M)
+      if (!F.isDeclaration()) ++NumLazyDefinitions;
+    auto K = ES.allocateVModule();
+    track(K, LayerKind::Lazy, definedNames(*M));
+    cantFail(CODLayer.addModule(K, std::move(M)));
+    return K;
+  }
+
+  // Add an object file compiled elsewhere, e.g. on another thread.
+  VModuleKey addObject(std::unique_ptr<MemoryBuffer> Obj) {
+    auto K = ES.allocateVModule();
+    track(K, LayerKind::Object, definedNames(*Obj));
+    cantFail(ObjectLayer.addObject(K, std::move(Obj)));
     return K;
   }
 
   void removeModule(VModuleKey K) {
-    ModuleKeys.erase(find(ModuleKeys, K));
-    cantFail(CompileLayer.removeModule(K));
+    auto I = Modules.find(K);
+    for (auto *E : I->second.Defines) Index.remove(*E, K);
+    switch (I->second.Layer) {
+    case LayerKind::Compiled:
+      cantFail(CompileLayer.removeModule(K));
+      break;
+    case LayerKind::Lazy:
+      cantFail(CODLayer.removeModule(K));
+      break;
+    case LayerKind::Object:
+      cantFail(ObjectLayer.removeObject(K));
+      break;
+    }
+    Modules.erase(I);
     ES.releaseVModule(K);
   }
 
+  // Called with a mangled name before the modules are searched for it. The
+  // waiter adds any module still on its way that defines the name, e.g. by
+  // waiting for a compile thread, so that lookups bind to the newest
+  // definition rather than one it replaces. Returns whether it added any.
+  void setSymbolWaiter(std::function<bool(const std::string &)> W) {
+    SymbolWaiter = std::move(W);
+  }
+
+  // Route calls to Name through a stub that jumps to Addr, or retarget the
+  // stub if it already exists. Stubs take precedence over module definitions.
+  // Retargeting is a single pointer-sized store, so code running concurrently
+  // calls either the old or the new target.
+  void setStub(const std::string &Name, JITTargetAddress Addr) {
+    auto MangledName = mangle(Name);
+    if (Stubs->findStub(MangledName, false))
+      cantFail(Stubs->updatePointer(MangledName, Addr));
+    else
+      cantFail(Stubs->createStub(MangledName, Addr, JITSymbolFlags::Exported));
+  }
+
+  // Resolve Name to Addr, e.g. data or callbacks owned by the host.
+  void addHostSymbol(const std::string &Name, JITTargetAddress Addr) {
+    HostSymbols[mangle(Name)] = Addr;
+  }
+
+  // Tell L about each object once it is linked and runnable, and again before
+  // it is freed, e.g. to register the code with a debugger or profiler. This
+  // includes every module added, after it is compiled.
+  void addEventListener(JITEventListener *L) { EventListeners.push_back(L); }
+  void removeEventListener(JITEventListener *L) {
+    EventListeners.erase(
+        std::remove(EventListeners.begin(), EventListeners.end(), L),
+        EventListeners.end());
+  }
+
+  // Consult C before compiling any module, and store what gets compiled.
+  void setObjectCache(ObjectCache *C) { Cache.Target = C; }
+
+  // Optimization applied to lazy definitions when they are materialized.
+  void setOptimizer(std::function<void(Module &)> F) {
+    Optimizer = std::move(F);
+  }
+
+  // Lazy definitions added so far, and how many of them have been compiled.
+  unsigned getNumLazyDefinitions() const { return NumLazyDefinitions; }
+  unsigned getNumMaterialized() const { return NumMaterialized; }
+
   JITSymbol findSymbol(const std::string Name) {
     return findMangledSymbol(mangle(Name));
   }
 
-private:
-  std::string mangle(const std::string &Name) {
+  // The address findSymbol last resolved Name to, or 0 if it has not been
+  // looked up since its newest definition was added. Lock-free, so any thread
+  // may call it while this one keeps adding and removing modules.
+  JITTargetAddress getResolvedAddress(const std::string &Name) const {
+    return Index.address(mangle(Name));
+  }
+
+  std::string mangle(const std::string &Name) const {
     std::string MangledName;
     {
       raw_string_ostream MangledNameStream(MangledName);
@@ -87,6 +271,7 @@ private:
     return MangledName;
   }
 
+private:
   JITSymbol findMangledSymbol(const std::string &Name) {
 #ifdef _WIN32
     // The symbol lookup of ObjectLinkingLayer uses the SymbolRef::SF_Exported
@@ -101,12 +286,24 @@ private:
     const bool ExportedSymbolsOnly = true;
 #endif
 
-    // Search modules in reverse order: from last added to first added.
-    // This is the opposite of the usual search order for dlsym, but makes more
-    // sense in a REPL where we want to bind to the newest available definition.
-    for (auto H : make_range(ModuleKeys.rbegin(), ModuleKeys.rend()))
-      if (auto Sym = CompileLayer.findSymbolIn(H, Name, ExportedSymbolsOnly))
-        return Sym;
+    if (auto Stub = Stubs->findStub(Name, ExportedSymbolsOnly)) return Stub;
+    auto HostSym = HostSymbols.find(Name);
+    if (HostSym != HostSymbols.end())
+      return JITSymbol(HostSym->second, JITSymbolFlags::Exported);
+
+    if (SymbolWaiter) SymbolWaiter(Name);
+
+    // Search the modules defining Name in reverse order: from last added to
+    // first added. This is the opposite of the usual search order for dlsym,
+    // but makes more sense in a REPL where we want to bind to the newest
+    // available definition.
+    if (auto *E = Index.find(Name)) {
+      if (auto Addr = E->Address.load(std::memory_order_acquire))
+        return JITSymbol(Addr, JITSymbolFlags::Exported);
+      for (auto K : make_range(E->Modules.rbegin(), E->Modules.rend()))
+        if (auto Sym = findSymbolIn(K, Name, ExportedSymbolsOnly))
+          return publish(*E, std::move(Sym));
+    }
 
     // If we can't find the symbol in the JIT, try looking in the host process.
     if (auto SymAddr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
@@ -125,13 +322,123 @@ private:
     return nullptr;
   }
 
+  enum class LayerKind { Compiled, Lazy, Object };
+  struct LoadedModule {
+    LayerKind Layer;
+    std::vector<SymbolIndex::Entry *> Defines;
+  };
+
+  // Mangled names of what M or Obj defines for other modules to link to.
+  // Objects may list local symbols too; findSymbolIn filters those out.
+  std::vector<std::string> definedNames(const Module &M) const {
+    std::vector<std::string> Names;
+    for (auto &GV : M.global_values())
+      if (!GV.isDeclaration() && !GV.hasLocalLinkage() && GV.hasName())
+        Names.push_back(mangle(GV.getName().str()));
+    return Names;
+  }
+  std::vector<std::string> definedNames(const MemoryBuffer &Obj) const {
+    std::vector<std::string> Names;
+    auto File = object::ObjectFile::createObjectFile(Obj.getMemBufferRef());
+    if (!File) {
+      consumeError(File.takeError());
+      return Names;
+    }
+    for (auto &Sym : (*File)->symbols()) {
+      auto Name = Sym.getName();
+      auto Section = Sym.getSection();
+      if (!Name || !Section) {
+        consumeError(Name.takeError());
+        consumeError(Section.takeError());
+        continue;
+      }
+      if (!Name->empty() && *Section != (*File)->section_end())
+        Names.push_back(Name->str());
+    }
+    return Names;
+  }
+
+  void track(VModuleKey K, LayerKind Layer,
+             const std::vector<std::string> &Names) {
+    auto &LM = Modules[K];
+    LM.Layer = Layer;
+    for (auto &Name : Names) {
+      auto &E = Index.insert(Name);
+      Index.add(E, K);
+      LM.Defines.push_back(&E);
+    }
+  }
+
+  JITSymbol findSymbolIn(VModuleKey K, const std::string &Name,
+                         bool ExportedSymbolsOnly) {
+    switch (Modules[K].Layer) {
+    case LayerKind::Lazy:
+      return CODLayer.findSymbolIn(K, Name, ExportedSymbolsOnly);
+    case LayerKind::Object:
+      return ObjectLayer.findSymbolIn(K, Name, ExportedSymbolsOnly);
+    default:
+      return CompileLayer.findSymbolIn(K, Name, ExportedSymbolsOnly);
+    }
+  }
+
+  // Sym, recording its address in E once resolved (which for a module not
+  // linked yet means linking it), unless E's modules have changed by then.
+  JITSymbol publish(SymbolIndex::Entry &E, JITSymbol Sym) {
+    auto Flags = Sym.getFlags();
+    uint64_t Generation = E.Generation;
+    return JITSymbol(
+        [this, &E, Generation,
+         Sym = std::move(Sym)]() mutable -> Expected<JITTargetAddress> {
+          auto Addr = Sym.getAddress();
+          if (Addr) Index.publish(E, Generation, *Addr);
+          return Addr;
+        },
+        Flags);
+  }
+
+  // Modules partitioned by the compile-on-demand layer get their own
+  // resolvers; everything else uses the JIT-wide one.
+  std::shared_ptr<SymbolResolver> getResolver(VModuleKey K) {
+    auto I = Resolvers.find(K);
+    return I != Resolvers.end() ? I->second : Resolver;
+  }
+
+  // SimpleCompiler takes its cache at construction; this lets one be
+  // attached later.
+  class ForwardingObjectCache : public ObjectCache {
+  public:
+    ObjectCache *Target = nullptr;
+    void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override {
+      if (Target) Target->notifyObjectCompiled(M, Obj);
+    }
+    std::unique_ptr<MemoryBuffer> getObject(const Module *M) override {
+      return Target ? Target->getObject(M) : nullptr;
+    }
+  };
+
   ExecutionSession ES;
+  ForwardingObjectCache Cache;
   std::shared_ptr<SymbolResolver> Resolver;
+  const TargetCPU Target;
   std::unique_ptr<TargetMachine> TM;
   const DataLayout DL;
+  std::shared_ptr<JITMemoryPool> Memory = std::make_shared<JITMemoryPool>();
+  // Before ObjectLayer, which notifies them as it frees its objects.
+  std::vector<JITEventListener *> EventListeners;
   ObjLayerT ObjectLayer;
   CompileLayerT CompileLayer;
-  std::vector<VModuleKey> ModuleKeys;
+  OptimizeLayerT OptimizeLayer;
+  std::unique_ptr<JITCompileCallbackManager> CompileCallbackManager;
+  CODLayerT CODLayer;
+  std::unique_ptr<IndirectStubsManager> Stubs;
+  std::map<std::string, JITTargetAddress> HostSymbols;
+  std::function<void(Module &)> Optimizer;
+  std::map<VModuleKey, std::shared_ptr<SymbolResolver>> Resolvers;
+  std::map<VModuleKey, LoadedModule> Modules;
+  SymbolIndex Index;
+  std::function<bool(const std::string &)> SymbolWaiter;
+  unsigned NumLazyDefinitions = 0;
+  unsigned NumMaterialized = 0;
 };
 
 } // end namespace orc
@@ -0,0 +1,20 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <new>
+
+// Replaces the global operator new to count allocations for AllocationCount.
+// Linked into the kaleidoscope tools only, never into the library.
+
+extern thread_local size_t ThreadAllocations;  // stats.cpp
+
+void *operator new(size_t Size) {
+  ++ThreadAllocations;
+  if (void *P = malloc(Size ? Size : 1)) return P;
+  abort();
+}
+void *operator new[](size_t Size) { return operator new(Size); }
+void operator delete(void *P) noexcept { free(P); }
+void operator delete[](void *P) noexcept { free(P); }
+void operator delete(void *P, size_t) noexcept { free(P); }
+void operator delete[](void *P, size_t) noexcept { free(P); }
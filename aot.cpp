@@ -0,0 +1,225 @@
+#include "aot.hpp"
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "batch_eval.hpp"
+#include "codegen.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "vector_math.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+// "<name> <arity>\n" for each definition, in a section of its own rather
+// than under a symbol, so that outputs linked together do not clash: the
+// linker concatenates their manifests.
+static const char *const ManifestSection = ".kaleidoscope_manifest";
+
+static bool EmitObject(llvm::Module &M, llvm::TargetMachine &TM,
+                       const std::string &Path) {
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_None);
+  if (EC) {
+    fprintf(stderr, "error: cannot open %s: %s\n", Path.c_str(),
+            EC.message().c_str());
+    return false;
+  }
+  llvm::legacy::PassManager PM;
+  if (TM.addPassesToEmitFile(PM, OS, nullptr, llvm::CGFT_ObjectFile)) {
+    fprintf(stderr, "error: the target cannot emit object files\n");
+    return false;
+  }
+  PM.run(M);
+  return true;
+}
+
+// Link Obj into a shared library with the system compiler driver.
+static bool LinkShared(const std::string &Obj, const std::string &Output,
+                       const CodeGenOptions &Options) {
+  auto CC = llvm::sys::findProgramByName("cc");
+  if (!CC) {
+    fprintf(stderr, "error: cannot find cc to link %s\n", Output.c_str());
+    return false;
+  }
+  std::vector<llvm::StringRef> Args = {*CC, "-shared", "-o", Output, Obj,
+                                       "-lm"};
+  // The vectorizers may have called its SIMD math functions.
+  if (Options.VectorMath && VectorMathAvailable()) Args.push_back("-lmvec");
+  std::string Error;
+  if (llvm::sys::ExecuteAndWait(*CC, Args, llvm::None, {}, 0, 0, &Error)) {
+    fprintf(stderr, "error: linking %s failed%s%s\n", Output.c_str(),
+            Error.empty() ? "" : ": ", Error.c_str());
+    return false;
+  }
+  return true;
+}
+
+int CompileAOT(const std::string &Input, const std::string &Output,
+               const CodeGenOptions &Options, llvm::CodeGenOpt::Level OptLevel,
+               bool BatchWrappers) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  auto L = Lexer::fromFile(Input);
+  if (!L) return 1;
+  setLexer(std::move(L));
+
+  // Position-independent, so the object also links into PIEs and libraries,
+  // and by default for the generic CPU, so it runs on other machines too.
+  auto TM = llvm::orc::KaleidoscopeJIT::createTargetMachine(
+      Options.Target, llvm::Reloc::PIC_, /*ForHost=*/false);
+  TM->setOptLevel(OptLevel);
+  CodeGenVisitor CG(TM->createDataLayout(), Options);
+  CG.OptimizeEachFunction = false;
+  CG.TheModule->setTargetTriple(TM->getTargetTriple().str());
+
+  Parser P;
+  std::string Manifest;
+  unsigned Skipped = 0, Failed = 0;
+  getNextToken();
+  while (getCurrentToken().type != tok_eof) {
+    switch (getCurrentToken().type) {
+      case ';':
+        getNextToken();
+        break;
+      case tok_def:
+        if (auto F = P.ParseDefinition()) {
+          std::string Entry = F->Proto->getName().str() + " " +
+                              std::to_string(F->Proto->Args.size()) + "\n";
+          if (F->Accept(CG))
+            Manifest += Entry;
+          else
+            ++Failed;
+        } else {
+          ++Failed;
+          getNextToken();
+        }
+        break;
+      case tok_extern:
+        if (auto Proto = P.ParseExtern()) {
+          Proto->Accept(CG);
+          CG.FunctionProtos[Proto->Name] = std::move(Proto);
+        } else {
+          ++Failed;
+          getNextToken();
+        }
+        break;
+      default:
+        if (P.ParseTopLevelExpr())
+          ++Skipped;
+        else
+          getNextToken();
+        break;
+    }
+  }
+  if (Skipped)
+    fprintf(stderr, "skipped %u top-level expression%s\n", Skipped,
+            Skipped == 1 ? "" : "s");
+  // A library without some of its functions would only fail later, when a
+  // program that calls them is linked.
+  if (Failed) {
+    fprintf(stderr, "error: %u item%s failed to compile; not writing %s\n",
+            Failed, Failed == 1 ? "" : "s", Output.c_str());
+    return 1;
+  }
+
+  auto &M = *CG.TheModule;
+  CodeGenVisitor::OptimizeModule(M, Options, TM.get());
+  if (BatchWrappers)
+    if (auto BM = MakeBatchModule(M, *TM, Options))
+      if (llvm::Linker::linkModules(M, std::move(BM))) {
+        fprintf(stderr, "error: cannot link the batch wrappers\n");
+        return 1;
+      }
+  auto *Data = llvm::ConstantDataArray::getString(M.getContext(), Manifest,
+                                                  /*AddNull=*/false);
+  auto *GV = new llvm::GlobalVariable(M, Data->getType(), /*isConstant=*/true,
+                                      llvm::GlobalValue::PrivateLinkage, Data,
+                                      "manifest");
+  GV->setSection(ManifestSection);
+  GV->setAlignment(llvm::MaybeAlign(1));
+  llvm::appendToUsed(M, {GV});
+
+  if (!llvm::StringRef(Output).endswith(".so"))
+    return EmitObject(M, *TM, Output) ? 0 : 1;
+
+  llvm::SmallString<128> Obj;
+  if (auto EC = llvm::sys::fs::createTemporaryFile("kaleidoscope", "o", Obj)) {
+    fprintf(stderr, "error: cannot create a temporary file: %s\n",
+            EC.message().c_str());
+    return 1;
+  }
+  std::string ObjPath = Obj.str().str();
+  bool OK =
+      EmitObject(M, *TM, ObjPath) && LinkShared(ObjPath, Output, Options);
+  llvm::sys::fs::remove(Obj);
+  return OK ? 0 : 1;
+}
+
+bool PreloadLibrary(const std::string &Path,
+                    SymbolMap<std::unique_ptr<PrototypeAST>> &Protos) {
+  // Permanent libraries are searched when the JIT resolves host symbols.
+  std::string Error;
+  auto Lib =
+      llvm::sys::DynamicLibrary::getPermanentLibrary(Path.c_str(), &Error);
+  if (!Lib.isValid()) {
+    fprintf(stderr, "error: cannot load %s: %s\n", Path.c_str(),
+            Error.c_str());
+    return false;
+  }
+
+  auto File = llvm::object::ObjectFile::createObjectFile(Path);
+  if (!File) {
+    fprintf(stderr, "error: cannot read %s: %s\n", Path.c_str(),
+            llvm::toString(File.takeError()).c_str());
+    return false;
+  }
+  llvm::Optional<llvm::StringRef> Manifest;
+  for (auto &Section : File->getBinary()->sections()) {
+    auto Name = Section.getName();
+    if (!Name) {
+      llvm::consumeError(Name.takeError());
+      continue;
+    }
+    if (*Name != ManifestSection) continue;
+    auto Contents = Section.getContents();
+    if (!Contents) {
+      llvm::consumeError(Contents.takeError());
+      continue;
+    }
+    Manifest = *Contents;
+    break;
+  }
+  if (!Manifest) {
+    fprintf(stderr, "error: %s was not written by kaleidoscope --emit\n",
+            Path.c_str());
+    return false;
+  }
+
+  llvm::SmallVector<llvm::StringRef, 64> Lines;
+  Manifest->split(Lines, '\n', -1, false);
+  for (auto Line : Lines) {
+    auto NameArity = Line.split(' ');
+    unsigned Arity;
+    if (NameArity.second.getAsInteger(10, Arity)) continue;
+    std::vector<SymbolID> Args;
+    for (unsigned i = 0; i < Arity; i++)
+      Args.push_back(Symbols().intern("a" + std::to_string(i)));
+    SymbolID Name = Symbols().intern(NameArity.first);
+    Protos[Name] = std::make_unique<PrototypeAST>(Name, std::move(Args));
+  }
+  return true;
+}
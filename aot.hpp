@@ -0,0 +1,29 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "llvm/Target/TargetMachine.h"
+#include "symbols.hpp"
+
+// Ahead-of-time compilation. Every definition of a source file goes into one
+// module, generated and optimized with Options, and is written out as a
+// native object file, or linked into a shared library when Output ends in
+// ".so". Definitions are exported as C functions, double f(double, ...), so
+// other programs can call them without LLVM. Top-level expressions are
+// skipped. Returns 1, writing nothing, if any definition or extern fails to
+// parse or compile.
+//
+// The output also carries a manifest listing each definition's name and
+// arity, which PreloadLibrary reads. With BatchWrappers, it exports the
+// <name>_batch wrappers of batch_eval.hpp too.
+int CompileAOT(const std::string &Input, const std::string &Output,
+               const CodeGenOptions &Options, llvm::CodeGenOpt::Level OptLevel,
+               bool BatchWrappers = false);
+
+// Load a shared library written by CompileAOT and declare its functions in
+// Protos, so that code compiled afterwards calls them in place.
+bool PreloadLibrary(const std::string &Path,
+                    SymbolMap<std::unique_ptr<PrototypeAST>> &Protos);
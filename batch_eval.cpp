@@ -0,0 +1,135 @@
+#include "batch_eval.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "codegen.hpp"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+// Add F_batch, a loop over rows calling F, to F's module.
+static void EmitWrapper(llvm::Function &F) {
+  auto &Ctx = F.getContext();
+  auto *DoubleTy = llvm::Type::getDoubleTy(Ctx);
+  auto *SizeTy = F.getParent()->getDataLayout().getIntPtrType(Ctx);
+  unsigned NumArgs = F.arg_size();
+
+  std::vector<llvm::Type *> Params(NumArgs + 1, DoubleTy->getPointerTo());
+  Params.push_back(SizeTy);
+  auto *W = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), Params, false),
+      llvm::Function::ExternalLinkage, F.getName() + "_batch",
+      F.getParent());
+  // Without noalias on out, the vectorizer would have to check for overlap
+  // at run time.
+  for (unsigned i = 0; i <= NumArgs; i++) {
+    W->addParamAttr(i, llvm::Attribute::NoAlias);
+    W->addParamAttr(i, llvm::Attribute::NoCapture);
+    if (i < NumArgs) W->addParamAttr(i, llvm::Attribute::ReadOnly);
+  }
+  auto *Out = W->arg_begin() + NumArgs;
+  auto *N = W->arg_begin() + NumArgs + 1;
+
+  auto *Entry = llvm::BasicBlock::Create(Ctx, "entry", W);
+  auto *Loop = llvm::BasicBlock::Create(Ctx, "loop", W);
+  auto *Exit = llvm::BasicBlock::Create(Ctx, "exit", W);
+  llvm::IRBuilder<> Builder(Entry);
+  auto *Zero = llvm::ConstantInt::get(SizeTy, 0);
+  Builder.CreateCondBr(Builder.CreateICmpEQ(N, Zero), Exit, Loop);
+
+  Builder.SetInsertPoint(Loop);
+  auto *I = Builder.CreatePHI(SizeTy, 2, "i");
+  I->addIncoming(Zero, Entry);
+  std::vector<llvm::Value *> Args;
+  for (unsigned k = 0; k < NumArgs; k++)
+    Args.push_back(Builder.CreateLoad(
+        DoubleTy, Builder.CreateInBoundsGEP(DoubleTy, W->arg_begin() + k, I)));
+  Builder.CreateStore(Builder.CreateCall(&F, Args),
+                      Builder.CreateInBoundsGEP(DoubleTy, Out, I));
+  auto *Next = Builder.CreateNUWAdd(I, llvm::ConstantInt::get(SizeTy, 1));
+  I->addIncoming(Next, Loop);
+  Builder.CreateCondBr(Builder.CreateICmpEQ(Next, N), Exit, Loop);
+
+  Builder.SetInsertPoint(Exit);
+  Builder.CreateRetVoid();
+}
+
+std::unique_ptr<llvm::Module> MakeBatchModule(const llvm::Module &M,
+                                              llvm::TargetMachine &TM,
+                                              const CodeGenOptions &Options) {
+  auto BM = llvm::CloneModule(M);
+  std::vector<llvm::Function *> Defs;
+  for (auto &F : *BM)
+    if (!F.isDeclaration()) Defs.push_back(&F);
+  if (Defs.empty()) return nullptr;
+
+  for (auto *F : Defs) {
+    // M keeps exporting the scalar definitions; these copies are only here
+    // to be inlined.
+    F->setLinkage(llvm::GlobalValue::InternalLinkage);
+    EmitWrapper(*F);
+  }
+  // Whichever TargetMachine compiles BM generates code for TM's CPU.
+  for (auto &F : *BM) {
+    F.addFnAttr("target-cpu", TM.getTargetCPU());
+    F.addFnAttr("target-features", TM.getTargetFeatureString());
+  }
+  CodeGenOptions O3 = Options;
+  O3.Pipeline = "O3";
+  CodeGenVisitor::OptimizeModule(*BM, O3, &TM);
+  return BM;
+}
+
+// Rows below which another thread costs more than it saves.
+static const size_t MinRowsPerThread = 1 << 16;
+
+static void CallWrapper(llvm::JITTargetAddress W, const double *const *A,
+                        double *Out, size_t N, size_t NumArgs) {
+  using P = const double *;
+  switch (NumArgs) {
+    case 0:
+      return ((void (*)(double *, size_t))W)(Out, N);
+    case 1:
+      return ((void (*)(P, double *, size_t))W)(A[0], Out, N);
+    case 2:
+      return ((void (*)(P, P, double *, size_t))W)(A[0], A[1], Out, N);
+    case 3:
+      return ((void (*)(P, P, P, double *, size_t))W)(A[0], A[1], A[2], Out,
+                                                       N);
+    case 4:
+      return ((void (*)(P, P, P, P, double *, size_t))W)(A[0], A[1], A[2],
+                                                          A[3], Out, N);
+    case 5:
+      return ((void (*)(P, P, P, P, P, double *, size_t))W)(
+          A[0], A[1], A[2], A[3], A[4], Out, N);
+    case 6:
+      return ((void (*)(P, P, P, P, P, P, double *, size_t))W)(
+          A[0], A[1], A[2], A[3], A[4], A[5], Out, N);
+  }
+}
+
+bool CallBatch(llvm::JITTargetAddress Wrapper,
+               llvm::ArrayRef<const double *> Args, double *Out, size_t N,
+               unsigned NumThreads) {
+  if (Args.size() > MaxBatchArgs) return false;
+
+  // Run rows [Begin, End) on this thread.
+  auto Run = [&](size_t Begin, size_t End) {
+    const double *A[MaxBatchArgs];
+    for (size_t k = 0; k < Args.size(); k++) A[k] = Args[k] + Begin;
+    CallWrapper(Wrapper, A, Out + Begin, End - Begin, Args.size());
+  };
+
+  size_t Blocks =
+      std::max<size_t>(1, std::min<size_t>(NumThreads, N / MinRowsPerThread));
+  // Keep block boundaries on cache lines of the output.
+  size_t BlockSize = ((N + Blocks - 1) / Blocks + 7) & ~size_t(7);
+  std::vector<std::thread> Threads;
+  for (size_t Begin = BlockSize; Begin < N; Begin += BlockSize)
+    Threads.emplace_back(Run, Begin, std::min(N, Begin + BlockSize));
+  Run(0, std::min(N, BlockSize));
+  for (auto &T : Threads) T.join();
+  return true;
+}
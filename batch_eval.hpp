@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+struct CodeGenOptions;
+
+// Batch wrappers evaluate a definition over arrays of rows:
+//
+//   void f_batch(const double *a0, ..., const double *aK, double *out,
+//                size_t n);
+//
+// computes out[i] = f(a0[i], ..., aK[i]) for every i < n. The inputs may
+// alias each other, but not out. The names cannot clash with Kaleidoscope
+// identifiers, which have no underscores.
+//
+// MakeBatchModule returns a module with a wrapper for each definition in M,
+// or null if M defines nothing. The wrappers call private copies of the
+// definitions, so the scalar bodies are inlined into the loops, and the
+// module is optimized at O3, with the rest of Options, and TM's cost model,
+// which vectorizes the loops for TM's SIMD width. The functions are marked
+// with TM's CPU and features, so the JIT generates code for TM even where
+// its own TargetMachine is generic: pass createHostTargetMachine() to tune
+// the loops for this machine.
+std::unique_ptr<llvm::Module> MakeBatchModule(const llvm::Module &M,
+                                              llvm::TargetMachine &TM,
+                                              const CodeGenOptions &Options);
+
+// The most inputs CallBatch passes to a wrapper.
+const unsigned MaxBatchArgs = 6;
+
+// Run the wrapper at Wrapper over N rows of Args, split into contiguous
+// blocks across up to NumThreads threads when N is large. Returns false if
+// the wrapper has more than MaxBatchArgs inputs.
+bool CallBatch(llvm::JITTargetAddress Wrapper,
+               llvm::ArrayRef<const double *> Args, double *Out, size_t N,
+               unsigned NumThreads = 1);
@@ -0,0 +1,60 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "aot.hpp"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "synthetic.hpp"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+// Startup cost of a 10k-definition prelude: JIT-compiling it one definition
+// at a time, as the REPL does, against loading it precompiled with
+// --preload.
+KALEIDOSCOPE_BENCH(aot) {
+  std::string Source = GenerateProgram(10000);
+  llvm::SmallString<128> Ks, Lib;
+  int FD;
+  if (llvm::sys::fs::createTemporaryFile("prelude", "ks", FD, Ks) ||
+      llvm::sys::fs::createTemporaryFile("prelude", "so", Lib)) {
+    fprintf(stderr, "aot: cannot create temporary files\n");
+    return;
+  }
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Source;
+  }
+
+  {
+    Stopwatch W;
+    CodeGenVisitor CG;
+    ForEachDefinition(Source, [&](std::unique_ptr<FunctionAST> F) {
+      if (!F->Accept(CG)) return;
+      CG.TheJIT->addModule(std::move(CG.TheModule));
+      CG.InitializeModuleAndPassManager();
+    });
+    ReportRate("aot-startup", "jit", W.seconds(), Source.size(), 10000,
+               "functions");
+  }
+
+  {
+    Stopwatch W;
+    if (CompileAOT(Ks.str().str(), Lib.str().str(), CodeGenOptions(),
+                   llvm::CodeGenOpt::Default))
+      return;
+    ReportRate("aot-build", "so", W.seconds(), Source.size(), 10000,
+               "functions");
+  }
+  {
+    Stopwatch W;
+    CodeGenVisitor CG;
+    PreloadLibrary(Lib.str().str(), CG.FunctionProtos);
+    ReportRate("aot-startup", "preload", W.seconds(), Source.size(), 10000,
+               "functions");
+  }
+  llvm::sys::fs::remove(Ks);
+  llvm::sys::fs::remove(Lib);
+}
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "synthetic.hpp"
+
+// The AST as it was before arena allocation: one heap node per expression, a
+// vtable and an owned std::string per name. Kept here as the comparison point
+// for parsing and for the dispatch cost of walking the tree.
+namespace legacy {
+
+struct ExprAST {
+  virtual ~ExprAST() {}
+  virtual double Walk() const = 0;
+};
+struct NumberExprAST : ExprAST {
+  double Val;
+  NumberExprAST(double Val) : Val(Val) {}
+  double Walk() const override { return Val; }
+};
+struct VariableExprAST : ExprAST {
+  std::string Name;
+  VariableExprAST(const std::string &Name) : Name(Name) {}
+  double Walk() const override { return Name.size(); }
+};
+struct BinaryExprAST : ExprAST {
+  char Op;
+  std::unique_ptr<ExprAST> LHS, RHS;
+  BinaryExprAST(char Op, std::unique_ptr<ExprAST> LHS,
+                std::unique_ptr<ExprAST> RHS)
+      : Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+  double Walk() const override { return LHS->Walk() + RHS->Walk() + Op; }
+};
+struct CallExprAST : ExprAST {
+  std::string Callee;
+  std::vector<std::unique_ptr<ExprAST>> Args;
+  CallExprAST(const std::string &Callee,
+              std::vector<std::unique_ptr<ExprAST>> Args)
+      : Callee(Callee), Args(std::move(Args)) {}
+  double Walk() const override {
+    double R = Callee.size();
+    for (auto &A : Args) R += A->Walk();
+    return R;
+  }
+};
+
+class Parser {
+  std::map<char, int> BinopPrecedence = {
+      {'<', 10}, {'+', 20}, {'-', 20}, {'*', 40}};
+
+  int GetTokPrecedence() {
+    if (!isascii(getCurrentToken().type)) return -1;
+    int TokPrec = BinopPrecedence[getCurrentToken().type];
+    return TokPrec <= 0 ? -1 : TokPrec;
+  }
+
+  std::unique_ptr<ExprAST> ParsePrimary() {
+    switch (getCurrentToken().type) {
+      case tok_number: {
+        auto R = std::make_unique<NumberExprAST>(getCurrentToken().NumVal);
+        getNextToken();
+        return std::move(R);
+      }
+      case '(': {
+        getNextToken();
+        auto V = ParseExpression();
+        getNextToken();
+        return V;
+      }
+      case tok_identifier:
+        break;
+      default:
+        return nullptr;
+    }
+    std::string IdName = getCurrentToken().IdentifierStr.str();
+    getNextToken();
+    if (getCurrentToken().type != '(')
+      return std::make_unique<VariableExprAST>(IdName);
+    getNextToken();
+    std::vector<std::unique_ptr<ExprAST>> Args;
+    while (getCurrentToken().type != ')') {
+      auto Arg = ParseExpression();
+      if (!Arg) return nullptr;
+      Args.push_back(std::move(Arg));
+      if (getCurrentToken().type == ',') getNextToken();
+    }
+    getNextToken();
+    return std::make_unique<CallExprAST>(IdName, std::move(Args));
+  }
+
+  std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
+                                         std::unique_ptr<ExprAST> LHS) {
+    while (1) {
+      int TokPrec = GetTokPrecedence();
+      if (TokPrec < ExprPrec) return LHS;
+      int BinOp = getCurrentToken().type;
+      getNextToken();
+      auto RHS = ParsePrimary();
+      if (!RHS) return nullptr;
+      if (TokPrec < GetTokPrecedence()) {
+        RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
+        if (!RHS) return nullptr;
+      }
+      LHS = std::make_unique<BinaryExprAST>(BinOp, std::move(LHS),
+                                            std::move(RHS));
+    }
+  }
+
+ public:
+  std::unique_ptr<ExprAST> ParseExpression() {
+    auto LHS = ParsePrimary();
+    if (!LHS) return nullptr;
+    return ParseBinOpRHS(0, std::move(LHS));
+  }
+
+  // def name(args) body, with the prototype kept as in the old tree.
+  std::unique_ptr<ExprAST> ParseDefinition(std::string &Name,
+                                           std::vector<std::string> &Args) {
+    getNextToken();
+    Name = getCurrentToken().IdentifierStr.str();
+    getNextToken();
+    while (getNextToken() == tok_identifier)
+      Args.push_back(getCurrentToken().IdentifierStr.str());
+    getNextToken();
+    return ParseExpression();
+  }
+};
+
+}  // namespace legacy
+
+// Arena-tree counterpart of legacy::ExprAST::Walk: same work, dispatched on
+// the node kind.
+static double Walk(const ExprAST *E) {
+  switch (E->getKind()) {
+    case ExprAST::EK_Number:
+      return llvm::cast<NumberExprAST>(E)->Val;
+    case ExprAST::EK_Variable:
+      return Symbols().name(llvm::cast<VariableExprAST>(E)->Name).size();
+    case ExprAST::EK_Binary: {
+      auto *B = llvm::cast<BinaryExprAST>(E);
+      return Walk(B->LHS) + Walk(B->RHS) + B->Op;
+    }
+    case ExprAST::EK_Call: {
+      auto *C = llvm::cast<CallExprAST>(E);
+      double R = Symbols().name(C->Callee).size();
+      for (auto *A : C->args()) R += Walk(A);
+      return R;
+    }
+  }
+  return 0;
+}
+
+static double Checksum;
+
+// Parse every item of Source with the legacy tree. Items are kept alive when
+// Keep is non-null so they can be walked afterwards.
+static size_t ParseLegacy(const std::string &Source,
+                          std::vector<std::unique_ptr<legacy::ExprAST>> *Keep) {
+  setLexer(std::make_unique<Lexer>(Source));
+  legacy::Parser P;
+  size_t Items = 0;
+  for (getNextToken(); getCurrentToken().type != tok_eof;) {
+    std::unique_ptr<legacy::ExprAST> E;
+    if (getCurrentToken().type == ';') {
+      getNextToken();
+      continue;
+    } else if (getCurrentToken().type == tok_def) {
+      std::string Name;
+      std::vector<std::string> Args;
+      E = P.ParseDefinition(Name, Args);
+    } else {
+      E = P.ParseExpression();
+    }
+    if (!E) getNextToken();
+    Items++;
+    if (Keep && E) Keep->push_back(std::move(E));
+  }
+  return Items;
+}
+
+static size_t ParseArena(const std::string &Source,
+                         std::vector<std::unique_ptr<FunctionAST>> *Keep,
+                         size_t &Slabs) {
+  setLexer(std::make_unique<Lexer>(Source));
+  Parser P;
+  size_t Items = 0;
+  for (getNextToken(); getCurrentToken().type != tok_eof;) {
+    std::unique_ptr<FunctionAST> F;
+    if (getCurrentToken().type == ';') {
+      getNextToken();
+      continue;
+    } else if (getCurrentToken().type == tok_def) {
+      F = P.ParseDefinition();
+    } else {
+      F = P.ParseTopLevelExpr();
+    }
+    if (!F) {
+      getNextToken();
+      continue;
+    }
+    Items++;
+    Slabs += F->Arena.GetNumSlabs();
+    if (Keep) Keep->push_back(std::move(F));
+  }
+  return Items;
+}
+
+KALEIDOSCOPE_BENCH(ast) {
+  std::string Source = GenerateProgram(100000);
+  {
+    size_t A0 = AllocationCount();
+    Stopwatch W;
+    size_t N = ParseLegacy(Source, nullptr);
+    double T = W.seconds();
+    ReportRate("ast-parse", "unique_ptr", T, 0, N, "items");
+    printf("%-16s %-12s allocations=%zu\n", "ast-parse", "unique_ptr",
+           AllocationCount() - A0);
+  }
+  {
+    size_t A0 = AllocationCount(), Slabs = 0;
+    Stopwatch W;
+    size_t N = ParseArena(Source, nullptr, Slabs);
+    double T = W.seconds();
+    ReportRate("ast-parse", "arena", T, 0, N, "items");
+    printf("%-16s %-12s allocations=%zu (arena slabs %zu)\n", "ast-parse",
+           "arena", AllocationCount() - A0, Slabs);
+  }
+
+  // Dispatch cost of walking a cache-resident set of items, the way codegen
+  // sees them one top-level item at a time.
+  std::string Small = GenerateProgram(2000);
+  {
+    std::vector<std::unique_ptr<legacy::ExprAST>> Items;
+    ParseLegacy(Small, &Items);
+    Stopwatch W;
+    for (int Rep = 0; Rep < 200; Rep++)
+      for (auto &E : Items) Checksum += E->Walk();
+    ReportRate("ast-walk", "virtual", W.seconds(), 0, 200.0 * Items.size(),
+               "items");
+  }
+  {
+    std::vector<std::unique_ptr<FunctionAST>> Items;
+    size_t Slabs = 0;
+    ParseArena(Small, &Items, Slabs);
+    Stopwatch W;
+    for (int Rep = 0; Rep < 200; Rep++)
+      for (auto &F : Items) Checksum += Walk(F->Body);
+    ReportRate("ast-walk", "kind-switch", W.seconds(), 0,
+               200.0 * Items.size(), "items");
+  }
+
+  // Codegen of the arena tree to IR, without handing modules to the JIT.
+  {
+    CodeGenVisitor CG;
+    std::vector<std::unique_ptr<FunctionAST>> Items;
+    size_t Slabs = 0;
+    ParseArena(GenerateProgram(10000), &Items, Slabs);
+    size_t A0 = AllocationCount();
+    Stopwatch W;
+    for (auto &F : Items) {
+      if (F->Proto->Name == sym_anon_expr) continue;
+      F->Accept(CG);
+    }
+    double T = W.seconds();
+    ReportRate("ast-codegen", "arena", T, 0, Items.size(), "items");
+    printf("%-16s %-12s allocations=%zu\n", "ast-codegen", "arena",
+           AllocationCount() - A0);
+  }
+
+  if (Checksum == 0) printf("\n");
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "synthetic.hpp"
+
+// Load every definition of Source into a fresh JIT, either one module per
+// definition the way the REPL does, or FunctionsPerModule definitions per
+// module optimized once, the way kaleidoscope -c does. Top-level expressions
+// are skipped. With Lazy, modules go behind compile-on-demand stubs and are
+// never called, so this measures the cost of defining alone.
+static void LoadDefinitions(const std::string &Source, bool Batch,
+                            unsigned FunctionsPerModule, bool Lazy = false) {
+  CodeGenVisitor CG;
+  CG.OptimizeEachFunction = !Batch && !Lazy;
+  CG.KeepContext = Lazy;
+  unsigned InModule = 0;
+  ForEachDefinition(Source, [&](std::unique_ptr<FunctionAST> F) {
+    if (!F->Accept(CG)) return;
+    if (Batch && ++InModule < FunctionsPerModule) return;
+    if (Batch && !Lazy) CG.OptimizeModule();
+    if (Lazy)
+      CG.TheJIT->addLazyModule(std::move(CG.TheModule));
+    else
+      CG.TheJIT->addModule(std::move(CG.TheModule));
+    CG.InitializeModuleAndPassManager();
+    InModule = 0;
+  });
+  if (InModule) {
+    if (!Lazy) CG.OptimizeModule();
+    if (Lazy)
+      CG.TheJIT->addLazyModule(std::move(CG.TheModule));
+    else
+      CG.TheJIT->addModule(std::move(CG.TheModule));
+  }
+}
+
+KALEIDOSCOPE_BENCH(batch) {
+  std::string Source = GenerateProgram(10000);
+  {
+    Stopwatch W;
+    LoadDefinitions(Source, false, 1);
+    ReportRate("batch-startup", "per-def", W.seconds(), Source.size(), 10000,
+               "functions");
+  }
+  for (unsigned PerModule : {256u, 4096u}) {
+    Stopwatch W;
+    LoadDefinitions(Source, true, PerModule);
+    std::string Variant = "batch/" + std::to_string(PerModule);
+    ReportRate("batch-startup", Variant.c_str(), W.seconds(), Source.size(),
+               10000, "functions");
+  }
+  for (bool Batch : {false, true}) {
+    Stopwatch W;
+    LoadDefinitions(Source, Batch, 4096, /*Lazy=*/true);
+    ReportRate("batch-startup", Batch ? "lazy/4096" : "lazy/per-def",
+               W.seconds(), Source.size(), 10000, "functions");
+  }
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_eval.hpp"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+// Rows per second for a three-input formula: a scalar loop over the JIT'd
+// function against its batch wrapper, on one thread and on several.
+KALEIDOSCOPE_BENCH(batch_eval) {
+  CodeGenVisitor CG;
+  Parser P;
+  std::string Def =
+      "def f(a b c) (a * b + c * c - a * 0.5) * (b < c) + (c - b) * 0.25;";
+  setLexer(std::make_unique<Lexer>(Def));
+  getNextToken();
+  P.ParseDefinition()->Accept(CG);
+  CG.TheJIT->addModule(MakeBatchModule(
+      *CG.TheModule, *CG.TheJIT->createHostTargetMachine(), CG.Options));
+  CG.TheJIT->addModule(std::move(CG.TheModule));
+  CG.InitializeModuleAndPassManager();
+
+  auto Scalar = (double (*)(double, double, double))llvm::cantFail(
+      CG.TheJIT->findSymbol("f").getAddress());
+  auto Batch = llvm::cantFail(CG.TheJIT->findSymbol("f_batch").getAddress());
+
+  const size_t N = 1 << 22;
+  std::vector<double> A(N), B(N), C(N), Out(N);
+  for (size_t i = 0; i < N; i++) {
+    A[i] = i * 0.001;
+    B[i] = (i % 97) * 0.5;
+    C[i] = (i % 89) * 0.5;
+  }
+  const double *Args[] = {A.data(), B.data(), C.data()};
+
+  {
+    Stopwatch W;
+    for (size_t i = 0; i < N; i++) Out[i] = Scalar(A[i], B[i], C[i]);
+    ReportRate("batch-eval", "scalar-loop", W.seconds(), N * 32.0, N, "rows");
+  }
+  unsigned MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned Threads : {1u, 4u, MaxThreads}) {
+    Stopwatch W;
+    CallBatch(Batch, Args, Out.data(), N, Threads);
+    std::string Variant = "batch/" + std::to_string(Threads) + "t";
+    ReportRate("batch-eval", Variant.c_str(), W.seconds(), N * 32.0, N,
+               "rows");
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Minimal harness for kaleidoscope_bench. Each benchmark registers itself with
+// KALEIDOSCOPE_BENCH and is selected by name on the command line.
+
+using BenchFn = void (*)();
+
+struct BenchRegistration {
+  BenchRegistration(const char *Name, BenchFn Fn);
+};
+
+#define KALEIDOSCOPE_BENCH(Name)                     \
+  static void Name();                                \
+  static BenchRegistration Name##_reg(#Name, &Name); \
+  static void Name()
+
+// Wall-clock stopwatch.
+class Stopwatch {
+  std::chrono::steady_clock::time_point Start;
+
+ public:
+  Stopwatch() : Start(std::chrono::steady_clock::now()) {}
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         Start)
+        .count();
+  }
+};
+
+// Runs per measurement taken with MedianSeconds (--repeat, default 5).
+unsigned Repetitions();
+
+// Median wall time of Repetitions() runs of Body. Setup that must not be
+// timed, such as re-parsing input a run consumes, goes in Before.
+template <typename SetupFn, typename BodyFn>
+double MedianSeconds(SetupFn &&Before, BodyFn &&Body) {
+  std::vector<double> Times;
+  for (unsigned Run = 0; Run < Repetitions(); Run++) {
+    Before();
+    Stopwatch W;
+    Body();
+    Times.push_back(W.seconds());
+  }
+  std::sort(Times.begin(), Times.end());
+  return Times[Times.size() / 2];
+}
+template <typename BodyFn>
+double MedianSeconds(BodyFn &&Body) {
+  return MedianSeconds([] {}, Body);
+}
+
+// Number of operator new calls made by this thread so far (stats.cpp).
+size_t AllocationCount();
+
+// Print one result line: "<bench> <variant> <metric>=<value> ...". The time
+// is also what --csv records and --baseline compares.
+void ReportRate(const char *Bench, const char *Variant, double Seconds,
+                double Bytes, double Items, const char *ItemName);
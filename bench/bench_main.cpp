@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bench.hpp"
+
+static std::vector<std::pair<const char *, BenchFn>> &Registry() {
+  static std::vector<std::pair<const char *, BenchFn>> R;
+  return R;
+}
+
+BenchRegistration::BenchRegistration(const char *Name, BenchFn Fn) {
+  Registry().emplace_back(Name, Fn);
+}
+
+// Every reported time, for --csv and --baseline.
+struct Result {
+  std::string Bench, Variant;
+  double Seconds;
+};
+static std::vector<Result> Results;
+static unsigned Repeat = 5;
+
+unsigned Repetitions() { return Repeat; }
+
+void ReportRate(const char *Bench, const char *Variant, double Seconds,
+                double Bytes, double Items, const char *ItemName) {
+  printf("%-16s %-12s time=%.4fs", Bench, Variant, Seconds);
+  if (Bytes > 0) printf(" MB/s=%.1f", Bytes / Seconds / (1 << 20));
+  if (Items > 0) printf(" %s/s=%.0f", ItemName, Items / Seconds);
+  printf("\n");
+  Results.push_back({Bench, Variant, Seconds});
+}
+
+// Results are written as "bench,variant,seconds" lines.
+static bool WriteCSV(const char *Path) {
+  FILE *F = fopen(Path, "w");
+  if (!F) {
+    fprintf(stderr, "cannot write %s\n", Path);
+    return false;
+  }
+  fprintf(F, "bench,variant,seconds\n");
+  for (auto &R : Results)
+    fprintf(F, "%s,%s,%.9f\n", R.Bench.c_str(), R.Variant.c_str(), R.Seconds);
+  fclose(F);
+  return true;
+}
+
+// Compare this run against a CSV written by an earlier --csv run. Returns
+// the number of results more than Threshold percent slower.
+static int CompareWithBaseline(const char *Path, double Threshold) {
+  FILE *F = fopen(Path, "r");
+  if (!F) {
+    fprintf(stderr, "cannot read %s\n", Path);
+    return -1;
+  }
+  std::map<std::pair<std::string, std::string>, double> Baseline;
+  char Line[512];
+  while (fgets(Line, sizeof(Line), F)) {
+    char *Comma1 = strchr(Line, ',');
+    char *Comma2 = Comma1 ? strchr(Comma1 + 1, ',') : nullptr;
+    if (!Comma2) continue;
+    Baseline[{std::string(Line, Comma1),
+              std::string(Comma1 + 1, Comma2)}] = strtod(Comma2 + 1, nullptr);
+  }
+  fclose(F);
+
+  int Regressions = 0;
+  printf("\n%-16s %-12s %12s %12s %8s\n", "bench", "variant", "baseline",
+         "now", "change");
+  for (auto &R : Results) {
+    auto B = Baseline.find({R.Bench, R.Variant});
+    if (B == Baseline.end() || B->second <= 0) continue;
+    double Change = (R.Seconds / B->second - 1) * 100;
+    bool Regressed = Change > Threshold;
+    Regressions += Regressed;
+    printf("%-16s %-12s %11.4fs %11.4fs %+7.1f%%%s\n", R.Bench.c_str(),
+           R.Variant.c_str(), B->second, R.Seconds, Change,
+           Regressed ? "  REGRESSION" : "");
+  }
+  return Regressions;
+}
+
+// kaleidoscope_bench [--repeat=N] [--csv=out.csv] [--baseline=old.csv]
+//                    [--threshold=percent] [name...]
+// Run the named benchmarks, or all of them. With --baseline, exit with 1 if
+// any result is more than --threshold (default 10) percent slower than in
+// the baseline.
+int main(int argc, char **argv) {
+  const char *CSV = nullptr, *BaselinePath = nullptr;
+  double Threshold = 10;
+  std::vector<const char *> Names;
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--repeat=", 9))
+      Repeat = std::max(1, atoi(argv[i] + 9));
+    else if (!strncmp(argv[i], "--csv=", 6))
+      CSV = argv[i] + 6;
+    else if (!strncmp(argv[i], "--baseline=", 11))
+      BaselinePath = argv[i] + 11;
+    else if (!strncmp(argv[i], "--threshold=", 12))
+      Threshold = atof(argv[i] + 12);
+    else
+      Names.push_back(argv[i]);
+  }
+
+  for (auto &B : Registry()) {
+    bool Selected = Names.empty();
+    for (const char *Name : Names)
+      if (!strcmp(Name, B.first)) Selected = true;
+    if (Selected) B.second();
+  }
+
+  if (CSV && !WriteCSV(CSV)) return 1;
+  if (BaselinePath) {
+    int Regressions = CompareWithBaseline(BaselinePath, Threshold);
+    if (Regressions) return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "engine.hpp"
+#include "synthetic.hpp"
+
+// Programs compiled and run per second by N threads, each with engines of its
+// own: every program gets a fresh Engine, is compiled, has its top-level
+// expressions evaluated and one function called through its pointer.
+KALEIDOSCOPE_BENCH(engines) {
+  std::string Source = GenerateProgram(256) + "def square(x) x * x;\n";
+  const unsigned ProgramsPerThread = 8;
+  unsigned Cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned NumThreads : {1u, 2u, 4u, 8u, 16u}) {
+    if (NumThreads > 2 * Cores) break;
+    std::vector<unsigned> Failures(NumThreads);
+    Stopwatch W;
+    std::vector<std::thread> Threads;
+    for (unsigned t = 0; t < NumThreads; t++)
+      Threads.emplace_back([&, t] {
+        for (unsigned Run = 0; Run < ProgramsPerThread; Run++) {
+          Engine E;
+          std::vector<double> Results;
+          auto *F = E.compile(Source, &Results)
+                        ? E.function<double>("square")
+                        : nullptr;
+          if (!F || Results.empty() || F(1.5) != 2.25) Failures[t]++;
+        }
+      });
+    for (auto &T : Threads) T.join();
+    double Seconds = W.seconds();
+
+    std::string Variant = "threads/" + std::to_string(NumThreads);
+    ReportRate("engines", Variant.c_str(), Seconds,
+               double(Source.size()) * NumThreads * ProgramsPerThread,
+               NumThreads * ProgramsPerThread, "programs");
+    for (unsigned F : Failures)
+      if (F) fprintf(stderr, "engines: %u programs failed\n", F);
+  }
+}
+
+// What Engine's stubs cost: a call tree evaluated through an Engine, where
+// each call that was not inlined goes through a stub, and through the same
+// module added to a plain JIT, where calls are direct. The default passes
+// inline nothing, so that is every call.
+KALEIDOSCOPE_BENCH(engine_calls) {
+  const unsigned Depth = 20;
+  std::string Source = GenerateCallTree(Depth);
+  std::string Root = "h" + std::to_string(Depth);
+  const double Calls = double(2 << Depth) - 1;
+
+  Engine E;
+  auto *Stubbed = E.compile(Source) ? E.function<double>(Root) : nullptr;
+  CodeGenVisitor CG;
+  CG.OptimizeEachFunction = false;
+  CompileLibrary(CG, Source);
+  CG.OptimizeModule();
+  CG.TheJIT->addModule(std::move(CG.TheModule));
+  auto *Direct = (double (*)(double))llvm::cantFail(
+      CG.TheJIT->findSymbol(Root).getAddress());
+  if (!Stubbed || Stubbed(0.5) != Direct(0.5)) {
+    fprintf(stderr, "engine_calls: results differ\n");
+    return;
+  }
+
+  double Sum = 0;
+  for (auto &Variant : {std::make_pair("stubs", Stubbed),
+                        std::make_pair("direct", Direct)}) {
+    double T = MedianSeconds([&] { Sum += Variant.second(0.5); });
+    ReportRate("engine-calls", Variant.first, T, 0, Calls, "calls");
+  }
+  if (Sum == 0) printf("\n");
+}
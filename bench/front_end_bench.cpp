@@ -0,0 +1,52 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "front_end.hpp"
+#include "synthetic.hpp"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+// ParseFiles over a library spread across many files, as loaded at startup,
+// on one thread and on more. Time should fall with the thread count up to
+// the number of cores; the single-threaded run skips the per-file interners
+// and the merge, so the difference includes that overhead.
+KALEIDOSCOPE_BENCH(front_end) {
+  const unsigned Files = 32, DefsPerFile = 2000;
+  std::vector<std::string> Paths;
+  size_t Bytes = 0;
+  for (unsigned I = 0; I < Files; I++) {
+    int FD;
+    llvm::SmallString<128> Path;
+    if (llvm::sys::fs::createTemporaryFile("front_end", "ks", FD, Path)) {
+      fprintf(stderr, "front_end: cannot create a temporary file\n");
+      return;
+    }
+    std::string Source = GenerateProgram(DefsPerFile, I + 1);
+    Bytes += Source.size();
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Source;
+    Paths.push_back(Path.str().str());
+  }
+
+  unsigned MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned> Counts = {1, 2, 4, 8};
+  if (std::find(Counts.begin(), Counts.end(), MaxThreads) == Counts.end())
+    Counts.push_back(MaxThreads);
+  size_t NumItems = 0;
+  for (unsigned Threads : Counts) {
+    std::vector<SourceItem> Items;
+    double T = MedianSeconds([&] { Items.clear(); },
+                             [&] { ParseFiles(Paths, Threads, Items); });
+    NumItems = Items.size();
+    std::string Variant = std::to_string(Threads) + "t";
+    ReportRate("front-end", Variant.c_str(), T, Bytes, NumItems, "items");
+  }
+  printf("front_end: %u files, %zu items, %u cores\n", Files, NumItems,
+         MaxThreads);
+  for (auto &Path : Paths) llvm::sys::fs::remove(Path);
+}
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "KaleidoscopeJIT.h"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+// KaleidoscopeJIT::findSymbol as the JIT fills up with one module per
+// definition, as in the REPL. Lookup time should not depend on how many
+// modules there are: neither for the oldest definition, nor for a name that
+// only the host process defines, nor for a module's first lookup, which
+// links it.
+KALEIDOSCOPE_BENCH(jit_lookup) {
+  CodeGenVisitor CG;
+  Parser P;
+  auto &JIT = *CG.TheJIT;
+  const unsigned Lookups = 100000;
+  unsigned Defined = 0;
+  double Checksum = 0;
+
+  auto Define = [&](const std::string &Source) {
+    setLexer(std::make_unique<Lexer>(Source));
+    for (getNextToken(); getCurrentToken().type != tok_eof;) {
+      if (getCurrentToken().type == ';') {
+        getNextToken();
+        continue;
+      }
+      auto F = P.ParseDefinition();
+      if (!F || !F->Accept(CG)) {
+        getNextToken();
+        continue;
+      }
+      JIT.addModule(std::move(CG.TheModule));
+      CG.InitializeModuleAndPassManager();
+    }
+  };
+  auto Lookup = [&](const char *Name) {
+    auto Addr = llvm::cantFail(JIT.findSymbol(Name).getAddress());
+    Checksum += Addr != 0;
+  };
+
+  for (unsigned N : {10u, 100u, 1000u, 10000u}) {
+    std::string Source;
+    for (; Defined < N; Defined++)
+      Source += "def f" + std::to_string(Defined) + "(x) x + " +
+                std::to_string(Defined) + ";\n";
+    Define(Source);
+
+    std::string Variant = "modules/" + std::to_string(N);
+    double T = MedianSeconds([&] {
+      for (unsigned k = 0; k < Lookups; k++) Lookup("f0");
+    });
+    ReportRate("jit-lookup-oldest", Variant.c_str(), T, 0, Lookups,
+               "lookups");
+    T = MedianSeconds([&] {
+      for (unsigned k = 0; k < Lookups; k++) Lookup("sin");
+    });
+    ReportRate("jit-lookup-host", Variant.c_str(), T, 0, Lookups, "lookups");
+
+    // Define more and link each on its first lookup.
+    const unsigned Fresh = 100;
+    std::string Names[Fresh];
+    T = MedianSeconds(
+        [&] {
+          std::string More;
+          for (unsigned k = 0; k < Fresh; k++, Defined++) {
+            Names[k] = "f" + std::to_string(Defined);
+            More += "def " + Names[k] + "(x) x;\n";
+          }
+          Define(More);
+        },
+        [&] {
+          for (auto &Name : Names) Lookup(Name.c_str());
+        });
+    ReportRate("jit-lookup-first", Variant.c_str(), T, 0, Fresh, "lookups");
+  }
+  if (Checksum == 0) printf("\n");
+}
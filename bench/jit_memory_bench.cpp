@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+
+// Resident set size, from /proc/self/statm; 0 where that is unavailable.
+static size_t ResidentBytes() {
+  FILE *F = fopen("/proc/self/statm", "r");
+  if (!F) return 0;
+  size_t Size = 0, Resident = 0;
+  if (fscanf(F, "%zu %zu", &Size, &Resident) != 2) Resident = 0;
+  fclose(F);
+  return Resident * sysconf(_SC_PAGESIZE);
+}
+
+// The REPL's evaluate-and-discard cycle for a top-level expression, minus
+// compiling it: load its object into the JIT, look up __anon_expr, call it
+// and remove the object again. The object is compiled once up front, so
+// what is measured is how the JIT places, links and reclaims memory. RSS
+// must not grow with the number of cycles.
+//
+// Then the REPL's usual mix: every expression follows a definition that
+// stays loaded, so the pool has to reuse the pages of discarded
+// expressions between live definitions.
+KALEIDOSCOPE_BENCH(jit_memory) {
+  CodeGenVisitor CG;
+  Parser P;
+  setLexer(std::make_unique<Lexer>("(1 + 2) * 3 - 0.5;"));
+  getNextToken();
+  auto F = P.ParseTopLevelExpr();
+  if (!F || !F->Accept(CG)) {
+    fprintf(stderr, "jit_memory: cannot compile the expression\n");
+    return;
+  }
+  CG.OptimizeModule();
+  auto Obj = llvm::orc::SimpleCompiler(CG.TheJIT->getTargetMachine())(
+      *CG.TheModule);
+  CG.InitializeModuleAndPassManager();
+  setLexer(std::make_unique<Lexer>("def f(x) x * 0.75 + 1.25;"));
+  getNextToken();
+  auto Def = P.ParseDefinition();
+  if (!Def || !Def->Accept(CG)) {
+    fprintf(stderr, "jit_memory: cannot compile the definition\n");
+    return;
+  }
+  CG.OptimizeModule();
+  auto DefObj = llvm::orc::SimpleCompiler(CG.TheJIT->getTargetMachine())(
+      *CG.TheModule);
+  auto &JIT = *CG.TheJIT;
+
+  const double Expected = (1.0 + 2) * 3 - 0.5;
+  size_t Wrong = 0;
+  auto Cycles = [&](unsigned N) {
+    for (unsigned k = 0; k < N; k++) {
+      auto K = JIT.addObject(
+          llvm::MemoryBuffer::getMemBuffer(Obj->getMemBufferRef(), false));
+      auto Addr = llvm::cantFail(JIT.findSymbol("__anon_expr").getAddress());
+      Wrong += ((double (*)())(intptr_t)Addr)() != Expected;
+      JIT.removeModule(K);
+    }
+  };
+
+  for (unsigned N : {1000u, 10000u}) {
+    double T = MedianSeconds([&] { Cycles(N); });
+    ReportRate("jit-memory", ("cycles/" + std::to_string(N)).c_str(), T, 0,
+               N, "cycles");
+  }
+
+  // Once the pool has warmed up, a million more cycles run in place.
+  size_t Before = ResidentBytes();
+  Stopwatch W;
+  Cycles(1000000);
+  double T = W.seconds();
+  size_t After = ResidentBytes();
+  ReportRate("jit-memory", "soak/1000000", T, 0, 1000000, "cycles");
+  auto &Pool = JIT.getMemoryPool();
+  printf("jit-memory rss before=%zuKiB after=%zuKiB; pool live=%zu peak=%zu "
+         "mapped=%zu\n",
+         Before >> 10, After >> 10, Pool.liveBytes(), Pool.peakBytes(),
+         Pool.mappedBytes());
+
+  // Mapped bytes per definition stay near the pages the definitions are
+  // sealed on, however many expressions run between them.
+  const unsigned Defs = 20000;
+  std::vector<llvm::orc::VModuleKey> Kept;
+  size_t MappedBefore = Pool.mappedBytes();
+  W = Stopwatch();
+  for (unsigned k = 0; k < Defs; k++) {
+    Kept.push_back(JIT.addObject(
+        llvm::MemoryBuffer::getMemBuffer(DefObj->getMemBufferRef(), false)));
+    llvm::cantFail(JIT.findSymbol("f").getAddress());
+    Cycles(1);
+  }
+  T = W.seconds();
+  ReportRate("jit-memory", ("mixed/" + std::to_string(Defs)).c_str(), T, 0,
+             Defs, "definitions");
+  size_t LiveMixed = Pool.liveBytes();
+  size_t MappedMixed = Pool.mappedBytes() - MappedBefore;
+  for (auto K : Kept) JIT.removeModule(K);
+  printf("jit-memory mixed: %u definitions, pool live=%zu mapped=+%zu "
+         "(%zu bytes per definition), mapped=%zu once removed\n",
+         Defs, LiveMixed, MappedMixed, MappedMixed / Defs,
+         Pool.mappedBytes());
+  if (Wrong) fprintf(stderr, "jit_memory: %zu wrong results\n", Wrong);
+}
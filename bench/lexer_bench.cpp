@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "bench.hpp"
+#include "lexer.hpp"
+#include "synthetic.hpp"
+
+// The lexer as it was before it ran over buffers: one getc() per character and
+// identifiers/numbers accumulated with +=. Kept here as the comparison point.
+static int LegacyGettok(FILE *F, int &LastChar, std::string &IdentifierStr,
+                        double &NumVal) {
+  while (isspace(LastChar)) LastChar = getc(F);
+
+  if (isalpha(LastChar)) {
+    IdentifierStr = LastChar;
+    while (isalnum((LastChar = getc(F)))) IdentifierStr += LastChar;
+    if (IdentifierStr == "def") return tok_def;
+    if (IdentifierStr == "extern") return tok_extern;
+    return tok_identifier;
+  }
+
+  if (isdigit(LastChar) || LastChar == '.') {
+    std::string NumStr;
+    do {
+      NumStr += LastChar;
+      LastChar = getc(F);
+    } while (isdigit(LastChar) || LastChar == '.');
+    NumVal = strtod(NumStr.c_str(), 0);
+    return tok_number;
+  }
+
+  if (LastChar == '#') {
+    do
+      LastChar = getc(F);
+    while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+    if (LastChar != EOF)
+      return LegacyGettok(F, LastChar, IdentifierStr, NumVal);
+  }
+  if (LastChar == EOF) return tok_eof;
+
+  int ThisChar = LastChar;
+  LastChar = getc(F);
+  return ThisChar;
+}
+
+// Sum of token values keeps the optimizer from dropping the loops.
+static double Checksum;
+
+static size_t LexAll(Lexer &L) {
+  size_t N = 0;
+  for (Token T = L.gettok(); T.type != tok_eof; T = L.gettok(), N++)
+    if (T.type == tok_number) Checksum += T.NumVal;
+  return N;
+}
+
+KALEIDOSCOPE_BENCH(lexer) {
+  std::string Source = GenerateProgram(200000);
+  char Path[] = "/tmp/kaleidoscope_lexer_benchXXXXXX";
+  int FD = mkstemp(Path);
+  if (FD < 0 ||
+      write(FD, Source.data(), Source.size()) != (ssize_t)Source.size()) {
+    fprintf(stderr, "lexer: cannot write %s\n", Path);
+    return;
+  }
+  close(FD);
+  double Bytes = Source.size();
+
+  {
+    FILE *F = fopen(Path, "r");
+    Stopwatch W;
+    int LastChar = ' ';
+    std::string Ident;
+    double Num = 0;
+    size_t N = 0;
+    for (int T; (T = LegacyGettok(F, LastChar, Ident, Num)) != tok_eof; N++)
+      if (T == tok_number) Checksum += Num;
+    ReportRate("lexer", "getchar", W.seconds(), Bytes, N, "tokens");
+    fclose(F);
+  }
+  {
+    Stopwatch W;
+    auto L = Lexer::fromFile(Path);
+    size_t N = L ? LexAll(*L) : 0;
+    ReportRate("lexer", "mmap", W.seconds(), Bytes, N, "tokens");
+  }
+  {
+    Stopwatch W;
+    Lexer L(Source);
+    size_t N = LexAll(L);
+    ReportRate("lexer", "buffer", W.seconds(), Bytes, N, "tokens");
+  }
+
+  unlink(Path);
+  if (Checksum == 0) printf("\n");
+}
@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "batch_eval.hpp"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "synthetic.hpp"
+#include "vector_math.hpp"
+
+// A transcendental-heavy formula set, evaluated with the math externs as
+// plain library calls, as intrinsics, and as intrinsics that vectorized
+// loops may call libmvec for. Rows are evaluated by the batch wrappers,
+// whose loops are what gets vectorized; "scalar" calls each definition once
+// per row, where only folding helps.
+KALEIDOSCOPE_BENCH(math) {
+  const char *Source =
+      "extern sin(x); extern cos(x); extern exp(x); extern log(x);\n"
+      "extern sqrt(x); extern pow(x y); extern fabs(x); extern fma(x y z);\n"
+      "def wave(x) sin(x) * cos(x * 0.5) + exp(x * 0.001);\n"
+      "def norm(a b) pow(a * a + 1, 0.25) * log(b * b + 1) + "
+      "sqrt(a * a + b * b);\n"
+      "def damp(x) fabs(sin(x) - cos(x * 2)) + fma(x, 0.5, exp(0 - x));\n"
+      "def folded(x) sin(1.5) * x + cos(0.25) * exp(1) + sqrt(2);\n";
+  const struct {
+    const char *Name;
+    unsigned Arity;
+  } Formulas[] = {{"wave", 1}, {"norm", 2}, {"damp", 1}, {"folded", 1}};
+  const size_t N = 1 << 20;
+  std::vector<double> A(N), B(N), Out(N);
+  for (size_t i = 0; i < N; i++) {
+    A[i] = i * 0.0001;
+    B[i] = (i % 97) * 0.25;
+  }
+  const double *Args[] = {A.data(), B.data()};
+
+  const struct {
+    const char *Name;
+    bool Intrinsics, VectorMath;
+  } Modes[] = {
+      {"calls", false, false},
+      {"intrinsics", true, false},
+      {"libmvec", true, true},
+  };
+  for (auto &Mode : Modes) {
+    if (Mode.VectorMath && !VectorMathAvailable()) {
+      printf("math: libmvec is not available\n");
+      continue;
+    }
+    CodeGenOptions Options;
+    Options.VectorMath = Mode.VectorMath;
+    CodeGenVisitor CG(Options);
+    CG.MathIntrinsics = Mode.Intrinsics;
+    CompileLibrary(CG, Source);
+    auto &JIT = *CG.TheJIT;
+    JIT.addModule(
+        MakeBatchModule(*CG.TheModule, *JIT.createHostTargetMachine(),
+                        CG.Options));
+    JIT.addModule(std::move(CG.TheModule));
+    CG.InitializeModuleAndPassManager();
+
+    double Checksum = 0;
+    for (auto &F : Formulas) {
+      std::string Variant = std::string(F.Name) + "/" + Mode.Name;
+      auto Batch = llvm::cantFail(
+          JIT.findSymbol(std::string(F.Name) + "_batch").getAddress());
+      llvm::ArrayRef<const double *> Inputs(Args, F.Arity);
+      double T =
+          MedianSeconds([&] { CallBatch(Batch, Inputs, Out.data(), N); });
+      ReportRate("math-batch", Variant.c_str(), T, 0, N, "rows");
+      Checksum += Out[N / 2];
+
+      auto Addr = llvm::cantFail(JIT.findSymbol(F.Name).getAddress());
+      T = MedianSeconds([&] {
+        if (F.Arity == 2) {
+          auto *Fn = (double (*)(double, double))(intptr_t)Addr;
+          for (size_t i = 0; i < N; i++) Out[i] = Fn(A[i], B[i]);
+        } else {
+          auto *Fn = (double (*)(double))(intptr_t)Addr;
+          for (size_t i = 0; i < N; i++) Out[i] = Fn(A[i]);
+        }
+      });
+      ReportRate("math-scalar", Variant.c_str(), T, 0, N, "rows");
+      Checksum += Out[N / 2];
+    }
+    printf("math %s: checksum %.17g\n", Mode.Name, Checksum);
+  }
+}
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "KaleidoscopeJIT.h"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "memoize.hpp"
+#include "synthetic.hpp"
+
+// Calls to a memoized function against calls to the same definition
+// compiled as is, for a body that is expensive next to a cache probe and one
+// that is not. Repeated calls cycle through fewer distinct arguments than
+// the cache holds; unique ones never repeat one, so every memoized call
+// pays for the probe and the insertion on top of the body.
+KALEIDOSCOPE_BENCH(memoize) {
+  const char *Source =
+      "extern sin(x); extern exp(x); extern sqrt(x);\n"
+      "def cheap(x) x * x + 1;\n"
+      "def costly(x) sin(x) * sin(x + 1) + exp(x * 0.5) * sqrt(x * x + 1) + "
+      "sin(exp(sin(x)));\n";
+  const unsigned Calls = 1000000, Distinct = 256;
+
+  for (bool Memoized : {false, true}) {
+    CodeGenVisitor CG;
+    auto &JIT = *CG.TheJIT;
+    Memoizer Memo(JIT, 4096, 2, Memoizer::Eviction::FIFO);
+    CompileLibrary(CG, Source);
+    if (Memoized) Memo.instrument(*CG.TheModule);
+    JIT.addModule(std::move(CG.TheModule));
+
+    for (const char *Name : {"cheap", "costly"}) {
+      auto Addr = llvm::cantFail(JIT.findSymbol(Name).getAddress());
+      auto *Fn = (double (*)(double))(intptr_t)Addr;
+      double Sum = 0;
+      std::string Variant = std::string(Name) + "/" +
+                            (Memoized ? "memoized" : "plain");
+      double T = MedianSeconds([&] {
+        for (unsigned k = 0; k < Calls; k++) Sum += Fn(k % Distinct);
+      });
+      ReportRate("memoize-repeat", Variant.c_str(), T, 0, Calls, "calls");
+      double Next = 0;
+      T = MedianSeconds([&] {
+        for (unsigned k = 0; k < Calls; k++) Sum += Fn(Next += 0.5);
+      });
+      ReportRate("memoize-unique", Variant.c_str(), T, 0, Calls, "calls");
+      if (Sum == 0) printf("\n");
+    }
+  }
+}
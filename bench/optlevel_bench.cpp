@@ -0,0 +1,70 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "synthetic.hpp"
+
+static const struct {
+  const char *Pipeline;
+  llvm::CodeGenOpt::Level CodeGenLevel;
+} Levels[] = {
+    {"instcombine,reassociate,gvn,simplifycfg", llvm::CodeGenOpt::Default},
+    {"O0", llvm::CodeGenOpt::None},
+    {"O1", llvm::CodeGenOpt::Less},
+    {"O2", llvm::CodeGenOpt::Default},
+    {"O3", llvm::CodeGenOpt::Aggressive},
+    {"Os", llvm::CodeGenOpt::Default},
+    {"Oz", llvm::CodeGenOpt::Default},
+};
+
+// Compile the definitions in Source as one optimized module, so the inliner
+// sees all of them.
+static void CompileDefinitions(CodeGenVisitor &CG, const std::string &Source) {
+  CG.OptimizeEachFunction = false;
+  ForEachDefinition(Source,
+                    [&](std::unique_ptr<FunctionAST> F) { F->Accept(CG); });
+  CG.OptimizeModule();
+  CG.TheJIT->addModule(std::move(CG.TheModule));
+  CG.InitializeModuleAndPassManager();
+}
+
+KALEIDOSCOPE_BENCH(optlevels) {
+  std::string Source = GenerateProgram(4096);
+  const unsigned Depth = 20;
+  std::string Tree = GenerateCallTree(Depth);
+  std::string Root = "h" + std::to_string(Depth);
+
+  for (auto &L : Levels) {
+    CodeGenOptions Options;
+    Options.Pipeline = L.Pipeline;
+    const char *Variant = L.Pipeline[0] == 'O' ? L.Pipeline : "default";
+    {
+      CodeGenVisitor CG(Options);
+      CG.TheJIT->getTargetMachine().setOptLevel(L.CodeGenLevel);
+      Stopwatch W;
+      CompileDefinitions(CG, Source);
+      ReportRate("optlevels-compile", Variant, W.seconds(), Source.size(),
+                 4096, "functions");
+    }
+
+    CodeGenVisitor CG(Options);
+    CG.TheJIT->getTargetMachine().setOptLevel(L.CodeGenLevel);
+    CompileDefinitions(CG, Tree);
+    auto Sym = CG.TheJIT->findSymbol(Root);
+    double (*FP)(double) =
+        (double (*)(double))(intptr_t)llvm::cantFail(Sym.getAddress());
+    double Best = 1e9, Sum = 0;
+    for (unsigned Run = 0; Run < 5; Run++) {
+      Stopwatch W;
+      Sum += FP(1.0);
+      Best = std::min(Best, W.seconds());
+    }
+    ReportRate("optlevels-run", Variant, Best, 0, double(1u << Depth),
+               "leaf calls");
+    if (Sum != Sum) fprintf(stderr, "optlevels: NaN\n");
+  }
+}
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "perf_jit.hpp"
+#include "synthetic.hpp"
+
+// Compile and link each definition of Source in a module of its own, as the
+// REPL does, then look them all up so that every object is linked.
+static void LinkDefinitions(CodeGenVisitor &CG, const std::string &Source) {
+  std::vector<std::string> Names;
+  ForEachDefinition(Source, [&](std::unique_ptr<FunctionAST> F) {
+    auto *Fn = F->Accept(CG);
+    if (!Fn) return;
+    Names.push_back(Fn->getName().str());
+    CG.TheJIT->addModule(std::move(CG.TheModule));
+    CG.InitializeModuleAndPassManager();
+  });
+  for (auto &Name : Names)
+    if (!CG.TheJIT->findSymbol(Name).getAddress())
+      fprintf(stderr, "perf-jit: %s not found\n", Name.c_str());
+}
+
+// The cost of --perf: line tables in every module, and a perf map line and
+// jitdump records, code included, for every function the JIT links.
+KALEIDOSCOPE_BENCH(perf_jit) {
+  const unsigned N = 2000;
+  std::string Source = GenerateProgram(N);
+  for (bool Perf : {false, true}) {
+    CodeGenOptions Options;
+    Options.LineTables = Perf;
+    std::unique_ptr<CodeGenVisitor> CG;
+    std::unique_ptr<PerfJITListener> Listener;
+    auto Detach = [&] {
+      if (Listener) CG->TheJIT->removeEventListener(Listener.get());
+      Listener.reset();
+    };
+    double T = MedianSeconds(
+        [&] {
+          Detach();
+          CG = std::make_unique<CodeGenVisitor>(Options);
+          if (Perf) {
+            Listener = std::make_unique<PerfJITListener>();
+            CG->TheJIT->addEventListener(Listener.get());
+          }
+        },
+        [&] { LinkDefinitions(*CG, Source); });
+    Detach();
+    ReportRate("perf-jit", Perf ? "perf" : "plain", T, Source.size(), N,
+               "functions");
+  }
+
+  std::string Pid = std::to_string(getpid());
+  const char *Dir = getenv("JITDUMPDIR");
+  unlink(("/tmp/perf-" + Pid + ".map").c_str());
+  unlink((std::string(Dir && *Dir ? Dir : "/tmp") + "/jit-" + Pid + ".dump")
+             .c_str());
+}
@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "KaleidoscopeJIT.h"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "profile.hpp"
+#include "synthetic.hpp"
+
+// Compile the definitions in Source as one module at O2, as -c does, with
+// Hook run on each as it is generated. Returns the calls to definitions
+// left in Root once it is optimized, i.e. those not inlined.
+static unsigned CompileDefinitions(CodeGenVisitor &CG,
+                                   const std::string &Source,
+                                   std::function<void(llvm::Function &)> Hook,
+                                   const char *Root) {
+  CG.OptimizeEachFunction = false;
+  CG.Options.DefinitionHook = std::move(Hook);
+  CompileLibrary(CG, Source);
+  CG.Options.DefinitionHook = nullptr;
+  CG.OptimizeModule();
+  unsigned Left = 0;
+  for (auto &I : llvm::instructions(*CG.TheModule->getFunction(Root)))
+    if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I))
+      Left += !Call->getCalledFunction()->isDeclaration();
+  CG.TheJIT->addModule(std::move(CG.TheModule));
+  return Left;
+}
+
+// A sum of Terms sines of x, too large for the inliner to take unprompted.
+static std::string Waves(unsigned Terms) {
+  std::string E;
+  for (unsigned i = 1; i <= Terms; i++)
+    E += (i > 1 ? " + " : "") + ("sin(x * " + std::to_string(i) + ".5 + 0." +
+                                 std::to_string(i) + ") * (x + " +
+                                 std::to_string(i) + ")");
+  return E;
+}
+
+// The whole loop: an instrumented build runs a training workload and writes
+// its profile, then the program is rebuilt from the profile and timed
+// against a build without one. hot() calls two large functions that share
+// their work, which only inlining both lets the optimizer compute once; the
+// cold definitions are never called.
+KALEIDOSCOPE_BENCH(pgo) {
+  std::string Library = "extern sin(x);\n";
+  Library += "def wave(x) " + Waves(24) + " + 1;\n";
+  Library += "def twice(x) (" + Waves(24) + ") * 2;\n";
+  Library += "def hot(x) wave(x) + twice(x);\n";
+  for (unsigned i = 0; i < 64; i++)
+    Library += "def cold" + std::to_string(i) + "(x) " + Waves(8) +
+               " + hot(x);\n";
+  const unsigned Calls = 1000000, Training = 10000;
+  std::string Path =
+      "/tmp/kaleidoscope-pgo-bench-" + std::to_string(getpid()) + ".profile";
+  CodeGenOptions Options;
+  Options.Pipeline = "O2";
+
+  auto Lookup = [](CodeGenVisitor &CG, const char *Name) {
+    auto Addr = llvm::cantFail(CG.TheJIT->findSymbol(Name).getAddress());
+    return (double (*)(double))(intptr_t)Addr;
+  };
+  double Sum = 0;
+
+  {
+    CodeGenVisitor CG(Options);
+    ProfileCollector Collector(*CG.TheJIT);
+    Stopwatch W;
+    CompileDefinitions(
+        CG, Library, [&](llvm::Function &F) { Collector.instrument(F); },
+        "hot");
+    auto *Hot = Lookup(CG, "hot");
+    for (unsigned k = 0; k < Training; k++) Sum += Hot(k * 0.001);
+    if (!Collector.write(Path)) return;
+    ReportRate("pgo-train", "instrumented", W.seconds(), Library.size(),
+               Training, "calls");
+  }
+  auto PGO = Profile::read(Path);
+  unlink(Path.c_str());
+  if (!PGO) return;
+
+  for (bool UseProfile : {false, true}) {
+    CodeGenVisitor CG(Options);
+    Stopwatch W;
+    std::function<void(llvm::Function &)> Hook;
+    if (UseProfile) Hook = [&](llvm::Function &F) { PGO->annotate(F); };
+    unsigned Left = CompileDefinitions(CG, Library, Hook, "hot");
+    const char *Variant = UseProfile ? "profile" : "plain";
+    ReportRate("pgo-compile", Variant, W.seconds(), Library.size(), 1,
+               "modules");
+    printf("pgo %s: hot makes %u calls to definitions\n", Variant, Left);
+
+    auto *Hot = Lookup(CG, "hot");
+    double T = MedianSeconds([&] {
+      for (unsigned k = 0; k < Calls; k++) Sum += Hot(k * 0.001);
+    });
+    ReportRate("pgo-run", Variant, T, 0, Calls, "calls");
+  }
+  if (Sum != Sum) fprintf(stderr, "pgo: NaN\n");
+}
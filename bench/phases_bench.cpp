@@ -0,0 +1,226 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "synthetic.hpp"
+
+// One benchmark per stage a definition goes through, over generated programs
+// of 10 to 100k definitions. Inputs are deterministic and every figure is the
+// median of --repeat runs, so two commits compare with --csv and --baseline.
+// Small inputs are run several times per measurement to stay well above the
+// clock's resolution.
+
+static const unsigned Sizes[] = {10, 100, 1000, 10000, 100000};
+// Each definition is its own module, as in the REPL; past this, adding them
+// to the JIT takes minutes per run.
+static const unsigned MaxJITSize = 10000;
+
+static double Checksum;
+
+static std::string Variant(const std::string &Prefix, unsigned N) {
+  return Prefix + std::to_string(N);
+}
+
+// Times to run an input of N items so that a measurement covers ~Target.
+static unsigned Scale(unsigned N, unsigned Target = 100000) {
+  return std::max(1u, Target / N);
+}
+
+// The definitions of GenerateProgram(N) as three sources: the definitions
+// alone, an extern for each and each body as a top-level expression.
+struct SplitProgram {
+  std::string Defs, Externs, Exprs;
+
+  explicit SplitProgram(unsigned N) {
+    std::string Source = GenerateProgram(N);
+    for (size_t Begin = 0, End; Begin < Source.size(); Begin = End + 1) {
+      End = Source.find('\n', Begin);
+      std::string Line = Source.substr(Begin, End - Begin);
+      if (Line.compare(0, 4, "def ")) continue;
+      size_t Close = Line.find(')');
+      Defs += Line + "\n";
+      Externs += "extern " + Line.substr(4, Close - 3) + ";\n";
+      Exprs += Line.substr(Close + 2) + "\n";
+    }
+  }
+};
+
+static void BenchLexer() {
+  for (unsigned N : Sizes) {
+    std::string Source = GenerateProgram(N);
+    unsigned Runs = Scale(N);
+    size_t Tokens = 0;
+    double T = MedianSeconds([&] {
+      Tokens = 0;
+      for (unsigned Run = 0; Run < Runs; Run++) {
+        Lexer L(Source);
+        for (Token Tok = L.gettok(); Tok.type != tok_eof; Tok = L.gettok()) {
+          if (Tok.type == tok_number) Checksum += Tok.NumVal;
+          Tokens++;
+        }
+      }
+    });
+    ReportRate("phase-lex", Variant("n/", N).c_str(), T,
+               double(Source.size()) * Runs, Tokens, "tokens");
+  }
+}
+
+static void BenchParser() {
+  Parser P;
+  for (unsigned N : Sizes) {
+    SplitProgram Split(N);
+    unsigned Runs = Scale(N);
+    const struct {
+      const char *Name;
+      const std::string &Source;
+      std::unique_ptr<FunctionAST> (Parser::*Parse)();
+    } Entries[] = {
+        {"phase-parse-def", Split.Defs, &Parser::ParseDefinition},
+        {"phase-parse-expr", Split.Exprs, &Parser::ParseTopLevelExpr},
+    };
+    for (auto &E : Entries) {
+      size_t Items = 0;
+      double T = MedianSeconds([&] {
+        for (unsigned Run = 0; Run < Runs; Run++)
+          Items =
+              ParseAll(E.Source, [&] { return (P.*E.Parse)() != nullptr; });
+      });
+      ReportRate(E.Name, Variant("n/", N).c_str(), T, 0, double(Items) * Runs,
+                 "items");
+    }
+    size_t Items = 0;
+    double T = MedianSeconds([&] {
+      for (unsigned Run = 0; Run < Runs; Run++)
+        Items = ParseAll(Split.Externs,
+                         [&] { return P.ParseExtern() != nullptr; });
+    });
+    ReportRate("phase-parse-ext", Variant("n/", N).c_str(), T, 0,
+               double(Items) * Runs, "items");
+  }
+}
+
+// CodeGenVisitor::Visit alone over many copies of one definition, each
+// renamed so that they share a module.
+static void BenchCodegenShape(const char *Bench, const char *Name,
+                              const std::string &Def, unsigned Nodes) {
+  unsigned Copies = Scale(Nodes);
+  std::string Source;
+  for (unsigned k = 0; k < Copies; k++)
+    Source += "def " + std::string(Name) + std::to_string(k) +
+              Def.substr(4 + strlen(Name));
+
+  CodeGenVisitor CG;
+  CG.OptimizeEachFunction = false;
+  Parser P;
+  std::vector<std::unique_ptr<FunctionAST>> Items;
+  double T = MedianSeconds(
+      [&] {
+        CG.InitializeModuleAndPassManager();
+        Items.clear();
+        ParseAll(Source, [&] {
+          Items.push_back(P.ParseDefinition());
+          return Items.back() != nullptr;
+        });
+      },
+      [&] {
+        for (auto &F : Items)
+          if (F) Checksum += F->Accept(CG) != nullptr;
+      });
+  ReportRate(Bench, Variant(std::string(Name) + "/", Nodes).c_str(), T, 0,
+             double(Nodes) * Copies, "nodes");
+}
+
+static void BenchCodegen() {
+  for (unsigned Depth : {10u, 100u, 1000u})
+    BenchCodegenShape("phase-codegen", "deep", GenerateDeepExpr(Depth), Depth);
+  for (unsigned Width : {10u, 100u, 1000u})
+    BenchCodegenShape("phase-codegen", "wide", GenerateWideExpr(Width), Width);
+}
+
+// KaleidoscopeJIT::addModule, findSymbol (which links) and calls into the
+// compiled code, for one module per definition.
+static void BenchJIT() {
+  for (unsigned N : Sizes) {
+    if (N > MaxJITSize) break;
+    SplitProgram Split(N);
+    std::unique_ptr<CodeGenVisitor> CG;
+    std::vector<std::unique_ptr<llvm::Module>> Modules;
+    std::vector<std::pair<std::string, size_t>> Defined;  // name, arity
+    Parser P;
+    auto Generate = [&] {
+      CG = std::make_unique<CodeGenVisitor>();
+      CG->KeepContext = true;  // Modules wait for AddAll in one context
+      Modules.clear();
+      Defined.clear();
+      ParseAll(Split.Defs, [&] {
+        auto F = P.ParseDefinition();
+        if (!F) return false;
+        std::string Name = F->Proto->getName().str();
+        size_t Arity = F->Proto->Args.size();
+        if (!F->Accept(*CG)) return false;
+        Defined.emplace_back(Name, Arity);
+        Modules.push_back(std::move(CG->TheModule));
+        CG->InitializeModuleAndPassManager();
+        return true;
+      });
+    };
+    auto AddAll = [&] {
+      for (auto &M : Modules) CG->TheJIT->addModule(std::move(M));
+    };
+    std::vector<uintptr_t> Addresses;
+    auto LookupAll = [&] {
+      Addresses.clear();
+      for (auto &D : Defined) {
+        auto Sym = CG->TheJIT->findSymbol(D.first);
+        Addresses.push_back(llvm::cantFail(Sym.getAddress()));
+      }
+    };
+
+    double T = MedianSeconds(Generate, AddAll);
+    ReportRate("phase-jit-add", Variant("n/", N).c_str(), T, 0, N,
+               "modules");
+    T = MedianSeconds([&] { Generate(), AddAll(); }, LookupAll);
+    ReportRate("phase-jit-lookup", Variant("n/", N).c_str(), T, 0, N,
+               "symbols");
+
+    unsigned Runs = Scale(N, 1000000);
+    T = MedianSeconds([&] {
+      for (unsigned Run = 0; Run < Runs; Run++)
+        for (size_t i = 0; i < Addresses.size(); i++) {
+          switch (Defined[i].second) {
+            case 1:
+              Checksum += ((double (*)(double))Addresses[i])(1.5);
+              break;
+            case 2:
+              Checksum += ((double (*)(double, double))Addresses[i])(1.5, 2);
+              break;
+            default:
+              Checksum += ((double (*)(double, double, double))Addresses[i])(
+                  1.5, 2, 0.5);
+              break;
+          }
+        }
+    });
+    ReportRate("phase-execute", Variant("n/", N).c_str(), T, 0,
+               double(N) * Runs, "calls");
+  }
+}
+
+KALEIDOSCOPE_BENCH(phases) {
+  BenchLexer();
+  BenchParser();
+  BenchCodegen();
+  BenchJIT();
+  if (Checksum == 0) printf("\n");
+}
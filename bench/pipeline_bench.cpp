@@ -0,0 +1,42 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "pipeline.hpp"
+#include "synthetic.hpp"
+
+// Load every definition of Source the way kaleidoscope -c --threads=N does:
+// parse on this thread and hand FunctionsPerJob definitions at a time to N
+// workers, then wait for all of them to reach the JIT.
+static void LoadDefinitionsThreaded(const std::string &Source,
+                                    unsigned NumThreads,
+                                    unsigned FunctionsPerJob) {
+  CodeGenVisitor CG;
+  CompilePipeline Pipeline(*CG.TheJIT, CG.Options, NumThreads);
+  std::vector<std::unique_ptr<FunctionAST>> Defs;
+  ForEachDefinition(Source, [&](std::unique_ptr<FunctionAST> F) {
+    Defs.push_back(std::move(F));
+    if (Defs.size() == FunctionsPerJob) {
+      Pipeline.submit(std::move(Defs), CG.FunctionProtos);
+      Defs.clear();
+    }
+  });
+  Pipeline.submit(std::move(Defs), CG.FunctionProtos);
+  Pipeline.finish();
+}
+
+KALEIDOSCOPE_BENCH(pipeline) {
+  std::string Source = GenerateProgram(10000);
+  for (unsigned NumThreads : {1u, 2u, 4u, 8u, 16u}) {
+    Stopwatch W;
+    LoadDefinitionsThreaded(Source, NumThreads, 64);
+    std::string Variant = "threads/" + std::to_string(NumThreads);
+    ReportRate("pipeline-startup", Variant.c_str(), W.seconds(), Source.size(),
+               10000, "functions");
+  }
+}
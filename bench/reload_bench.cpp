@@ -0,0 +1,52 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "bench.hpp"
+#include "engine.hpp"
+#include "synthetic.hpp"
+
+// The definitions of GenerateProgram(N), without its top-level calls.
+static std::string GenerateLibrary(unsigned N) {
+  std::string Program = GenerateProgram(N), Library;
+  for (size_t Begin = 0, End; Begin < Program.size(); Begin = End + 1) {
+    End = Program.find('\n', Begin);
+    if (!Program.compare(Begin, 4, "def "))
+      Library.append(Program, Begin, End - Begin + 1);
+  }
+  return Library;
+}
+
+// Engine::compile of a library of N definitions, then of the same library
+// with one definition edited, as when a source file is reloaded. The reload
+// should cost the edited definition and whatever inlined it, not N.
+KALEIDOSCOPE_BENCH(reload) {
+  for (unsigned N : {100u, 1000u, 10000u}) {
+    std::string Library = GenerateLibrary(N);
+    // Edit the first definition, which later ones may call.
+    std::string Edited = Library;
+    Edited.insert(Edited.find(';'), " + 0.25");
+
+    std::unique_ptr<Engine> E;
+    bool OK = true;
+    double Full = MedianSeconds([&] { E = std::make_unique<Engine>(); },
+                                [&] { OK &= E->compile(Library); });
+    double Reload = MedianSeconds(
+        [&] {
+          E = std::make_unique<Engine>();
+          OK &= E->compile(Library);
+        },
+        [&] { OK &= E->compile(Edited); });
+    auto Report = E->lastCompile();
+    if (!OK) fprintf(stderr, "reload: compile failed\n");
+
+    std::string Variant = "n/" + std::to_string(N);
+    ReportRate("reload-full", Variant.c_str(), Full, Library.size(), N,
+               "definitions");
+    ReportRate("reload-one", Variant.c_str(), Reload, Edited.size(), N,
+               "definitions");
+    printf("reload n/%u: %u reused, %u rebuilt\n", N, Report.Reused,
+           Report.Rebuilt);
+  }
+}
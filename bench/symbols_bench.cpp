@@ -0,0 +1,48 @@
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "symbols.hpp"
+
+// Prototype lookups by name, as getFunction does for every call: the
+// std::map<std::string, ...> it used to be against SymbolMap keyed by the ID
+// the lexer already interned.
+KALEIDOSCOPE_BENCH(symbols) {
+  const unsigned NumNames = 50000, Lookups = 5000000;
+  std::vector<std::string> Names;
+  for (unsigned i = 0; i < NumNames; i++)
+    Names.push_back("f" + std::to_string(i * 7919u));
+
+  {
+    Stopwatch W;
+    for (auto &N : Names) Symbols().intern(N);
+    ReportRate("symbols", "intern", W.seconds(), 0, NumNames, "names");
+  }
+
+  std::map<std::string, unsigned> ByName;
+  SymbolMap<unsigned> BySym;
+  std::vector<SymbolID> Syms;
+  for (unsigned i = 0; i < NumNames; i++) {
+    ByName[Names[i]] = i;
+    Syms.push_back(Symbols().intern(Names[i]));
+    BySym[Syms.back()] = i;
+  }
+
+  unsigned long Sum = 0;
+  {
+    Stopwatch W;
+    for (unsigned i = 0; i < Lookups; i++)
+      Sum += ByName.find(Names[(i * 31u) % NumNames])->second;
+    ReportRate("symbols", "std::map", W.seconds(), 0, Lookups, "lookups");
+  }
+  {
+    Stopwatch W;
+    for (unsigned i = 0; i < Lookups; i++)
+      Sum += *BySym.find(Syms[(i * 31u) % NumNames]);
+    ReportRate("symbols", "SymbolMap", W.seconds(), 0, Lookups, "lookups");
+  }
+  if (Sum == 0) printf("\n");
+}
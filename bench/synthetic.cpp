@@ -0,0 +1,129 @@
+#include "synthetic.hpp"
+
+#include <random>
+#include <vector>
+
+#include "codegen.hpp"
+
+namespace {
+
+class Generator {
+  std::mt19937 Rng;
+  std::vector<unsigned> Arity;
+  std::string Out;
+
+  unsigned pick(unsigned N) { return Rng() % N; }
+
+  void emitTerm(unsigned Args, unsigned Self) {
+    switch (pick(Self ? 4 : 3)) {
+      case 0:
+        Out += std::to_string(pick(1000)) + "." + std::to_string(pick(100));
+        break;
+      case 3: {  // call an earlier definition with simple arguments
+        unsigned Callee = pick(Self);
+        Out += "f" + std::to_string(Callee) + "(";
+        for (unsigned i = 0; i < Arity[Callee]; i++) {
+          if (i) Out += ", ";
+          Out += "a" + std::to_string(pick(Args));
+        }
+        Out += ")";
+        break;
+      }
+      default:
+        Out += "a" + std::to_string(pick(Args));
+        break;
+    }
+  }
+
+  void emitExpr(unsigned Args, unsigned Self, unsigned Depth) {
+    if (Depth == 0 || pick(4) == 0) return emitTerm(Args, Self);
+    static const char Ops[] = {'+', '-', '*', '<'};
+    bool Paren = pick(2);
+    if (Paren) Out += "(";
+    emitExpr(Args, Self, Depth - 1);
+    Out += " ";
+    Out += Ops[pick(4)];
+    Out += " ";
+    emitExpr(Args, Self, Depth - 1);
+    if (Paren) Out += ")";
+  }
+
+ public:
+  explicit Generator(unsigned Seed) : Rng(Seed) {}
+
+  std::string run(unsigned NumFunctions) {
+    Out.reserve(NumFunctions * 96);
+    for (unsigned F = 0; F < NumFunctions; F++) {
+      unsigned Args = 1 + pick(3);
+      Arity.push_back(Args);
+      Out += "def f" + std::to_string(F) + "(";
+      for (unsigned i = 0; i < Args; i++) {
+        if (i) Out += " ";
+        Out += "a" + std::to_string(i);
+      }
+      Out += ") ";
+      emitExpr(Args, F, 4);
+      Out += ";\n";
+
+      if (F % 8 == 7) {
+        Out += "# checkpoint " + std::to_string(F) + "\n";
+        Out += "f" + std::to_string(F) + "(";
+        for (unsigned i = 0; i < Args; i++) Out += i ? ", 1.5" : "1.5";
+        Out += ");\n";
+      }
+    }
+    return std::move(Out);
+  }
+};
+
+}  // namespace
+
+std::string GenerateProgram(unsigned NumFunctions, unsigned Seed) {
+  return Generator(Seed).run(NumFunctions);
+}
+
+std::string GenerateCallTree(unsigned Depth) {
+  std::string Out = "def h0(x) (x * x * 0.5 + x * 3 - 7) * (x + 0.25);\n";
+  for (unsigned k = 1; k <= Depth; k++) {
+    std::string Prev = "h" + std::to_string(k - 1);
+    Out += "def h" + std::to_string(k) + "(x) " + Prev + "(x) + " + Prev +
+           "(x + 1);\n";
+  }
+  return Out;
+}
+
+std::string GenerateDeepExpr(unsigned Depth) {
+  static const char Ops[] = {'+', '*', '-'};
+  std::string Out = "def deep(x) ";
+  for (unsigned k = 0; k < Depth; k++)
+    Out += std::string("(x ") + Ops[k % 3] + " ";
+  Out += "1.5";
+  Out.append(Depth, ')');
+  return Out + ";\n";
+}
+
+std::string GenerateWideExpr(unsigned Width) {
+  std::string Out = "def wide(x y) ";
+  for (unsigned k = 0; k < Width; k++) {
+    if (k) Out += k % 4 == 3 ? " - " : " + ";
+    Out += (k % 2 ? "y * " : "x * ") + std::to_string(k % 10) + ".5";
+  }
+  return Out + ";\n";
+}
+
+void CompileLibrary(CodeGenVisitor &CG, const std::string &Source) {
+  Parser P;
+  setLexer(std::make_unique<Lexer>(Source));
+  for (getNextToken(); getCurrentToken().type != tok_eof;) {
+    if (getCurrentToken().type == ';') {
+      getNextToken();
+    } else if (getCurrentToken().type == tok_extern) {
+      if (auto Proto = P.ParseExtern())
+        CG.FunctionProtos[Proto->Name] = std::move(Proto);
+    } else if (auto F = P.ParseDefinition()) {
+      F->Accept(CG);
+    } else {
+      getNextToken();
+    }
+  }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+// Generate a deterministic Kaleidoscope program with NumFunctions definitions.
+// Bodies mix arithmetic over the arguments with calls to earlier definitions;
+// a comment and a top-level call follow every few definitions.
+std::string GenerateProgram(unsigned NumFunctions, unsigned Seed = 1);
+
+// A numeric call tree: h<k>(x) calls h<k-1> twice, so evaluating
+// h<Depth>(x) runs the arithmetic in h0 2^Depth times.
+std::string GenerateCallTree(unsigned Depth);
+
+// "def deep(x) (x + (x * (x - ...)))": operators nested Depth levels deep
+// through parentheses.
+std::string GenerateDeepExpr(unsigned Depth);
+
+// "def wide(x y) x * 0.5 + y * 1.5 + ...": a flat chain of Width terms.
+std::string GenerateWideExpr(unsigned Width);
+
+// Call Parse at every item of Source, with the lexer on its first token.
+// ';' between items is skipped, and so is the current token when Parse
+// returns false. Returns the number of items Parse took.
+template <typename ParseFn>
+size_t ParseAll(const std::string &Source, ParseFn Parse) {
+  setLexer(std::make_unique<Lexer>(Source));
+  size_t Items = 0;
+  for (getNextToken(); getCurrentToken().type != tok_eof;) {
+    if (getCurrentToken().type == ';') {
+      getNextToken();
+      continue;
+    }
+    if (Parse())
+      Items++;
+    else
+      getNextToken();
+  }
+  return Items;
+}
+
+// Hand each definition of Source to Define as soon as it is parsed, the way
+// the REPL reads a file. Top-level expressions are parsed and dropped.
+template <typename DefineFn>
+void ForEachDefinition(const std::string &Source, DefineFn Define) {
+  Parser P;
+  setLexer(std::make_unique<Lexer>(Source));
+  for (getNextToken(); getCurrentToken().type != tok_eof;) {
+    if (getCurrentToken().type != tok_def) {
+      if (getCurrentToken().type == ';' || !P.ParseTopLevelExpr())
+        getNextToken();
+      continue;
+    }
+    if (auto F = P.ParseDefinition()) Define(std::move(F));
+  }
+}
+
+// Generate code in CG for Source, a library of externs and definitions
+// without top-level expressions. Everything goes into CG.TheModule.
+void CompileLibrary(CodeGenVisitor &CG, const std::string &Source);
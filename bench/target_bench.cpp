@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "batch_eval.hpp"
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "synthetic.hpp"
+
+// The same formulas compiled for the generic CPU, for the host CPU with all
+// its features, and for the host with --fast-math, which lets the multiply-
+// adds fuse into FMAs and the sums be reassociated. Rows are evaluated by
+// the batch wrappers, which the vectorizers widen to the target's SIMD
+// width, and by calling each definition once per row.
+KALEIDOSCOPE_BENCH(target) {
+  const char *Source =
+      "def poly(x) ((((((x * 0.5 + 0.25) * x - 0.125) * x + 0.0625) * x - "
+      "0.03125) * x + 0.015625) * x - 0.0078125) * x + 1;\n"
+      "def quad(a b) a * a * 0.3 + b * b * 0.2 + a * b * 0.5 + a * 0.1 + "
+      "b * 0.7 + 0.9;\n";
+  const struct {
+    const char *Name;
+    unsigned Arity;
+  } Formulas[] = {{"poly", 1}, {"quad", 2}};
+  const size_t N = 1 << 22;
+  std::vector<double> A(N), B(N), Out(N);
+  for (size_t i = 0; i < N; i++) {
+    A[i] = (i % 1000) * 0.001;
+    B[i] = (i % 97) * 0.25;
+  }
+  const double *Args[] = {A.data(), B.data()};
+
+  const struct {
+    const char *Name, *CPU;
+    bool FastMath;
+  } Modes[] = {
+      {"generic", "generic", false},
+      {"host", "native", false},
+      {"host-fast-math", "native", true},
+  };
+  for (auto &Mode : Modes) {
+    CodeGenOptions Options;
+    Options.Target.CPU = Mode.CPU;
+    Options.FastMath = Mode.FastMath;
+    CodeGenVisitor CG(Options);
+    CompileLibrary(CG, Source);
+    auto &JIT = *CG.TheJIT;
+    JIT.addModule(
+        MakeBatchModule(*CG.TheModule, *JIT.createHostTargetMachine(),
+                        CG.Options));
+    JIT.addModule(std::move(CG.TheModule));
+    CG.InitializeModuleAndPassManager();
+
+    double Checksum = 0;
+    for (auto &F : Formulas) {
+      std::string Variant = std::string(F.Name) + "/" + Mode.Name;
+      auto Batch = llvm::cantFail(
+          JIT.findSymbol(std::string(F.Name) + "_batch").getAddress());
+      llvm::ArrayRef<const double *> Inputs(Args, F.Arity);
+      double T =
+          MedianSeconds([&] { CallBatch(Batch, Inputs, Out.data(), N); });
+      ReportRate("target-batch", Variant.c_str(), T, 0, N, "rows");
+      Checksum += Out[N / 3];
+
+      auto Addr = llvm::cantFail(JIT.findSymbol(F.Name).getAddress());
+      T = MedianSeconds([&] {
+        if (F.Arity == 2) {
+          auto *Fn = (double (*)(double, double))(intptr_t)Addr;
+          for (size_t i = 0; i < N; i++) Out[i] = Fn(A[i], B[i]);
+        } else {
+          auto *Fn = (double (*)(double))(intptr_t)Addr;
+          for (size_t i = 0; i < N; i++) Out[i] = Fn(A[i]);
+        }
+      });
+      ReportRate("target-scalar", Variant.c_str(), T, 0, N, "rows");
+      Checksum += Out[N / 3];
+    }
+    printf("target %s: checksum %.17g\n", Mode.Name, Checksum);
+  }
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "synthetic.hpp"
+#include "tiering.hpp"
+
+// Define everything in Source one module per definition, as the REPL does,
+// either optimized up front or through Tiers.
+static void LoadDefinitions(CodeGenVisitor &CG, const std::string &Source,
+                            TieredCompiler *Tiers) {
+  CG.OptimizeEachFunction = !Tiers;
+  ForEachDefinition(Source, [&](std::unique_ptr<FunctionAST> F) {
+    if (!F->Accept(CG)) return;
+    if (Tiers)
+      Tiers->addModule(std::move(CG.TheModule));
+    else
+      CG.TheJIT->addModule(std::move(CG.TheModule));
+    CG.InitializeModuleAndPassManager();
+  });
+}
+
+static double Evaluate(CodeGenVisitor &CG, const std::string &Expr) {
+  Parser P;
+  setLexer(std::make_unique<Lexer>(Expr));
+  getNextToken();
+  auto F = P.ParseTopLevelExpr();
+  F->Accept(CG);
+  CG.OptimizeModule();
+  auto H = CG.TheJIT->addModule(std::move(CG.TheModule));
+  CG.InitializeModuleAndPassManager();
+  auto Sym = CG.TheJIT->findSymbol("__anon_expr");
+  double (*FP)() = (double (*)())(intptr_t)llvm::cantFail(Sym.getAddress());
+  double V = FP();
+  CG.TheJIT->removeModule(H);
+  return V;
+}
+
+static const unsigned HotDepth = 20;
+
+KALEIDOSCOPE_BENCH(tiering) {
+  std::string Source = GenerateProgram(10000);
+  for (bool Tiered : {false, true}) {
+    CodeGenVisitor CG;
+    std::unique_ptr<TieredCompiler> Tiers;
+    if (Tiered)
+      Tiers = std::make_unique<TieredCompiler>(*CG.TheJIT, CG.Options, 1000);
+    Stopwatch W;
+    LoadDefinitions(CG, Source, Tiers.get());
+    ReportRate("tiering-startup", Tiered ? "tiered" : "optimized", W.seconds(),
+               Source.size(), 10000, "functions");
+  }
+
+  // Steady state: the first evaluations run at tier 0 until the background
+  // compile lands, later ones at tier 1.
+  std::string Hot = GenerateCallTree(HotDepth);
+  std::string Expr = "h" + std::to_string(HotDepth) + "(1);";
+  for (bool Tiered : {false, true}) {
+    CodeGenVisitor CG;
+    std::unique_ptr<TieredCompiler> Tiers;
+    if (Tiered)
+      Tiers = std::make_unique<TieredCompiler>(*CG.TheJIT, CG.Options, 1000);
+    LoadDefinitions(CG, Hot, Tiers.get());
+    CG.OptimizeEachFunction = true;
+    for (unsigned Run = 0; Run < 10; Run++) {
+      if (Tiers) Tiers->installCompleted();
+      Stopwatch W;
+      Evaluate(CG, Expr);
+      std::string Variant =
+          std::string(Tiered ? "tiered" : "optimized") + "/run" +
+          std::to_string(Run);
+      ReportRate("tiering-hot", Variant.c_str(), W.seconds(), 0,
+                 double(1u << HotDepth), "calls");
+    }
+  }
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+#include "bench.hpp"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+
+static std::unique_ptr<FunctionAST> ParseExpr(Parser &P,
+                                              const std::string &Source) {
+  setLexer(std::make_unique<Lexer>(Source));
+  getNextToken();
+  return P.ParseTopLevelExpr();
+}
+
+// Add F as __anon_expr and return its address; the caller removes H.
+static double (*CompileExpr(CodeGenVisitor &CG, FunctionAST &F,
+                            llvm::orc::VModuleKey &H))() {
+  F.Accept(CG);
+  H = CG.TheJIT->addModule(std::move(CG.TheModule));
+  CG.InitializeModuleAndPassManager();
+  auto Sym = CG.TheJIT->findSymbol("__anon_expr");
+  return (double (*)())(intptr_t)llvm::cantFail(Sym.getAddress());
+}
+
+KALEIDOSCOPE_BENCH(vm) {
+  CodeGenVisitor CG;
+  Parser P;
+  BytecodeVM VM(*CG.TheJIT, CG.FunctionProtos);
+  BytecodeVM::Program Prog;
+
+  std::string Def = "def f(a b) a * b + 1;";
+  setLexer(std::make_unique<Lexer>(Def));
+  getNextToken();
+  P.ParseDefinition()->Accept(CG);
+  CG.TheJIT->addModule(std::move(CG.TheModule));
+  CG.InitializeModuleAndPassManager();
+
+  // Latency: parse and evaluate once, the way the REPL does.
+  const std::string Exprs[] = {"1 + 2 * 3;", "f(1.5, 2) + f(3, 4) * 2;"};
+  const char *Names[] = {"arith", "calls"};
+  const unsigned N = 2000;
+  for (unsigned i = 0; i < 2; i++) {
+    double Sum = 0;
+    {
+      Stopwatch W;
+      for (unsigned Run = 0; Run < N; Run++) {
+        auto F = ParseExpr(P, Exprs[i]);
+        llvm::orc::VModuleKey H;
+        Sum += CompileExpr(CG, *F, H)();
+        CG.TheJIT->removeModule(H);
+      }
+      std::string Variant = std::string("jit/") + Names[i];
+      ReportRate("vm-latency", Variant.c_str(), W.seconds(), 0, N,
+                 "expressions");
+    }
+    {
+      Stopwatch W;
+      for (unsigned Run = 0; Run < N; Run++) {
+        auto F = ParseExpr(P, Exprs[i]);
+        VM.compile(*F, Prog);
+        Sum += BytecodeVM::run(Prog);
+      }
+      std::string Variant = std::string("vm/") + Names[i];
+      ReportRate("vm-latency", Variant.c_str(), W.seconds(), 0, N,
+                 "expressions");
+    }
+    if (Sum != Sum) fprintf(stderr, "vm: NaN\n");
+  }
+
+  // Throughput: compile one larger expression once, then run it repeatedly.
+  std::string Big;
+  for (unsigned i = 0; i < 64; i++) {
+    if (i) Big += i % 3 ? " + " : " - ";
+    Big += "f(" + std::to_string(i) + ", 0.5) * " + std::to_string(i % 7);
+  }
+  Big += ";";
+  const unsigned Runs = 100000;
+  double Sum = 0;
+  {
+    auto F = ParseExpr(P, Big);
+    llvm::orc::VModuleKey H;
+    auto *FP = CompileExpr(CG, *F, H);
+    Stopwatch W;
+    for (unsigned Run = 0; Run < Runs; Run++) Sum += FP();
+    ReportRate("vm-throughput", "jit", W.seconds(), 0, Runs, "evaluations");
+    CG.TheJIT->removeModule(H);
+  }
+  {
+    auto F = ParseExpr(P, Big);
+    VM.compile(*F, Prog);
+    Stopwatch W;
+    for (unsigned Run = 0; Run < Runs; Run++) Sum += BytecodeVM::run(Prog);
+    ReportRate("vm-throughput", "vm", W.seconds(), 0, Runs, "evaluations");
+  }
+  if (Sum != Sum) fprintf(stderr, "vm: NaN\n");
+}
@@ -1,69 +1,266 @@
 #include "codegen.hpp"
 
+#include <mutex>
+
 #include "KaleidoscopeJIT.h"
 #include "expressions.hpp"
+#include "stats.hpp"
+#include "vector_math.hpp"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
 
 static llvm::Value *LogErrorV(const char *Str) {
   LogError(Str);
   return nullptr;
 }
 
-CodeGenVisitor::CodeGenVisitor() {
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
+// The function attribute behind CodeGenVisitor::IsPure.
+static const char PureAttribute[] = "kaleidoscope-pure";
+
+// Externs known to have no side effects, as long as errno is not read.
+static bool IsPureExtern(llvm::StringRef Name) {
+  static const char *const Names[] = {
+      "acos",  "asin", "atan",  "atan2", "cbrt", "ceil",  "cos",
+      "cosh",  "exp",  "exp2",  "fabs",  "fma",  "floor", "fmax",
+      "fmin",  "fmod", "hypot", "log",   "log10", "log2", "pow",
+      "round", "sin",  "sinh",  "sqrt",  "tan",  "tanh",  "trunc",
+  };
+  for (const char *N : Names)
+    if (Name == N) return true;
+  return false;
+}
+
+// The math externs with an intrinsic of the same meaning and arity.
+static const struct {
+  const char *Name;
+  llvm::Intrinsic::ID ID;
+  unsigned NumArgs;
+} MathIntrinsicIDs[] = {
+    {"sin", llvm::Intrinsic::sin, 1},   {"cos", llvm::Intrinsic::cos, 1},
+    {"exp", llvm::Intrinsic::exp, 1},   {"log", llvm::Intrinsic::log, 1},
+    {"sqrt", llvm::Intrinsic::sqrt, 1}, {"pow", llvm::Intrinsic::pow, 2},
+    {"fabs", llvm::Intrinsic::fabs, 1}, {"fma", llvm::Intrinsic::fma, 3},
+};
+
+bool CodeGenVisitor::IsPure(const llvm::Function &F) {
+  return F.hasFnAttribute(PureAttribute);
+}
+
+bool CodeGenVisitor::isPureCallee(SymbolID Callee) {
+  if (Callee == CurrentFunction) return true;
+  if (char *P = Purity.find(Callee)) return *P;
+  // A definition not generated yet, such as a later one in the same file,
+  // may do anything, whatever its name.
+  return isExtern(Callee) && IsPureExtern(Symbols().name(Callee));
+}
+
+bool CodeGenVisitor::isExtern(SymbolID Callee) {
+  auto *P = FunctionProtos.find(Callee);
+  return P && (*P)->IsExtern;
+}
+
+void CodeGenVisitor::setLocation(const ExprAST &E) {
+  if (!DIB || !E.Line) return;
+  auto *SP = Builder->GetInsertBlock()->getParent()->getSubprogram();
+  Builder->SetCurrentDebugLocation(
+      llvm::DILocation::get(*TheContext, E.Line, 0, SP));
+}
+
+using OptimizationLevel = llvm::PassBuilder::OptimizationLevel;
+
+static const struct {
+  const char *Name;
+  OptimizationLevel Level;
+} OptLevels[] = {
+    {"O1", OptimizationLevel::O1}, {"O2", OptimizationLevel::O2},
+    {"O3", OptimizationLevel::O3}, {"Os", OptimizationLevel::Os},
+    {"Oz", OptimizationLevel::Oz},
+};
+
+// Fill MPM from Pipeline, a level name other than O0 or a pass list.
+static llvm::Error BuildPipeline(llvm::PassBuilder &PB,
+                                 llvm::ModulePassManager &MPM,
+                                 const std::string &Pipeline) {
+  for (auto &L : OptLevels)
+    if (Pipeline == L.Name) {
+      MPM = PB.buildPerModuleDefaultPipeline(L.Level);
+      return llvm::Error::success();
+    }
+  return PB.parsePassPipeline(MPM, Pipeline);
+}
+
+bool CodeGenVisitor::SetPipeline(const std::string &Pipeline) {
+  if (Pipeline != "O0") {
+    llvm::PassBuilder PB;
+    llvm::ModulePassManager MPM;
+    if (auto Err = BuildPipeline(PB, MPM, Pipeline)) {
+      fprintf(stderr, "invalid pass pipeline '%s': %s\n", Pipeline.c_str(),
+              llvm::toString(std::move(Err)).c_str());
+      return false;
+    }
+  }
+  Options.Pipeline = Pipeline;
+  return true;
+}
+
+bool CodeGenVisitor::PipelineInlines(const std::string &Pipeline) {
+  if (Pipeline == "O0") return false;
+  // Run it over f() calling g() and watch for the inliner: pass lists may
+  // name it in several ways, or inside a default pipeline.
+  llvm::LLVMContext Context;
+  llvm::Module M("inline-probe", Context);
+  auto *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(Context), false);
+  auto *G = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "g", M);
+  auto *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "f", M);
+  llvm::IRBuilder<> B(llvm::BasicBlock::Create(Context, "entry", G));
+  B.CreateRet(llvm::ConstantFP::get(Context, llvm::APFloat(1.0)));
+  B.SetInsertPoint(llvm::BasicBlock::Create(Context, "entry", F));
+  B.CreateRet(B.CreateCall(G));
+
+  bool Inlines = false;
+  llvm::PassInstrumentationCallbacks PIC;
+  PIC.registerBeforePassCallback([&](llvm::StringRef Pass, llvm::Any) {
+    Inlines |= Pass == "InlinerPass";
+    return true;
+  });
+  llvm::PassBuilder PB(nullptr, llvm::PipelineTuningOptions(), llvm::None,
+                       &PIC);
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  llvm::ModulePassManager MPM;
+  if (auto Err = BuildPipeline(PB, MPM, Pipeline)) {
+    llvm::consumeError(std::move(Err));
+    return false;
+  }
+  MPM.run(M, MAM);
+  return Inlines;
+}
+
+CodeGenVisitor::CodeGenVisitor(CodeGenOptions Options)
+    : Options(std::move(Options)) {
+  // Target registration is not thread-safe; visitors may be created on
+  // several threads at once.
+  static std::once_flag TargetsInitialized;
+  std::call_once(TargetsInitialized, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+  });
+
+  TheJIT =
+      std::make_unique<llvm::orc::KaleidoscopeJIT>(this->Options.Target);
+  DL = TheJIT->getTargetMachine().createDataLayout();
+  InitializeModuleAndPassManager();
+}
 
-  TheJIT = std::make_unique<llvm::orc::KaleidoscopeJIT>();
+CodeGenVisitor::CodeGenVisitor(const llvm::DataLayout &DL,
+                               CodeGenOptions Options)
+    : DL(DL), Options(std::move(Options)) {
   InitializeModuleAndPassManager();
 }
 
 void CodeGenVisitor::InitializeModuleAndPassManager() {
-  // Open a new context and module.
-  TheContext = std::make_unique<llvm::LLVMContext>();
+  // Open a new context and module. A module not handed to the JIT must go
+  // before the context it lives in.
+  DIB.reset();
+  TheModule.reset();
+  if (!TheContext || !KeepContext)
+    TheContext = std::make_unique<llvm::LLVMContext>();
   TheModule = std::make_unique<llvm::Module>("my cool jit", *TheContext);
-  TheModule->setDataLayout(TheJIT->getTargetMachine().createDataLayout());
+  TheModule->setDataLayout(DL);
 
   // Create a new builder for the module.
   Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+  if (Options.FastMath) {
+    llvm::FastMathFlags FMF;
+    FMF.setFast();
+    Builder->setFastMathFlags(FMF);
+  }
+
+  if (Options.LineTables) {
+    TheModule->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                             llvm::DEBUG_METADATA_VERSION);
+    DIB = std::make_unique<llvm::DIBuilder>(*TheModule);
+    DIB->createCompileUnit(llvm::dwarf::DW_LANG_C,
+                           DIB->createFile("kaleidoscope", Options.SourceDir),
+                           "kaleidoscope", /*isOptimized=*/true, "", 0, "",
+                           llvm::DICompileUnit::LineTablesOnly);
+    // The unit lists no types or globals, so it is complete already; each
+    // subprogram is finalized on its own.
+    DIB->finalize();
+  }
+}
+
+void CodeGenVisitor::OptimizeModule(llvm::Module &M,
+                                    const CodeGenOptions &Options,
+                                    llvm::TargetMachine *TM) {
+  const std::string &Pipeline = Options.Pipeline;
+  if (Pipeline == "O0") return;
+  ScopedTimer T(Phase::Optimize);
 
-  // Create a new pass manager
-  TheFPM = std::make_unique<llvm::legacy::FunctionPassManager>(TheModule.get());
-  // add path
-  TheFPM->add(llvm::createInstructionCombiningPass());
-  TheFPM->add(llvm::createReassociatePass());
-  TheFPM->add(llvm::createGVNPass());
-  TheFPM->add(llvm::createCFGSimplificationPass());
+  // Clang's choices: vectorize loops from O2 and at Os, straight-line code
+  // from O2.
+  llvm::PipelineTuningOptions PTO;
+  PTO.LoopVectorization =
+      Pipeline == "O2" || Pipeline == "O3" || Pipeline == "Os";
+  PTO.SLPVectorization = Pipeline == "O2" || Pipeline == "O3";
+  PTO.LoopInterleaving = PTO.LoopVectorization;
 
-  TheFPM->doInitialization();
+  // Everything here is local, so compile threads can optimize concurrently.
+  llvm::PassBuilder PB(TM, PTO);
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+  // The target's library, with the vector math functions it can call.
+  llvm::Optional<llvm::TargetLibraryInfoImpl> TLII;
+  if (TM) {
+    TLII.emplace(TM->getTargetTriple());
+    if (Options.VectorMath) AddVectorMathFunctions(*TLII, *TM);
+    FAM.registerPass([&] { return llvm::TargetLibraryAnalysis(*TLII); });
+  }
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  llvm::ModulePassManager MPM;
+  // SetPipeline checks that it parses.
+  llvm::cantFail(BuildPipeline(PB, MPM, Pipeline));
+  MPM.run(M, MAM);
 }
 
-llvm::Function *CodeGenVisitor::getFunction(std::string Name) {
+llvm::Function *CodeGenVisitor::getFunction(SymbolID Name) {
   // First, see if the function has already been added to the current module.
-  if (auto *F = TheModule->getFunction(Name)) return F;
+  if (auto *F = TheModule->getFunction(Symbols().name(Name))) return F;
 
   // If not, check whether we can codegen the declaration from some existing
   // prototype.
-  auto FI = FunctionProtos.find(Name);
-  if (FI != FunctionProtos.end())
+  if (auto *Proto = FunctionProtos.find(Name))
     // return FI->second->codegen();
-    return FI->second->Accept(*this);
+    return (*Proto)->Accept(*this);
 
   // If no existing prototype exists, return null.
   return nullptr;
@@ -77,11 +274,11 @@ llvm::Function *CodeGenVisitor::Visit(PrototypeAST &p) {
       llvm::Type::getDoubleTy(*TheContext), Doubles, false);
 
   llvm::Function *F = llvm::Function::Create(
-      FT, llvm::Function::ExternalLinkage, p.Name, TheModule.get());
+      FT, llvm::Function::ExternalLinkage, p.getName(), TheModule.get());
 
   unsigned Idx = 0;
   for (auto &Arg : F->args()) {
-    Arg.setName(p.Args[Idx++]);
+    Arg.setName(Symbols().name(p.Args[Idx++]));
   }
 
   return F;
@@ -90,8 +287,9 @@ llvm::Function *CodeGenVisitor::Visit(PrototypeAST &p) {
 // code gen impl
 llvm::Function *CodeGenVisitor::Visit(FunctionAST &f) {
   auto &P = *(f.Proto);
-  FunctionProtos[f.Proto->getName()] = std::move(f.Proto);
-  llvm::Function *TheFunction = getFunction(P.getName());
+  ScopedTimer T(Phase::Codegen, P.Name);
+  FunctionProtos[P.Name] = std::move(f.Proto);
+  llvm::Function *TheFunction = getFunction(P.Name);
   if (!TheFunction) return nullptr;
 
   if (!TheFunction)
@@ -109,19 +307,40 @@ llvm::Function *CodeGenVisitor::Visit(FunctionAST &f) {
 
   NamedValues.clear();
   for (auto &arg : TheFunction->args()) {
-    NamedValues[arg.getName()] = &arg;
+    NamedValues[P.Args[arg.getArgNo()]] = &arg;
   }
+  llvm::DISubprogram *SP = nullptr;
+  if (DIB) {
+    auto *File = DIB->createFile(P.File ? P.File : "<unknown>",
+                                 Options.SourceDir);
+    SP = DIB->createFunction(
+        File, P.getName(), TheFunction->getName(), File, P.Line,
+        DIB->createSubroutineType(DIB->getOrCreateTypeArray(llvm::None)),
+        P.Line, llvm::DINode::FlagPrototyped,
+        llvm::DISubprogram::SPFlagDefinition);
+    TheFunction->setSubprogram(SP);
+    // Until the body's first operator or call sets its own line.
+    Builder->SetCurrentDebugLocation(
+        llvm::DILocation::get(*TheContext, P.Line, 0, SP));
+  }
+  CurrentFunction = P.Name;
+  CurrentIsPure = true;
 
   // if(llvm::Value *RetVal = f.Body->codegen()){
   if (llvm::Value *RetVal = f.Body->Accept(*this)) {
     Builder->CreateRet(RetVal);
+    if (SP) DIB->finalizeSubprogram(SP);
+    Purity[P.Name] = CurrentIsPure;
+    if (CurrentIsPure) TheFunction->addFnAttr(PureAttribute);
     llvm::verifyFunction(*TheFunction);
+    if (Options.DefinitionHook) Options.DefinitionHook(*TheFunction);
 
-    // Optimize the function.
-    TheFPM->run(*TheFunction);
+    // Optimize the function. Its module holds nothing else to optimize.
+    if (OptimizeEachFunction) OptimizeModule();
     return TheFunction;
   }
 
+  if (SP) DIB->finalizeSubprogram(SP);
   TheFunction->eraseFromParent();
   return nullptr;
 }
@@ -131,9 +350,9 @@ llvm::Value *CodeGenVisitor::Visit(NumberExprAST &n) {
 }
 llvm::Value *CodeGenVisitor::Visit(VariableExprAST &v) {
   // Look this variable up in the function.
-  llvm::Value *V = NamedValues[v.Name];
-  if (!V) LogErrorV("Unknown variable name");
-  return V;
+  llvm::Value **V = NamedValues.find(v.Name);
+  if (!V) return LogErrorV("Unknown variable name");
+  return *V;
 }
 
 llvm::Value *CodeGenVisitor::Visit(BinaryExprAST &b) {
@@ -142,6 +361,7 @@ llvm::Value *CodeGenVisitor::Visit(BinaryExprAST &b) {
   // llvm::Value *R = b.RHS->codegen();
   llvm::Value *R = b.RHS->Accept(*this);
   if (!L || !R) return nullptr;
+  setLocation(b);
 
   switch (b.Op) {
     case '+':
@@ -163,14 +383,28 @@ llvm::Value *CodeGenVisitor::Visit(CallExprAST &c) {
   llvm::Function *CalleeF = getFunction(c.Callee);
   // llvm::Function *CalleeF = TheModule-> getFunction(Callee);
   if (!CalleeF) return LogErrorV("Unknown function referenced");
-  if (CalleeF->arg_size() != c.Args.size())
+  if (CalleeF->arg_size() != c.NumArgs)
     return LogErrorV("Incorrect #arguments passed");
+  if (!isPureCallee(c.Callee)) CurrentIsPure = false;
+
+  // A math extern, rather than a definition that happens to share its name,
+  // declared with the arguments the intrinsic takes. Anything else stays a
+  // plain call.
+  if (MathIntrinsics && isExtern(c.Callee) && !Purity.find(c.Callee))
+    for (auto &M : MathIntrinsicIDs)
+      if (CalleeF->getName() == M.Name && c.NumArgs == M.NumArgs) {
+        if (CalleeF->use_empty()) CalleeF->eraseFromParent();
+        CalleeF = llvm::Intrinsic::getDeclaration(
+            TheModule.get(), M.ID, {llvm::Type::getDoubleTy(*TheContext)});
+        break;
+      }
 
   std::vector<llvm::Value *> ArgsV;
-  for (unsigned i = 0, e = c.Args.size(); i != e; i++) {
+  for (unsigned i = 0, e = c.NumArgs; i != e; i++) {
     // ArgsV.push_back( c.Args[i]->codegen() );
     ArgsV.push_back(c.Args[i]->Accept(*this));
     if (!ArgsV.back()) return nullptr;
   }
+  setLocation(c);
   return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
 }
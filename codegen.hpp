@@ -1,13 +1,16 @@
 #pragma once
 
-#include <map>
+#include <functional>
 #include <string>
 
 #include "KaleidoscopeJIT.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Target/TargetMachine.h"
+#include "symbols.hpp"
 
 class ExprAST;
 class NumberExprAST;
@@ -17,19 +20,87 @@ class CallExprAST;
 class FunctionAST;
 class PrototypeAST;
 
+// How a CodeGenVisitor generates and optimizes code. Every visitor has its
+// own, so visitors on different threads may compile with different ones.
+struct CodeGenOptions {
+  // The pipeline OptimizeModule runs: "O0" to "O3", "Os", "Oz", or a pass
+  // list in the syntax of opt -passes, which SetPipeline checks. The
+  // default is the tutorial's function pipeline.
+  std::string Pipeline = "instcombine,reassociate,gvn,simplifycfg";
+  // The CPU the JIT generates code for.
+  llvm::orc::KaleidoscopeJIT::TargetCPU Target;
+  // Let arithmetic be reassociated, contracted into FMAs and assumed free
+  // of NaNs, infinities and signed zeros.
+  bool FastMath = false;
+  // Let vectorized code call libmvec's SIMD math functions, where it loads.
+  // They are less accurate than libm's; see vector_math.hpp.
+  bool VectorMath = false;
+  // Give modules DWARF line tables that map each instruction to the line of
+  // the operator or call it comes from, e.g. for profilers. Source paths are
+  // relative to SourceDir.
+  bool LineTables = false;
+  std::string SourceDir = ".";
+  // Called on each definition as soon as it is generated, before it is
+  // optimized, e.g. to instrument it or to apply a profile. Compile threads
+  // call their copy, so it must be safe to call from any thread.
+  std::function<void(llvm::Function&)> DefinitionHook;
+};
+
 class CodeGenVisitor {
   std::unique_ptr<llvm::IRBuilder<>> Builder;
-  std::map<std::string, llvm::Value*> NamedValues;
-  std::unique_ptr<llvm::legacy::FunctionPassManager> TheFPM;
+  std::unique_ptr<llvm::DIBuilder> DIB;  // with Options.LineTables
+  SymbolMap<llvm::Value*> NamedValues;
   std::unique_ptr<llvm::LLVMContext> TheContext;
+  llvm::DataLayout DL{""};
+  // Whether each definition so far is pure (1) or not (0); see IsPure.
+  SymbolMap<char> Purity;
+  SymbolID CurrentFunction = ~0u;
+  bool CurrentIsPure = false;
+  bool isPureCallee(SymbolID Callee);
+  bool isExtern(SymbolID Callee);
+  // With line tables, attribute the instructions generated next to E's line.
+  void setLocation(const ExprAST& E);
 
  public:
-  CodeGenVisitor();
+  explicit CodeGenVisitor(CodeGenOptions Options = CodeGenOptions());
+  // Generate code for DL without a JIT of its own, e.g. on a compile thread.
+  // The native target must already be initialized.
+  explicit CodeGenVisitor(const llvm::DataLayout& DL,
+                          CodeGenOptions Options = CodeGenOptions());
   void InitializeModuleAndPassManager();
 
-  std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+  // Changes take effect from the next InitializeModuleAndPassManager, and
+  // for Target, once a JIT is created with it.
+  CodeGenOptions Options;
+  // Set Options.Pipeline, after checking that it parses. Reports and returns
+  // false if it does not.
+  bool SetPipeline(const std::string& Pipeline);
+  // Whether Pipeline, one SetPipeline accepts, runs the inliner.
+  static bool PipelineInlines(const std::string& Pipeline);
+  // Run Options.Pipeline over all of M at once. TM, if given, supplies the
+  // target cost models, e.g. for the vectorizers.
+  static void OptimizeModule(llvm::Module& M, const CodeGenOptions& Options,
+                             llvm::TargetMachine* TM = nullptr);
+  void OptimizeModule() {
+    OptimizeModule(*TheModule, Options,
+                   TheJIT ? &TheJIT->getTargetMachine() : nullptr);
+  }
+
+  // When false, Visit(FunctionAST&) leaves optimization to OptimizeModule().
+  // When true, it optimizes the whole module, which should then hold only
+  // the one definition.
+  bool OptimizeEachFunction = true;
+  // Keep one LLVMContext for every module instead of a fresh one per module.
+  // Required while the JIT holds on to IR, as it does for lazy modules.
+  bool KeepContext = false;
+  // Call the LLVM intrinsics for the math externs, such as llvm.sin for
+  // "extern sin(x)", which the optimizer can fold and vectorize, rather than
+  // the library functions directly.
+  bool MathIntrinsics = true;
+
+  SymbolMap<std::unique_ptr<PrototypeAST>> FunctionProtos;
   std::unique_ptr<llvm::Module> TheModule;
-  std::unique_ptr<llvm::orc::KaleidoscopeJIT> TheJIT;
+  std::unique_ptr<llvm::orc::KaleidoscopeJIT> TheJIT;  // null without a JIT
   llvm::Value* Visit(NumberExprAST&);
   llvm::Value* Visit(VariableExprAST&);
   llvm::Value* Visit(BinaryExprAST&);
@@ -37,8 +108,13 @@ class CodeGenVisitor {
   llvm::Function* Visit(PrototypeAST&);
   llvm::Function* Visit(FunctionAST&);
 
-  llvm::Function* getFunction(std::string);
+  llvm::Function* getFunction(SymbolID);
+
+  // Whether Visit(FunctionAST&) found F to be pure: it only calls itself,
+  // other pure definitions and math library functions, so its result
+  // depends on nothing but its arguments.
+  static bool IsPure(const llvm::Function& F);
 };
 
-std::unique_ptr<ExprAST> LogError(const char* Str);
+ExprAST* LogError(const char* Str);
 std::unique_ptr<PrototypeAST> LogErrorP(const char* Str);
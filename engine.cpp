@@ -0,0 +1,204 @@
+#include "engine.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "KaleidoscopeJIT.h"
+#include "lexer.hpp"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+
+Engine::Engine(CodeGenOptions Options) {
+  SymbolScope Scope(Names);
+  CG = std::make_unique<CodeGenVisitor>(std::move(Options));
+  CG->OptimizeEachFunction = false;
+  Swapper = std::make_unique<HotSwapper>(*CG->TheJIT, CG->Options,
+                                         /*Relinkable=*/false);
+}
+
+Engine::~Engine() {
+  SymbolScope Scope(Names);
+  Swapper.reset();
+  CG.reset();
+}
+
+// Compile the definitions Rebuild names as one module. Returns false if any
+// of them failed, which are then compiled again next time.
+bool Engine::build(const std::vector<SymbolID> &Rebuild) {
+  bool OK = true;
+  std::vector<Definition *> Built;
+  for (SymbolID Name : Rebuild) {
+    auto &D = *Library.find(Name);
+    // Code generation keeps the prototype; the AST needs one of its own for
+    // the next rebuild.
+    auto Proto = std::make_unique<PrototypeAST>(*D.AST->Proto);
+    D.Compiled = false;
+    if (D.AST->Accept(*CG))
+      Built.push_back(&D);
+    else
+      OK = false;
+    D.AST->Proto = std::move(Proto);
+  }
+  if (Built.empty()) return OK;
+
+  CG->OptimizeModule();
+  // Calls within the module may have been inlined. The code of a caller that
+  // inlined a callee, even at only some of its calls, has to be rebuilt with
+  // the callee's. Calls the optimizer merged or dropped count as inlined too.
+  for (auto *D : Built) {
+    auto *F = CG->TheModule->getFunction(D->AST->Proto->getName());
+    llvm::StringMap<unsigned> Calls;
+    for (auto &I : llvm::instructions(*F))
+      if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I))
+        if (auto *Callee = Call->getCalledFunction())
+          Calls[Callee->getName()]++;
+    D->Inlined.clear();
+    auto &Callees = D->Callees;
+    for (auto I = Callees.begin(); I != Callees.end();) {
+      auto Next = std::upper_bound(I, Callees.end(), *I);
+      if (*I != D->AST->Proto->Name &&
+          Calls.lookup(Names.name(*I)) < unsigned(Next - I))
+        D->Inlined.push_back(*I);
+      I = Next;
+    }
+    D->Compiled = true;
+  }
+  Swapper->addModule(std::move(CG->TheModule));
+  CG->InitializeModuleAndPassManager();
+  return OK;
+}
+
+bool Engine::compile(llvm::StringRef Source, std::vector<double> *Results) {
+  SymbolScope Scope(Names);
+  LexerScope Input(std::make_unique<Lexer>(Source));
+
+  bool OK = true;
+  std::vector<std::unique_ptr<FunctionAST>> Defs, Exprs;
+  getNextToken();
+  while (getCurrentToken().type != (int)tok_eof) {
+    switch (getCurrentToken().type) {
+      case ';':
+        getNextToken();
+        break;
+      case (int)tok_def:
+        if (auto F = P.ParseDefinition()) {
+          Defs.push_back(std::move(F));
+        } else {
+          OK = false;
+          getNextToken();
+        }
+        break;
+      case (int)tok_extern:
+        if (auto Proto = P.ParseExtern()) {
+          Proto->Accept(*CG);
+          CG->FunctionProtos[Proto->Name] = std::move(Proto);
+        } else {
+          OK = false;
+          getNextToken();
+        }
+        break;
+      default:
+        if (auto F = P.ParseTopLevelExpr()) {
+          Exprs.push_back(std::move(F));
+        } else {
+          OK = false;
+          getNextToken();
+        }
+        break;
+    }
+  }
+
+  // Take in the definitions that changed. The last one of a name wins.
+  Report = CompileReport();
+  SymbolMap<char> Queued, ArityChanged;  // used as sets
+  std::vector<SymbolID> Rebuild, InSource;
+  auto Queue = [&](SymbolID Name) {
+    char &Q = Queued[Name];
+    if (!Q) Rebuild.push_back(Name);
+    Q = true;
+  };
+  for (auto &F : Defs) {
+    SymbolID Name = F->Proto->Name;
+    InSource.push_back(Name);
+    uint64_t FP = Fingerprint(*F);
+    auto *D = Library.find(Name);
+    if (D && D->Compiled && D->Fingerprint == FP) continue;
+    if (!D) {
+      D = &Library[Name];
+      Defined.push_back(Name);
+    } else if (D->AST->Proto->Args.size() != F->Proto->Args.size()) {
+      ArityChanged[Name] = true;
+    }
+    llvm::SmallVector<SymbolID, 8> Callees;
+    CollectCallees(F->Body, Callees);
+    std::sort(Callees.begin(), Callees.end());
+    D->Callees.assign(Callees.begin(), Callees.end());
+    D->AST = std::move(F);
+    D->Fingerprint = FP;
+    Queue(Name);
+  }
+
+  // Then whatever depends on them: callers that inlined one, and callers of
+  // one that now takes a different number of arguments.
+  if (!Rebuild.empty()) {
+    SymbolMap<std::vector<SymbolID>> InlinedBy, CalledBy;
+    for (SymbolID Name : Defined) {
+      auto &D = *Library.find(Name);
+      for (SymbolID Callee : D.Inlined) InlinedBy[Callee].push_back(Name);
+      for (SymbolID Callee : D.Callees) CalledBy[Callee].push_back(Name);
+    }
+    for (size_t I = 0; I < Rebuild.size(); I++) {
+      SymbolID Name = Rebuild[I];
+      if (auto *Users = InlinedBy.find(Name))
+        for (SymbolID User : *Users) Queue(User);
+      if (ArityChanged.find(Name))
+        if (auto *Users = CalledBy.find(Name))
+          for (SymbolID User : *Users) Queue(User);
+    }
+  }
+  Report.Rebuilt = Rebuild.size();
+  std::sort(InSource.begin(), InSource.end());
+  InSource.erase(std::unique(InSource.begin(), InSource.end()),
+                 InSource.end());
+  for (SymbolID Name : InSource)
+    if (!Queued.find(Name)) Report.Reused++;
+  if (!build(Rebuild)) OK = false;
+
+  for (auto &F : Exprs) {
+    if (!F->Accept(*CG)) {
+      OK = false;
+      continue;
+    }
+    CG->OptimizeModule();
+    auto H = CG->TheJIT->addModule(std::move(CG->TheModule));
+    CG->InitializeModuleAndPassManager();
+    auto Addr = CG->TheJIT->findSymbol("__anon_expr").getAddress();
+    if (!Addr) {
+      fprintf(stderr, "%s\n", llvm::toString(Addr.takeError()).c_str());
+      OK = false;
+    } else {
+      double Value = ((double (*)())(intptr_t)*Addr)();
+      if (Results) Results->push_back(Value);
+    }
+    CG->TheJIT->removeModule(H);
+  }
+  return OK;
+}
+
+void *Engine::lookup(llvm::StringRef Name, size_t Arity) {
+  auto *Proto = CG->FunctionProtos.find(Names.intern(Name));
+  if (!Proto || (*Proto)->Args.size() != Arity) {
+    fprintf(stderr, "no function %s taking %zu arguments\n",
+            Name.str().c_str(), Arity);
+    return nullptr;
+  }
+  auto Addr = CG->TheJIT->findSymbol(Name.str()).getAddress();
+  if (!Addr) {
+    fprintf(stderr, "%s\n", llvm::toString(Addr.takeError()).c_str());
+    return nullptr;
+  }
+  return (void *)(intptr_t)*Addr;
+}
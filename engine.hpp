@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "hot_swap.hpp"
+#include "parser.hpp"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "symbols.hpp"
+
+template <typename... Ts>
+struct AllDoubles : std::true_type {};
+template <typename T, typename... Ts>
+struct AllDoubles<T, Ts...>
+    : std::integral_constant<bool, std::is_same<T, double>::value &&
+                                       AllDoubles<Ts...>::value> {};
+
+// A Kaleidoscope session for embedding: compile source held in memory and
+// call the result through typed function pointers.
+//
+// Each engine has its own identifiers, parser state, LLVM context, JIT and
+// CodeGenOptions, such as its optimization pipeline and target CPU, and
+// nothing it uses is shared with other engines, so engines on different
+// threads compile and run in parallel without contending. A single engine is
+// not thread-safe, and a function pointer stays valid only as long as its
+// engine.
+//
+// Compiling an edited source again only rebuilds what changed. Each
+// definition is fingerprinted, and one whose fingerprint matches the
+// compiled version is reused. Rebuilt are the changed ones, those that
+// inlined a rebuilt one, and the callers of one whose arity changed. Every
+// definition is called through a stub (see HotSwapper), so code that is
+// reused calls the new versions of whatever it did not inline. That costs
+// an indirect jump per call left after inlining: the engine_calls bench, a
+// tree of 2M calls under the default passes, which inline nothing, runs
+// about a third slower than with direct calls. Engines do not relink, so
+// the swapper keeps no bitcode and counts no calls.
+class Engine {
+ public:
+  struct CompileReport {
+    unsigned Reused = 0;   // definitions in the source already compiled
+    unsigned Rebuilt = 0;  // definitions compiled, including dependents
+  };
+
+ private:
+  struct Definition {
+    std::unique_ptr<FunctionAST> AST;
+    uint64_t Fingerprint = 0;
+    bool Compiled = false;
+    std::vector<SymbolID> Callees;  // from the AST, one per call, sorted
+    std::vector<SymbolID> Inlined;  // callees with fewer calls left
+  };
+
+  SymbolTable Names;
+  Parser P;
+  std::unique_ptr<CodeGenVisitor> CG;
+  std::unique_ptr<HotSwapper> Swapper;
+  SymbolMap<Definition> Library;
+  std::vector<SymbolID> Defined;  // keys of Library
+  CompileReport Report;
+
+  bool build(const std::vector<SymbolID> &Rebuild);
+  void *lookup(llvm::StringRef Name, size_t Arity);
+
+ public:
+  explicit Engine(CodeGenOptions Options = CodeGenOptions());
+  ~Engine();
+  Engine(const Engine &) = delete;
+  Engine &operator=(const Engine &) = delete;
+
+  // Compile the definitions and externs of Source as one optimized module,
+  // then evaluate its top-level expressions in order and append their values
+  // to Results, if given. Definitions may call those of earlier calls, and
+  // replace them for every caller. Reports errors to stderr and returns
+  // false if any item failed.
+  bool compile(llvm::StringRef Source, std::vector<double> *Results = nullptr);
+  bool compile(const llvm::MemoryBuffer &Buffer,
+               std::vector<double> *Results = nullptr) {
+    return compile(Buffer.getBuffer(), Results);
+  }
+
+  // How many definitions the last compile() reused and rebuilt.
+  const CompileReport &lastCompile() const { return Report; }
+
+  // The compiled function Name taking sizeof...(ArgTs) doubles, e.g.
+  // function<double, double>("f"). Null if there is no such function.
+  template <typename... ArgTs>
+  double (*function(llvm::StringRef Name))(ArgTs...) {
+    static_assert(AllDoubles<ArgTs...>::value,
+                  "Kaleidoscope functions take and return doubles");
+    return (double (*)(ArgTs...))lookup(Name, sizeof...(ArgTs));
+  }
+};
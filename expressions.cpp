@@ -1,14 +1,77 @@
 #include "expressions.hpp"
 
-llvm::Value* NumberExprAST::Accept(CodeGenVisitor& v) { return v.Visit(*this); }
+#include <type_traits>
 
-llvm::Value* VariableExprAST::Accept(CodeGenVisitor& v) {
-  return v.Visit(*this);
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MathExtras.h"
+
+// The arena never runs destructors.
+static_assert(std::is_trivially_destructible<NumberExprAST>::value &&
+                  std::is_trivially_destructible<VariableExprAST>::value &&
+                  std::is_trivially_destructible<BinaryExprAST>::value &&
+                  std::is_trivially_destructible<CallExprAST>::value,
+              "expression nodes must be trivially destructible");
+
+llvm::Value* ExprAST::Accept(CodeGenVisitor& v) {
+  switch (getKind()) {
+    case EK_Number:
+      return v.Visit(*llvm::cast<NumberExprAST>(this));
+    case EK_Variable:
+      return v.Visit(*llvm::cast<VariableExprAST>(this));
+    case EK_Binary:
+      return v.Visit(*llvm::cast<BinaryExprAST>(this));
+    case EK_Call:
+      return v.Visit(*llvm::cast<CallExprAST>(this));
+  }
+  llvm_unreachable("unknown expression kind");
+}
+
+void CollectCallees(const ExprAST* E, llvm::SmallVectorImpl<SymbolID>& Out) {
+  if (auto* B = llvm::dyn_cast<BinaryExprAST>(E)) {
+    CollectCallees(B->LHS, Out);
+    CollectCallees(B->RHS, Out);
+  } else if (auto* C = llvm::dyn_cast<CallExprAST>(E)) {
+    for (auto* Arg : C->args()) CollectCallees(Arg, Out);
+    Out.push_back(C->Callee);
+  }
 }
 
-llvm::Value* BinaryExprAST::Accept(CodeGenVisitor& v) { return v.Visit(*this); }
+static llvm::hash_code HashExpr(const ExprAST* E,
+                                llvm::ArrayRef<SymbolID> Params) {
+  switch (E->getKind()) {
+    case ExprAST::EK_Number:
+      return llvm::hash_combine(
+          E->getKind(), llvm::DoubleToBits(llvm::cast<NumberExprAST>(E)->Val));
+    case ExprAST::EK_Variable: {
+      SymbolID Name = llvm::cast<VariableExprAST>(E)->Name;
+      auto I = llvm::find(Params, Name);
+      if (I != Params.end())
+        return llvm::hash_combine(E->getKind(), I - Params.begin());
+      return llvm::hash_combine(E->getKind(), Symbols().name(Name));
+    }
+    case ExprAST::EK_Binary: {
+      auto* B = llvm::cast<BinaryExprAST>(E);
+      return llvm::hash_combine(E->getKind(), B->Op, HashExpr(B->LHS, Params),
+                                HashExpr(B->RHS, Params));
+    }
+    case ExprAST::EK_Call: {
+      auto* C = llvm::cast<CallExprAST>(E);
+      auto H = llvm::hash_combine(E->getKind(), Symbols().name(C->Callee),
+                                  C->NumArgs);
+      for (auto* Arg : C->args())
+        H = llvm::hash_combine(H, HashExpr(Arg, Params));
+      return H;
+    }
+  }
+  llvm_unreachable("unknown expression kind");
+}
 
-llvm::Value* CallExprAST::Accept(CodeGenVisitor& v) { return v.Visit(*this); }
+uint64_t Fingerprint(const FunctionAST& F) {
+  auto& Params = F.Proto->Args;
+  return llvm::hash_combine(Params.size(), HashExpr(F.Body, Params));
+}
 
 llvm::Function* PrototypeAST::Accept(CodeGenVisitor& v) {
   return v.Visit(*this);
@@ -16,4 +79,4 @@ llvm::Function* PrototypeAST::Accept(CodeGenVisitor& v) {
 
 llvm::Function* FunctionAST::Accept(CodeGenVisitor& v) {
   return v.Visit(*this);
-}
\ No newline at end of file
+}
@@ -1,74 +1,122 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "codegen.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Casting.h"
+#include "symbols.hpp"
+
+// Expression nodes are bump-allocated from the arena of the top-level item
+// (FunctionAST) they belong to and are released with it in one shot. Nodes are
+// trivially destructible and dispatch on Kind instead of a vtable. Most bodies
+// are a few hundred bytes, so slabs are kept small to keep items dense.
+using ASTArena = llvm::BumpPtrAllocatorImpl<llvm::MallocAllocator, 512>;
 
 class ExprAST {
  public:
-  virtual ~ExprAST() {}
-  virtual llvm::Value *Accept(CodeGenVisitor &) = 0;
+  enum ExprKind : uint8_t { EK_Number, EK_Variable, EK_Binary, EK_Call };
+
+ private:
+  const ExprKind Kind;
+
+ protected:
+  explicit ExprAST(ExprKind K) : Kind(K) {}
+
+ public:
+  // Line of the token the node was parsed from, for line tables: the name of
+  // a variable or callee, or a binary operator. 0 where none was recorded.
+  unsigned Line = 0;
+
+  ExprKind getKind() const { return Kind; }
+  llvm::Value *Accept(CodeGenVisitor &);
 };
 
 // Expression class for numeric literals
 class NumberExprAST : public ExprAST {
  public:
   double Val;
-  NumberExprAST(double Val) : Val(Val) {}
-  virtual llvm::Value *Accept(CodeGenVisitor &);
+  NumberExprAST(double Val) : ExprAST(EK_Number), Val(Val) {}
+
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Number; }
 };
 
 // Expression class for referencing a variable
 class VariableExprAST : public ExprAST {
  public:
-  std::string Name;
-  VariableExprAST(const std::string &Name) : Name(Name) {}
-  virtual llvm::Value *Accept(CodeGenVisitor &);
+  SymbolID Name;
+  VariableExprAST(SymbolID Name) : ExprAST(EK_Variable), Name(Name) {}
+
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Variable; }
 };
 
 // Expression class for a binary operator
 class BinaryExprAST : public ExprAST {
  public:
   char Op;
-  std::unique_ptr<ExprAST> LHS, RHS;
-  virtual llvm::Value *Accept(CodeGenVisitor &);
+  ExprAST *LHS, *RHS;
 
-  BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS,
-                std::unique_ptr<ExprAST> RHS)
-      : Op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+  BinaryExprAST(char op, ExprAST *LHS, ExprAST *RHS)
+      : ExprAST(EK_Binary), Op(op), LHS(LHS), RHS(RHS) {}
+
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Binary; }
 };
 
-// Expression class for function calls.
+// Expression class for function calls. The argument array is arena-owned.
 class CallExprAST : public ExprAST {
  public:
-  std::string Callee;
-  std::vector<std::unique_ptr<ExprAST>> Args;
-  virtual llvm::Value *Accept(CodeGenVisitor &);
+  SymbolID Callee;
+  unsigned NumArgs;
+  ExprAST **Args;
+
+  CallExprAST(SymbolID Callee, ExprAST **Args, unsigned NumArgs)
+      : ExprAST(EK_Call), Callee(Callee), NumArgs(NumArgs), Args(Args) {}
 
-  CallExprAST(const std::string &Callee,
-              std::vector<std::unique_ptr<ExprAST>> Args)
-      : Callee(Callee), Args(std::move(Args)) {}
+  llvm::ArrayRef<ExprAST *> args() const { return {Args, NumArgs}; }
+
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Call; }
 };
 
+// Append the callee of every call in E to Out, in evaluation order.
+void CollectCallees(const ExprAST *E, llvm::SmallVectorImpl<SymbolID> &Out);
+
 // This class represents the "prototype" for a function,
 // which captures its name, and its argument names (thus implicitly the number
-// of arguments the function takes).
+// of arguments the function takes). Prototypes outlive the definition they
+// came from (see CodeGenVisitor::FunctionProtos), so they are not arena-owned.
 class PrototypeAST {
  public:
-  std::string Name;
-  std::vector<std::string> Args;
+  SymbolID Name;
+  std::vector<SymbolID> Args;
+  // Where the item starts, for line tables; File is from getSourceName.
+  const char *File = nullptr;
+  unsigned Line = 0;
+  // Declared with "extern", so defined outside the program, e.g. in libm.
+  bool IsExtern = false;
   llvm::Function *Accept(CodeGenVisitor &);
-  PrototypeAST(const std::string &name, std::vector<std::string> Args)
+  PrototypeAST(SymbolID name, std::vector<SymbolID> Args)
       : Name(name), Args(std::move(Args)) {}
 
-  const std::string &getName() const { return Name; }
+  llvm::StringRef getName() const { return Symbols().name(Name); }
 };
 
-// This class represents a function definition itself.
+// This class represents a function definition itself. It owns the arena that
+// holds its body.
 class FunctionAST {
  public:
   std::unique_ptr<PrototypeAST> Proto;
-  std::unique_ptr<ExprAST> Body;
+  ExprAST *Body;
+  ASTArena Arena;
   llvm::Function *Accept(CodeGenVisitor &);
-  FunctionAST(std::unique_ptr<PrototypeAST> Proto,
-              std::unique_ptr<ExprAST> Body)
-      : Proto(std::move(Proto)), Body(std::move(Body)) {}
+  FunctionAST(std::unique_ptr<PrototypeAST> Proto, ExprAST *Body,
+              ASTArena Arena)
+      : Proto(std::move(Proto)), Body(Body), Arena(std::move(Arena)) {}
 };
+
+// A hash of what F computes: its arity and the structure of its body, with
+// parameters by position and callees by name. Renaming a parameter keeps the
+// fingerprint; any other edit changes it, barring collisions.
+uint64_t Fingerprint(const FunctionAST &F);
@@ -0,0 +1,115 @@
+#include "front_end.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "symbols.hpp"
+
+// Parse the file at Path with the calling thread's interner.
+static bool ParseFile(const std::string &Path,
+                      std::vector<SourceItem> &Items) {
+  auto L = Lexer::fromFile(Path);
+  if (!L) return false;
+  LexerScope Scope(std::move(L));
+  Parser P;
+  getNextToken();
+  while (getCurrentToken().type != (int)tok_eof) {
+    switch (getCurrentToken().type) {
+      case ';':
+        getNextToken();
+        break;
+      case (int)tok_def:
+        if (auto F = P.ParseDefinition())
+          Items.push_back({SourceItem::Definition, std::move(F), nullptr});
+        else
+          getNextToken();
+        break;
+      case (int)tok_extern:
+        if (auto Proto = P.ParseExtern())
+          Items.push_back({SourceItem::Extern, nullptr, std::move(Proto)});
+        else
+          getNextToken();
+        break;
+      default:
+        if (auto F = P.ParseTopLevelExpr())
+          Items.push_back({SourceItem::Expression, std::move(F), nullptr});
+        else
+          getNextToken();
+        break;
+    }
+  }
+  return true;
+}
+
+// Replace every symbol ID with To[ID].
+static void Remap(PrototypeAST &P, const std::vector<SymbolID> &To) {
+  P.Name = To[P.Name];
+  for (auto &Arg : P.Args) Arg = To[Arg];
+}
+
+static void Remap(ExprAST *E, const std::vector<SymbolID> &To) {
+  if (auto *V = llvm::dyn_cast<VariableExprAST>(E)) {
+    V->Name = To[V->Name];
+  } else if (auto *B = llvm::dyn_cast<BinaryExprAST>(E)) {
+    Remap(B->LHS, To);
+    Remap(B->RHS, To);
+  } else if (auto *C = llvm::dyn_cast<CallExprAST>(E)) {
+    C->Callee = To[C->Callee];
+    for (auto *Arg : C->args()) Remap(Arg, To);
+  }
+}
+
+bool ParseFiles(const std::vector<std::string> &Paths, unsigned NumThreads,
+                std::vector<SourceItem> &Items) {
+  NumThreads = std::min<size_t>(NumThreads, Paths.size());
+  if (NumThreads <= 1) {
+    bool OK = true;
+    for (auto &Path : Paths) OK &= ParseFile(Path, Items);
+    return OK;
+  }
+
+  struct Unit {
+    SymbolTable Names;
+    std::vector<SourceItem> Items;
+    bool OK = false;
+  };
+  std::vector<std::unique_ptr<Unit>> Units;
+  for (size_t I = 0; I < Paths.size(); I++)
+    Units.push_back(std::make_unique<Unit>());
+
+  // Threads take the next file as they finish one, so a few large files do
+  // not leave the others idle.
+  std::atomic<size_t> Next{0};
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; T++)
+    Threads.emplace_back([&] {
+      for (size_t I; (I = Next++) < Paths.size();) {
+        Unit &U = *Units[I];
+        SymbolScope Scope(U.Names);
+        U.OK = ParseFile(Paths[I], U.Items);
+      }
+    });
+  for (auto &T : Threads) T.join();
+
+  bool OK = true;
+  std::vector<SymbolID> To;
+  for (auto &U : Units) {
+    OK &= U->OK;
+    To.resize(U->Names.size());
+    for (SymbolID Sym = 0; Sym < To.size(); Sym++)
+      To[Sym] = Symbols().intern(U->Names.name(Sym));
+    for (auto &Item : U->Items) {
+      if (Item.Function) {
+        Remap(*Item.Function->Proto, To);
+        Remap(Item.Function->Body, To);
+      } else {
+        Remap(*Item.Proto, To);
+      }
+      Items.push_back(std::move(Item));
+    }
+  }
+  return OK;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "expressions.hpp"
+
+// A top-level item of a source file.
+struct SourceItem {
+  enum ItemKind { Definition, Extern, Expression };
+  ItemKind Kind;
+  std::unique_ptr<FunctionAST> Function;  // definitions and expressions
+  std::unique_ptr<PrototypeAST> Proto;    // externs
+};
+
+// Lex and parse the files at Paths, up to NumThreads of them at once. Each
+// file is parsed on a thread of its own, with its own lexer, parser and
+// interner, so the threads share nothing until they are done; the names
+// they interned are then moved over to the calling thread's interner.
+//
+// Items come out in a deterministic order, whatever the threads' timing:
+// file by file in the order given, each in source order. Items that do not
+// parse are reported and skipped. Returns false, after reporting, if a file
+// cannot be read.
+bool ParseFiles(const std::vector<std::string> &Paths, unsigned NumThreads,
+                std::vector<SourceItem> &Items);
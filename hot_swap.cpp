@@ -0,0 +1,196 @@
+#include "hot_swap.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+
+#include "codegen.hpp"
+#include "stats.hpp"
+#include "tiering.hpp"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+// RuntimeDyld resolves the external symbols of an object in time quadratic
+// in their number, and every call here is to an external stub: one object
+// of 3000 definitions took 1.8 s to link against 0.14 s for 1000. Larger
+// modules are split into objects of this many definitions.
+static const size_t MaxDefinitionsPerObject = 256;
+
+llvm::JITTargetAddress HotSwapper::lookup(const std::string &Name) {
+  auto Addr = JIT.findSymbol(Name).getAddress();
+  if (!Addr) {
+    fprintf(stderr, "%s\n", llvm::toString(Addr.takeError()).c_str());
+    return 0;
+  }
+  return *Addr;
+}
+
+void HotSwapper::addModule(std::unique_ptr<llvm::Module> M) {
+  std::shared_ptr<Bitcode> BC;
+  if (Relinkable) {
+    BC = std::make_shared<Bitcode>();
+    llvm::raw_svector_ostream OS(*BC);
+    llvm::WriteBitcodeToFile(*M, OS);
+  }
+
+  std::vector<llvm::Function *> Defs;
+  for (auto &F : *M)
+    if (!F.isDeclaration()) Defs.push_back(&F);
+
+  std::vector<std::pair<SymbolID, std::string>> Bodies;
+  for (auto *F : Defs) {
+    std::string Name = F->getName().str();
+    SymbolID Sym = Symbols().intern(Name);
+    if (auto *D = Current.find(Sym)) {
+      ++Swaps;
+      if (D->Calls) *D->Calls = 0;
+    } else {
+      // Linking the module below resolves calls to the stub, so it has to
+      // exist already; it is pointed at the new code right after.
+      JIT.setStub(Name, 0);
+      Current[Sym];
+      Defined.push_back(Sym);
+      if (Relinkable) {
+        Counters.push_back(0);
+        uint64_t *Calls = &Counters.back();
+        Current.find(Sym)->Calls = Calls;
+        JIT.addHostSymbol(Name + ".calls",
+                          (llvm::JITTargetAddress)(uintptr_t)Calls);
+      }
+    }
+    // BC was written before, so relinked code does not count its calls.
+    if (Relinkable) AddCallCounter(*F, Name, 0);
+
+    // Move the body aside, leaving calls to Name, including those within
+    // this module, to go through the stub.
+    std::string Body = Name + ".v" + std::to_string(NextVersion++);
+    F->setName(Body);
+    auto *Decl = llvm::Function::Create(
+        F->getFunctionType(), llvm::Function::ExternalLinkage, Name, *M);
+    F->replaceAllUsesWith(Decl);
+    Bodies.emplace_back(Sym, std::move(Body));
+  }
+
+  if (Defs.size() <= MaxDefinitionsPerObject) {
+    JIT.addModule(std::move(M));
+  } else {
+    // The bodies only call each other through the stubs, so each part is
+    // complete with declarations of the rest.
+    for (size_t I = 0; I < Defs.size(); I += MaxDefinitionsPerObject) {
+      size_t End = std::min(Defs.size(), I + MaxDefinitionsPerObject);
+      llvm::DenseSet<const llvm::GlobalValue *> Part(
+          Defs.begin() + I, Defs.begin() + End);
+      llvm::ValueToValueMapTy VMap;
+      JIT.addModule(llvm::CloneModule(
+          *M, VMap,
+          [&](const llvm::GlobalValue *GV) { return Part.count(GV) != 0; }));
+    }
+  }
+  if (Relinked && !Bodies.empty()) {
+    for (SymbolID Sym : Defined)
+      JIT.setStub(Symbols().name(Sym).str(), Current.find(Sym)->Body);
+    Relinked = false;
+  }
+  for (auto &B : Bodies) {
+    auto &D = *Current.find(B.first);
+    D.Module = BC;
+    D.Body = lookup(B.second);
+    JIT.setStub(Symbols().name(B.first).str(), D.Body);
+  }
+}
+
+bool HotSwapper::relink() {
+  if (!Relinkable) {
+    fprintf(stderr, "relink: the definitions were not kept\n");
+    return false;
+  }
+  std::vector<SymbolID> Hot;
+  for (SymbolID Sym : Defined)
+    if (*Current.find(Sym)->Calls >= Threshold) Hot.push_back(Sym);
+  if (Hot.empty()) return true;
+
+  // Take each hot definition from the module it was generated in. The
+  // others there have been replaced or are cold, and are left as
+  // declarations that bind to their stubs.
+  std::vector<std::pair<std::shared_ptr<const Bitcode>, std::vector<SymbolID>>>
+      Sources;
+  for (SymbolID Sym : Hot) {
+    auto &D = *Current.find(Sym);
+    auto S = std::find_if(Sources.begin(), Sources.end(),
+                          [&](const decltype(Sources)::value_type &S) {
+                            return S.first == D.Module;
+                          });
+    if (S == Sources.end())
+      Sources.push_back({D.Module, {Sym}});
+    else
+      S->second.push_back(Sym);
+  }
+
+  llvm::LLVMContext Ctx;
+  std::unique_ptr<llvm::Module> M;
+  for (auto &S : Sources) {
+    llvm::MemoryBufferRef Buf(
+        llvm::StringRef(S.first->data(), S.first->size()), "relink");
+    auto Src = llvm::cantFail(llvm::getLazyBitcodeModule(Buf, Ctx));
+    for (auto &F : *Src) {
+      if (!F.isMaterializable()) continue;
+      if (std::find(S.second.begin(), S.second.end(),
+                    Symbols().intern(F.getName())) == S.second.end())
+        F.deleteBody();
+      else
+        llvm::cantFail(F.materialize());
+    }
+    llvm::cantFail(Src->materializeAll());
+    if (!M) {
+      M = std::move(Src);
+    } else if (llvm::Linker::linkModules(*M, std::move(Src))) {
+      fprintf(stderr, "relink: cannot link the definitions\n");
+      return false;
+    }
+  }
+
+  // Calls within M now go straight to the definitions. Give them names of
+  // their own so that callers elsewhere keep binding to the stubs.
+  std::vector<std::pair<SymbolID, std::string>> Bodies;
+  for (SymbolID Sym : Hot) {
+    std::string Body =
+        Symbols().name(Sym).str() + ".v" + std::to_string(NextVersion++);
+    M->getFunction(Symbols().name(Sym))->setName(Body);
+    Bodies.emplace_back(Sym, std::move(Body));
+  }
+  CodeGenVisitor::OptimizeModule(*M, Options, &JIT.getTargetMachine());
+  {
+    ScopedTimer T(Phase::Compile);
+    auto Obj = llvm::orc::SimpleCompiler(JIT.getTargetMachine())(*M);
+    if (!Obj) {
+      fprintf(stderr, "relink: cannot compile the definitions\n");
+      return false;
+    }
+    JIT.addObject(std::move(Obj));
+  }
+
+  std::vector<llvm::JITTargetAddress> Addrs;
+  for (auto &B : Bodies) {
+    Addrs.push_back(lookup(B.second));
+    if (!Addrs.back()) return false;
+  }
+  for (size_t I = 0; I < Bodies.size(); I++)
+    JIT.setStub(Symbols().name(Bodies[I].first).str(), Addrs[I]);
+  Relinked = true;
+  RelinkedFunctions = Hot.size();
+  ++Relinks;
+  return true;
+}
+
+void HotSwapper::printStats(llvm::raw_ostream &OS) {
+  OS << "hot swap: " << Defined.size() << " functions, " << Swaps
+     << " redefinitions, " << Relinks << " relinks";
+  if (Relinked) OS << " (calls among " << RelinkedFunctions << " are direct)";
+  OS << '\n';
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "codegen.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "symbols.hpp"
+
+// Definitions that can be replaced while the program runs.
+//
+// Every function is called through a stub named after it, and its code is
+// emitted as <name>.v<N>. Redefining a function compiles the new version
+// and repoints the stub, which is a single pointer store, so existing
+// callers switch over on their next call without being recompiled.
+//
+// relink() trades the indirection back for speed once the definitions have
+// settled. It needs a Relinkable swapper, which keeps every module it is
+// given as bitcode and has each separately compiled version count its
+// calls, as tier 0 does with --tiered. relink() compiles the current version of every
+// function called at least Threshold times into one module whose calls go
+// directly to each other, where they may also be inlined, and points their
+// stubs at that. Calls to the other functions still go through stubs.
+// Redefining anything afterwards puts every stub back on its separately
+// compiled version, since the relinked callers would still call the old
+// one.
+//
+// A relink costs a compile of all the hot functions together, however few
+// of them changed since the last one, and adds their code to the JIT
+// without freeing the versions it replaces. It must not be called from JIT
+// code, which may be running the code whose stubs it repoints.
+//
+// Replaced code is never freed, as it may still be running. Like the
+// TieredCompiler, this is used on the thread that owns the JIT.
+class HotSwapper {
+  using Bitcode = llvm::SmallVector<char, 0>;
+
+  struct Definition {
+    // The module that defines the current version, as generated.
+    std::shared_ptr<const Bitcode> Module;
+    llvm::JITTargetAddress Body = 0;  // <name>.v<N>
+    // Calls to the current version, counted by its separately compiled code.
+    uint64_t *Calls = nullptr;
+  };
+
+  llvm::orc::KaleidoscopeJIT &JIT;
+  const CodeGenOptions Options;  // for relink()
+  const bool Relinkable;
+  const uint64_t Threshold;
+  std::deque<uint64_t> Counters;  // one per name, at stable addresses
+  SymbolMap<Definition> Current;
+  std::vector<SymbolID> Defined;  // in order of first definition
+  unsigned NextVersion = 0;
+  bool Relinked = false;
+  unsigned Swaps = 0, Relinks = 0;
+  size_t RelinkedFunctions = 0;  // by the last relink()
+
+  llvm::JITTargetAddress lookup(const std::string &Name);
+
+ public:
+  // Threshold is the calls that make a function hot for relink(); with 0,
+  // relink() takes every function.
+  HotSwapper(llvm::orc::KaleidoscopeJIT &JIT, const CodeGenOptions &Options,
+             bool Relinkable = false, uint64_t Threshold = 0)
+      : JIT(JIT),
+        Options(Options),
+        Relinkable(Relinkable),
+        Threshold(Threshold) {}
+
+  // Compile the definitions in M, replacing any earlier ones of the same
+  // name for every caller.
+  void addModule(std::unique_ptr<llvm::Module> M);
+  // Compile the current definitions of the hot functions into one module
+  // with direct calls and route their stubs to it. Reports and returns false
+  // on failure, leaving the stubs as they were.
+  bool relink();
+  void printStats(llvm::raw_ostream &OS);
+};
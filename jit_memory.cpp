@@ -0,0 +1,326 @@
+#include "jit_memory.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Process.h"
+
+using llvm::sys::Memory;
+using llvm::sys::MemoryBlock;
+
+static unsigned FinalFlags(JITMemoryPool::Kind K) {
+  switch (K) {
+    case JITMemoryPool::Code:
+      return Memory::MF_READ | Memory::MF_EXEC;
+    case JITMemoryPool::ReadOnly:
+      return Memory::MF_READ;
+    default:
+      return Memory::MF_READ | Memory::MF_WRITE;
+  }
+}
+
+static size_t PageSize() {
+  static const size_t Size = llvm::sys::Process::getPageSizeEstimate();
+  return Size;
+}
+
+JITMemoryPool::~JITMemoryPool() {
+  for (auto &S : Slabs)
+    if (S.Mem.base()) Memory::releaseMappedMemory(S.Mem);
+}
+
+int JITMemoryPool::newSlab(Kind K) {
+  std::error_code EC;
+  MemoryBlock Mem = Memory::allocateMappedMemory(
+      SlabSize, nullptr, Memory::MF_READ | Memory::MF_WRITE, EC);
+  if (EC) {
+    fprintf(stderr, "jit memory: %s\n", EC.message().c_str());
+    return -1;
+  }
+  int Index;
+  if (!Released.empty()) {
+    Index = Released.back();
+    Released.pop_back();
+  } else {
+    Index = Slabs.size();
+    Slabs.emplace_back();
+  }
+  Slab &S = Slabs[Index];
+  S.Mem = Mem;
+  S.K = K;
+  S.Free.assign(1, Range{0, Mem.allocatedSize()});
+  S.Used = 0;
+  S.Writers = 0;
+  S.Writable.assign(Mem.allocatedSize() / PageSize(), true);
+  S.Dirty.assign(S.Writable.size(), false);
+  S.WritablePages = S.Writable.size();
+  S.Reclaimable = false;
+  Mapped += Mem.allocatedSize();
+  return Index;
+}
+
+// The offset of the first Size bytes at Alignment in the free range F that
+// lie on writable pages only, or SIZE_MAX if there are none.
+size_t JITMemoryPool::fit(const Slab &S, Range F, size_t Size,
+                          unsigned Alignment) const {
+  auto Base = (uintptr_t)S.Mem.base();
+  size_t Start = F.Offset, End = F.Offset + F.Size;
+  while (Start < End) {
+    size_t Page = Start / PageSize(), Last = Page;
+    if (!S.Writable[Page]) {
+      Start = (Page + 1) * PageSize();
+      continue;
+    }
+    while (Last + 1 < S.Writable.size() && S.Writable[Last + 1]) Last++;
+    size_t At = llvm::alignTo(Base + Start, Alignment) - Base;
+    if (At + Size <= std::min(End, (Last + 1) * PageSize())) return At;
+    Start = (Last + 1) * PageSize();
+  }
+  return SIZE_MAX;
+}
+
+// Give the pages written since S was last sealed their final protection.
+void JITMemoryPool::seal(Slab &S) {
+  if (S.K == ReadWrite) return;
+  for (size_t First = 0; First < S.Dirty.size(); First++) {
+    if (!S.Dirty[First]) continue;
+    size_t End = First;
+    for (; End < S.Dirty.size() && S.Dirty[End]; End++)
+      S.Dirty[End] = S.Writable[End] = false;
+    S.WritablePages -= End - First;
+    MemoryBlock Pages((uint8_t *)S.Mem.base() + First * PageSize(),
+                      (End - First) * PageSize());
+    if (auto EC = Memory::protectMappedMemory(Pages, FinalFlags(S.K)))
+      fprintf(stderr, "jit memory: %s\n", EC.message().c_str());
+    First = End;
+  }
+}
+
+// Make the sealed pages of kind K that hold no live block writable again.
+// Returns false if there are none.
+bool JITMemoryPool::reopenFreePages(Kind K) {
+  bool Any = false;
+  for (auto &S : Slabs) {
+    if (S.K != K || !S.Mem.base() || !S.Reclaimable) continue;
+    for (auto &F : S.Free) reopen(S, F);
+    S.Reclaimable = false;
+    Any = true;
+  }
+  return Any;
+}
+
+// Make the sealed pages that lie wholly in the free range F writable again.
+void JITMemoryPool::reopen(Slab &S, Range F) {
+  size_t Last = (F.Offset + F.Size) / PageSize();
+  for (size_t First = llvm::alignTo(F.Offset, PageSize()) / PageSize();
+       First < Last; First++) {
+    if (S.Writable[First]) continue;
+    size_t End = First;
+    for (; End < Last && !S.Writable[End]; End++) S.Writable[End] = true;
+    S.WritablePages += End - First;
+    MemoryBlock Pages((uint8_t *)S.Mem.base() + First * PageSize(),
+                      (End - First) * PageSize());
+    if (auto EC = Memory::protectMappedMemory(
+            Pages, Memory::MF_READ | Memory::MF_WRITE))
+      fprintf(stderr, "jit memory: %s\n", EC.message().c_str());
+    First = End;
+  }
+}
+
+void JITMemoryPool::release(Slab &S) {
+  Mapped -= S.Mem.allocatedSize();
+  Memory::releaseMappedMemory(S.Mem);
+  S.Mem = MemoryBlock();
+  S.Free.clear();
+  Released.push_back(&S - Slabs.data());
+}
+
+JITMemoryPool::Block JITMemoryPool::allocate(Kind K, size_t Size,
+                                             unsigned Alignment) {
+  Alignment = std::max(Alignment, 16u);
+  Size = llvm::alignTo(std::max<size_t>(Size, 1), 16);
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  // Large sections, e.g. a batch of big definitions, would leave most of a
+  // slab unusable. Map them on their own and give them back when freed.
+  if (Size + Alignment > SlabSize / 4) {
+    std::error_code EC;
+    MemoryBlock Mem = Memory::allocateMappedMemory(
+        Size, nullptr, Memory::MF_READ | Memory::MF_WRITE, EC);
+    if (EC) {
+      fprintf(stderr, "jit memory: %s\n", EC.message().c_str());
+      return Block{nullptr, 0, K, -1};
+    }
+    Mapped += Mem.allocatedSize();
+    Live += Mem.allocatedSize();
+    Peak = std::max(Peak, Live);
+    return Block{(uint8_t *)Mem.base(), Mem.allocatedSize(), K, -1};
+  }
+
+  Block B = place(K, Size, Alignment);
+  // Nothing fits: reopen the pages freed between sealed blocks, and failing
+  // that add a slab, which has room for any small section. Reopening only
+  // when the writable pages run out costs a few mprotects per slab's worth
+  // of sections rather than one for every module removed.
+  if (!B.Addr && reopenFreePages(K)) B = place(K, Size, Alignment);
+  if (!B.Addr && newSlab(K) >= 0) B = place(K, Size, Alignment);
+  return B;
+}
+
+// The first fit for a small section in the slabs of kind K, or a block with
+// a null Addr.
+JITMemoryPool::Block JITMemoryPool::place(Kind K, size_t Size,
+                                          unsigned Alignment) {
+  for (size_t I = 0; I < Slabs.size(); I++) {
+    Slab &S = Slabs[I];
+    if (S.K != K || !S.Mem.base() || !S.WritablePages) continue;
+    auto Base = (uintptr_t)S.Mem.base();
+    for (size_t R = 0; R < S.Free.size(); R++) {
+      Range F = S.Free[R];
+      size_t Start = fit(S, F, Size, Alignment);
+      if (Start == SIZE_MAX) continue;
+      // Keep the alignment padding and the tail free, in offset order.
+      Range Tail{Start + Size, F.Offset + F.Size - (Start + Size)};
+      if (Start > F.Offset) {
+        S.Free[R].Size = Start - F.Offset;
+        if (Tail.Size) S.Free.insert(S.Free.begin() + R + 1, Tail);
+      } else if (Tail.Size) {
+        S.Free[R] = Tail;
+      } else {
+        S.Free.erase(S.Free.begin() + R);
+      }
+      S.Used += Size;
+      S.Writers++;
+      if (K != ReadWrite)
+        for (size_t P = Start / PageSize(); P * PageSize() < Start + Size; P++)
+          S.Dirty[P] = true;
+      Live += Size;
+      Peak = std::max(Peak, Live);
+      return Block{(uint8_t *)Base + Start, Size, K, (int)I};
+    }
+  }
+  return Block{nullptr, 0, K, -1};
+}
+
+void JITMemoryPool::finalize(const Block &B) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  if (B.Slab < 0) {
+    if (B.K == ReadWrite) return;
+    MemoryBlock Mem(B.Addr, B.Size);
+    if (auto EC = Memory::protectMappedMemory(Mem, FinalFlags(B.K)))
+      fprintf(stderr, "jit memory: %s\n", EC.message().c_str());
+    return;
+  }
+  // Other modules in the slab may still be loading; the last one to finish
+  // seals the pages they were all written to.
+  Slab &S = Slabs[B.Slab];
+  if (--S.Writers == 0) seal(S);
+}
+
+void JITMemoryPool::free(const Block &B) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  Live -= B.Size;
+  if (B.Slab < 0) {
+    Mapped -= B.Size;
+    MemoryBlock Mem(B.Addr, B.Size);
+    Memory::releaseMappedMemory(Mem);
+    return;
+  }
+
+  Slab &S = Slabs[B.Slab];
+  Range F{size_t(B.Addr - (uint8_t *)S.Mem.base()), B.Size};
+  auto I = std::lower_bound(
+      S.Free.begin(), S.Free.end(), F,
+      [](const Range &A, const Range &B) { return A.Offset < B.Offset; });
+  // Merge with the free ranges on either side.
+  if (I != S.Free.end() && F.Offset + F.Size == I->Offset) {
+    F.Size += I->Size;
+    I = S.Free.erase(I);
+  }
+  if (I != S.Free.begin() && std::prev(I)->Offset + std::prev(I)->Size ==
+                                 F.Offset) {
+    std::prev(I)->Size += F.Size;
+    F = *std::prev(I);
+  } else {
+    S.Free.insert(I, F);
+  }
+  // Note sealed pages the merged range now covers, for reopenFreePages.
+  if (S.K != ReadWrite)
+    for (size_t P = llvm::alignTo(F.Offset, PageSize()) / PageSize();
+         (P + 1) * PageSize() <= F.Offset + F.Size; P++)
+      if (!S.Writable[P]) {
+        S.Reclaimable = true;
+        break;
+      }
+  S.Used -= B.Size;
+  if (S.Used) return;
+
+  unsigned Empty = 0;
+  for (auto &Other : Slabs)
+    if (Other.Mem.base() && !Other.Used) Empty++;
+  if (Empty > SpareSlabs) release(S);
+}
+
+size_t JITMemoryPool::liveBytes() const {
+  std::lock_guard<std::mutex> Guard(Lock);
+  return Live;
+}
+
+size_t JITMemoryPool::peakBytes() const {
+  std::lock_guard<std::mutex> Guard(Lock);
+  return Peak;
+}
+
+size_t JITMemoryPool::mappedBytes() const {
+  std::lock_guard<std::mutex> Guard(Lock);
+  return Mapped;
+}
+
+void JITMemoryPool::printStats(llvm::raw_ostream &OS) const {
+  std::lock_guard<std::mutex> Guard(Lock);
+  OS << "jit memory: " << Live << " bytes live, " << Peak << " peak, "
+     << Mapped << " mapped\n";
+}
+
+PooledMemoryManager::~PooledMemoryManager() {
+  deregisterEHFrames();
+  finalizeMemory();
+  for (auto &B : Blocks) Pool->free(B);
+}
+
+uint8_t *PooledMemoryManager::allocate(JITMemoryPool::Kind K, uintptr_t Size,
+                                       unsigned Alignment) {
+  auto B = Pool->allocate(K, Size, Alignment);
+  if (B.Addr) Blocks.push_back(B);
+  return B.Addr;
+}
+
+uint8_t *PooledMemoryManager::allocateCodeSection(uintptr_t Size,
+                                                  unsigned Alignment,
+                                                  unsigned SectionID,
+                                                  llvm::StringRef SectionName) {
+  return allocate(JITMemoryPool::Code, Size, Alignment);
+}
+
+uint8_t *PooledMemoryManager::allocateDataSection(uintptr_t Size,
+                                                  unsigned Alignment,
+                                                  unsigned SectionID,
+                                                  llvm::StringRef SectionName,
+                                                  bool IsReadOnly) {
+  return allocate(IsReadOnly ? JITMemoryPool::ReadOnly
+                             : JITMemoryPool::ReadWrite,
+                  Size, Alignment);
+}
+
+bool PooledMemoryManager::finalizeMemory(std::string *ErrMsg) {
+  for (size_t I = Unfinalized; I < Blocks.size(); I++) {
+    auto &B = Blocks[I];
+    if (B.K == JITMemoryPool::Code)
+      Memory::InvalidateInstructionCache(B.Addr, B.Size);
+    Pool->finalize(B);
+  }
+  Unfinalized = Blocks.size();
+  return false;  // no error
+}
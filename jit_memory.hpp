@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Memory for JIT-compiled sections, carved out of slabs that modules share.
+//
+// SectionMemoryManager maps fresh pages for every module and unmaps them when
+// the module is removed, so evaluating a top-level expression costs a few
+// mmap/mprotect/munmap calls and leaves RSS fragmented. Here each kind of
+// section (code, read-only data, writable data) has its own slabs, blocks
+// are allocated first-fit from them and freed blocks coalesce for reuse.
+// Emptied slabs beyond a few spares go back to the system, so repeatedly
+// adding and removing modules runs in constant memory.
+//
+// Code and read-only blocks are only placed on writable pages. Finalizing
+// the modules being loaded gives just the pages they were written to their
+// final protection, usually one mprotect per kind of section. Sealed pages
+// are never made writable again while anything in them is live, so code
+// already loaded keeps running; once every block on a page is freed, the
+// page is reopened for writing when the writable pages run out. The space of
+// a discarded expression is thus reused even while definitions loaded after
+// it stay. Modules are loaded by
+// the thread that owns the JIT.
+class JITMemoryPool {
+ public:
+  enum Kind { Code, ReadOnly, ReadWrite, NumKinds };
+
+  struct Block {
+    uint8_t *Addr;
+    size_t Size;
+    Kind K;
+    int Slab;  // -1 for a block mapped on its own
+  };
+
+  ~JITMemoryPool();
+
+  // A writable block, or one with a null Addr if the system is out of
+  // memory. Code and read-only blocks stay writable until finalized.
+  Block allocate(Kind K, size_t Size, unsigned Alignment);
+  void finalize(const Block &B);
+  // B must have been finalized.
+  void free(const Block &B);
+
+  // Bytes in blocks handed out and not yet freed, the most there ever were,
+  // and bytes currently mapped for them.
+  size_t liveBytes() const;
+  size_t peakBytes() const;
+  size_t mappedBytes() const;
+  void printStats(llvm::raw_ostream &OS) const;
+
+ private:
+  enum : size_t { SlabSize = 256 << 10, SpareSlabs = 2 };
+
+  struct Range {
+    size_t Offset, Size;
+  };
+  struct Slab {
+    llvm::sys::MemoryBlock Mem;  // empty once released
+    Kind K;
+    std::vector<Range> Free;  // sorted by offset, coalesced
+    size_t Used = 0;
+    unsigned Writers = 0;  // unfinalized blocks
+    // Per page, for code and read-only slabs: whether it may be written,
+    // and whether it has been since the slab was last sealed.
+    std::vector<bool> Writable, Dirty;
+    size_t WritablePages = 0;
+    bool Reclaimable = false;  // some sealed page holds no live block
+  };
+
+  mutable std::mutex Lock;
+  std::vector<Slab> Slabs;
+  std::vector<int> Released;  // indices of Slabs to map again
+  size_t Live = 0, Peak = 0, Mapped = 0;
+
+  int newSlab(Kind K);
+  Block place(Kind K, size_t Size, unsigned Alignment);
+  size_t fit(const Slab &S, Range F, size_t Size, unsigned Alignment) const;
+  void seal(Slab &S);
+  bool reopenFreePages(Kind K);
+  void reopen(Slab &S, Range F);
+  void release(Slab &S);
+};
+
+// The memory manager of one module: sections come from a JITMemoryPool and
+// go back to it when the module is removed from the JIT.
+class PooledMemoryManager : public llvm::RTDyldMemoryManager {
+  std::shared_ptr<JITMemoryPool> Pool;
+  std::vector<JITMemoryPool::Block> Blocks;
+  size_t Unfinalized = 0;  // Blocks[Unfinalized..] are still being written
+
+  uint8_t *allocate(JITMemoryPool::Kind K, uintptr_t Size, unsigned Alignment);
+
+ public:
+  explicit PooledMemoryManager(std::shared_ptr<JITMemoryPool> Pool)
+      : Pool(std::move(Pool)) {}
+  ~PooledMemoryManager() override;
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               llvm::StringRef SectionName) override;
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, llvm::StringRef SectionName,
+                               bool IsReadOnly) override;
+  bool finalizeMemory(std::string *ErrMsg = nullptr) override;
+};
@@ -1,27 +1,148 @@
 #include "lexer.hpp"
 
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex>
+#include <set>
 #include <string>
 
+#include "stats.hpp"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+
 /******************************
  * Lexer
  *******************************/
 
-static Token CurTok;
-static int LastChar = ' ';
+// Per thread, so that sessions on different threads lex independently.
+static thread_local std::unique_ptr<Lexer> TheLexer;
+static thread_local Token CurTok;
 
-Token gettok() {
+// Source names are few and referenced from prototypes that outlive their
+// lexer, so they are kept for the life of the process.
+static const char *InternSourceName(llvm::StringRef Name) {
+  static std::mutex Mutex;
+  static std::set<std::string> Names;
+  std::lock_guard<std::mutex> Lock(Mutex);
+  return Names.insert(Name.str()).first->c_str();
+}
+
+Lexer::Lexer() : Interactive(true), Name("<stdin>") {}
+
+Lexer::Lexer(llvm::StringRef Source)
+    : Name("<memory>"), Cur(Source.begin()), End(Source.end()) {}
+
+Lexer::Lexer(std::unique_ptr<llvm::MemoryBuffer> Buf)
+    : Buffer(std::move(Buf)),
+      Name(InternSourceName(Buffer->getBufferIdentifier())),
+      Cur(Buffer->getBufferStart()),
+      End(Buffer->getBufferEnd()) {}
+
+Lexer::~Lexer() { free(LineBuf); }
+
+std::unique_ptr<Lexer> Lexer::fromFile(const std::string &Path) {
+  auto BufOrErr = llvm::MemoryBuffer::getFile(Path, /*FileSize=*/-1,
+                                              /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    fprintf(stderr, "error: cannot open %s: %s\n", Path.c_str(),
+            BufOrErr.getError().message().c_str());
+    return nullptr;
+  }
+  return std::make_unique<Lexer>(std::move(*BufOrErr));
+}
+
+// Refill from stdin. Tokens never span lines, so the previous line can be
+// dropped once the lexer has run off its end.
+bool Lexer::fill() {
+  if (!Interactive) return false;
+  ssize_t N = getline(&LineBuf, &LineCap, stdin);
+  if (N <= 0) return false;
+  Cur = LineBuf;
+  End = LineBuf + N;
+  return true;
+}
+
+// Number: [0-9.]+, valued like strtod over the token text (conversion stops at
+// a second '.'). Short literals are converted exactly in place; anything that
+// needs more than 15 significant digits or a large exponent falls back to
+// strtod on a stack copy.
+double Lexer::lexNumber() {
+  static const double Pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *Start = Cur;
+  uint64_t Mantissa = 0;
+  int Digits = 0, Exp10 = 0;
+  bool SeenDot = false, Stopped = false, Exact = true;
+
+  for (; Cur != End && (llvm::isDigit(*Cur) || *Cur == '.'); ++Cur) {
+    if (Stopped) continue;
+    if (*Cur == '.') {
+      if (SeenDot) Stopped = true;
+      SeenDot = true;
+      continue;
+    }
+    unsigned D = *Cur - '0';
+    if (Mantissa == 0 && D == 0) {  // leading zero
+      if (SeenDot) --Exp10;
+      continue;
+    }
+    if (Digits == 15) {
+      Exact = false;
+      continue;
+    }
+    Mantissa = Mantissa * 10 + D;
+    ++Digits;
+    if (SeenDot) --Exp10;
+  }
+
+  if (Exact && Exp10 >= -22) {
+    double V = (double)Mantissa;
+    return Exp10 < 0 ? V / Pow10[-Exp10] : V;
+  }
+
+  llvm::SmallString<64> Str(llvm::StringRef(Start, Cur - Start));
+  return strtod(Str.c_str(), nullptr);
+}
+
+Token Lexer::gettok() {
   Token tk;
 
-  // Skip any whitespace.
-  while (isspace(LastChar)) LastChar = getchar();
+  while (1) {
+    // Skip any whitespace.
+    for (; Cur != End && isspace((unsigned char)*Cur); ++Cur)
+      Line += *Cur == '\n';
 
-  if (isalpha(LastChar)) {  // identifier: [a-zA-Z][a-zA-Z0-9]*
-    tk.IdentifierStr = LastChar;
-    while (isalnum((LastChar = getchar()))) tk.IdentifierStr += LastChar;
+    // Check for end of input.  Don't eat the EOF.
+    if (Cur == End) {
+      if (fill()) continue;
+      tk.type = (int)::tok_eof;
+      tk.Line = Line;
+      return tk;
+    }
+
+    if (*Cur != '#') break;
+
+    // Comment until end of line.
+    while (Cur != End && *Cur != '\n' && *Cur != '\r') ++Cur;
+  }
+
+  const char *Start = Cur;
+  unsigned char ThisChar = *Cur;
+  tk.Line = Line;
 
-    if (tk.IdentifierStr == "def") {
+  if (llvm::isAlpha(ThisChar)) {  // identifier: [a-zA-Z][a-zA-Z0-9]*
+    do ++Cur;
+    while (Cur != End && llvm::isAlnum(*Cur));
+    tk.IdentifierStr = llvm::StringRef(Start, Cur - Start);
+    tk.Sym = Symbols().intern(tk.IdentifierStr);
+
+    if (tk.Sym == sym_def) {
       tk.type = (int)tok_def;
-    } else if (tk.IdentifierStr == "extern") {
+    } else if (tk.Sym == sym_extern) {
       tk.type = (int)tok_extern;
     } else {
       tk.type = (int)tok_identifier;
@@ -30,42 +151,44 @@ Token gettok() {
     return tk;
   }
 
-  if (isdigit(LastChar) || LastChar == '.') {  // Number: [0-9.]+
-    std::string NumStr;
-    do {
-      NumStr += LastChar;
-      LastChar = getchar();
-    } while (isdigit(LastChar) || LastChar == '.');
-
-    tk.NumVal = strtod(NumStr.c_str(), 0);
+  if (llvm::isDigit(ThisChar) || ThisChar == '.') {  // Number: [0-9.]+
+    tk.NumVal = lexNumber();
     tk.type = (int)::tok_number;
     return tk;
   }
 
-  if (LastChar == '#') {
-    // Comment until end of line.
-    do
-      LastChar = getchar();
-    while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
-
-    if (LastChar != EOF) return gettok();
-  }
-  // Check for end of file.  Don't eat the EOF.
-  if (LastChar == EOF) {
-    tk.type = (int)::tok_eof;
-    return tk;
-  }
-
   // Otherwise, just return the character as its ascii value.
-  int ThisChar = LastChar;
-  LastChar = getchar();
+  ++Cur;
   tk.type = ThisChar;
   return tk;
 }
 
+void setLexer(std::unique_ptr<Lexer> L) { TheLexer = std::move(L); }
+
+LexerScope::LexerScope(std::unique_ptr<Lexer> L)
+    : Saved(std::move(TheLexer)), SavedTok(CurTok) {
+  TheLexer = std::move(L);
+}
+
+LexerScope::~LexerScope() {
+  TheLexer = std::move(Saved);
+  CurTok = SavedTok;
+}
+
+Token gettok() {
+  if (!TheLexer) TheLexer = std::make_unique<Lexer>();
+  return TheLexer->gettok();
+}
+
 int getNextToken() {
+  LexTimer T;
   CurTok = gettok();
   return CurTok.type;
 }
 
 Token& getCurrentToken() { return CurTok; }
+
+const char *getSourceName() {
+  if (!TheLexer) TheLexer = std::make_unique<Lexer>();
+  return TheLexer->getName();
+}
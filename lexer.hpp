@@ -1,6 +1,11 @@
 #pragma once
+#include <memory>
 #include <string>
 
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "symbols.hpp"
+
 // The lexer returns tokens [0-255] if it is an unknown character, otherwise one
 // of these for known things.
 enum TokenType {
@@ -17,11 +22,65 @@ enum TokenType {
 
 struct Token {
   int type;
-  std::string IdentifierStr;  // Filled in if tok_identifier
-  double NumVal;              // Filled in if tok_number
+  // Filled in if tok_identifier. Points into the lexer's buffer and stays valid
+  // until the next token is read.
+  llvm::StringRef IdentifierStr;
+  SymbolID Sym;   // Interned IdentifierStr, filled in if tok_identifier
+  double NumVal;  // Filled in if tok_number
+  unsigned Line;  // Line the token starts on, counting from 1
+};
+
+// Lexer over a contiguous buffer: a memory-mapped file, caller-supplied memory
+// or, as a fallback for the REPL, stdin read one line at a time.
+class Lexer {
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;  // owned file mapping, if any
+  char *LineBuf = nullptr;                      // current stdin line
+  size_t LineCap = 0;
+  bool Interactive = false;
+  const char *Name;  // see getSourceName
+  unsigned Line = 1;
+
+  const char *Cur = nullptr;
+  const char *End = nullptr;
+
+  bool fill();
+  double lexNumber();
+
+ public:
+  // Read from stdin, one line at a time.
+  Lexer();
+  // Lex caller-owned memory. Source must outlive the lexer.
+  explicit Lexer(llvm::StringRef Source);
+  explicit Lexer(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+  ~Lexer();
+
+  // Memory-map Path. Returns nullptr (and reports to stderr) on failure.
+  static std::unique_ptr<Lexer> fromFile(const std::string &Path);
+
+  Token gettok();
+  const char *getName() const { return Name; }
+};
+
+// Replace the input of the calling thread's lexer. Defaults to stdin.
+void setLexer(std::unique_ptr<Lexer> L);
+
+// Lex from L on the calling thread until the scope ends, then go back to the
+// previous lexer and current token.
+class LexerScope {
+  std::unique_ptr<Lexer> Saved;
+  Token SavedTok;
+
+ public:
+  explicit LexerScope(std::unique_ptr<Lexer> L);
+  ~LexerScope();
+  LexerScope(const LexerScope &) = delete;
+  LexerScope &operator=(const LexerScope &) = delete;
 };
 
-// return Token struct from std input.
+// return Token struct from the calling thread's lexer.
 Token gettok();
 int getNextToken();
+// Name of the input of the calling thread's lexer: the path of a file,
+// "<stdin>" or "<memory>". Interned, so it stays valid for the whole process.
+const char *getSourceName();
 Token& getCurrentToken();
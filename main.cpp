@@ -1,12 +1,195 @@
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <thread>
 #include <vector>
 
+#include "aot.hpp"
+#include "batch_eval.hpp"
 #include "codegen.hpp"
 #include "expressions.hpp"
+#include "front_end.hpp"
+#include "hot_swap.hpp"
 #include "lexer.hpp"
+#include "memoize.hpp"
+#include "object_cache.hpp"
 #include "parser.hpp"
+#include "perf_jit.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "tiering.hpp"
+#include "vector_math.hpp"
+#include "vm.hpp"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+
+/******************************
+ * options
+ *******************************/
+static llvm::cl::opt<std::string> InputFile(llvm::cl::Positional,
+                                            llvm::cl::desc("[file.ks]"),
+                                            llvm::cl::init(""));
+static llvm::cl::list<std::string> BatchFiles(
+    "c",
+    llvm::cl::desc("Compile whole files into a few modules, then run their "
+                   "top-level expressions in order. Repeat, or separate with "
+                   "commas, to load several files"),
+    llvm::cl::value_desc("file.ks"), llvm::cl::CommaSeparated);
+static llvm::cl::opt<unsigned> ParseThreads(
+    "parse-threads",
+    llvm::cl::desc("Lex and parse up to N of the -c files at once "
+                   "(0: one per core)"),
+    llvm::cl::init(0));
+static llvm::cl::opt<std::string> EmitFile(
+    "emit",
+    llvm::cl::desc("Compile the input file ahead of time into a native object "
+                   "(.o) or shared library (.so) exporting C functions"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::list<std::string> Preload(
+    "preload",
+    llvm::cl::desc("Load a library written with --emit and declare its "
+                   "functions"),
+    llvm::cl::value_desc("lib.so"));
+static llvm::cl::opt<bool> BatchWrappers(
+    "batch-wrappers",
+    llvm::cl::desc("Also generate vectorized <name>_batch(const double *a0, "
+                   "..., double *out, size_t n) for every definition"));
+static llvm::cl::opt<bool> PrintIR("print-ir",
+                                   llvm::cl::desc("Print IR in batch mode"));
+static llvm::cl::opt<unsigned> FunctionsPerModule(
+    "functions-per-module",
+    llvm::cl::desc("Definitions per module in batch mode"),
+    llvm::cl::init(4096));
+static llvm::cl::opt<std::string> OptLevel(
+    "O", llvm::cl::Prefix,
+    llvm::cl::desc("Optimization level: 0, 1, 2, 3, s or z "
+                   "(default: the tutorial's four function passes)"),
+    llvm::cl::value_desc("level"));
+static llvm::cl::opt<std::string> Passes(
+    "passes",
+    llvm::cl::desc("Optimize with a custom pass pipeline, e.g. "
+                   "'function(sroa,instcombine),globaldce'"),
+    llvm::cl::value_desc("pipeline"));
+static llvm::cl::opt<std::string> MCPU(
+    "mcpu",
+    llvm::cl::desc("Generate code for <cpu>, or 'native' for the host's "
+                   "(default: generic, with batch wrappers tuned for the "
+                   "host's)"),
+    llvm::cl::value_desc("cpu"));
+static llvm::cl::list<std::string> MAttrs(
+    "mattr", llvm::cl::CommaSeparated,
+    llvm::cl::desc("Enable or disable target features, e.g. +avx2,-fma"),
+    llvm::cl::value_desc("+feature,-feature"));
+static llvm::cl::opt<bool> FastMath(
+    "fast-math",
+    llvm::cl::desc("Let the optimizer reassociate arithmetic, fuse it into "
+                   "FMAs and assume it sees no NaNs or infinities"));
+static llvm::cl::opt<bool> VectorMath(
+    "vector-math",
+    llvm::cl::desc("Let vectorized code call libmvec's SIMD math functions, "
+                   "which may be off from libm by a few ulp"));
+enum class EngineKind { JIT, VM };
+static llvm::cl::opt<EngineKind> Engine(
+    "engine", llvm::cl::desc("How to evaluate top-level expressions"),
+    llvm::cl::values(
+        clEnumValN(EngineKind::JIT, "jit", "Compile them with LLVM"),
+        clEnumValN(EngineKind::VM, "vm",
+                   "Interpret them as bytecode, calling compiled functions")),
+    llvm::cl::init(EngineKind::JIT));
+static llvm::cl::opt<bool> Lazy(
+    "lazy", llvm::cl::desc("Compile each definition on its first call"));
+static llvm::cl::opt<unsigned> Threads(
+    "threads",
+    llvm::cl::desc("Optimize and compile definitions on N worker threads "
+                   "(0: on the main thread)"),
+    llvm::cl::init(0));
+static llvm::cl::opt<unsigned> FunctionsPerJob(
+    "functions-per-job",
+    llvm::cl::desc("Definitions per worker job in batch mode with --threads"),
+    llvm::cl::init(64));
+static llvm::cl::opt<bool> Tiered(
+    "tiered", llvm::cl::desc("Compile definitions unoptimized first and "
+                             "recompile hot ones at O3 in the background"));
+static llvm::cl::opt<unsigned> TierThreshold(
+    "tier-threshold",
+    llvm::cl::desc("Calls before a function is recompiled with --tiered "
+                   "(0: never)"),
+    llvm::cl::init(1000));
+static llvm::cl::opt<bool> HotSwap(
+    "hot-swap",
+    llvm::cl::desc("Call every definition through a stub, so that redefining "
+                   "a function also redirects its existing callers. Programs "
+                   "can call relink() to make calls direct again"));
+static llvm::cl::opt<unsigned> RelinkThreshold(
+    "relink-threshold",
+    llvm::cl::desc("Calls before relink() makes calls to a function direct "
+                   "with --hot-swap (0: every function)"),
+    llvm::cl::init(1000));
+static llvm::cl::opt<bool> Memoize(
+    "memoize",
+    llvm::cl::desc("Cache the results of pure functions of up to 3 "
+                   "arguments, those that call nothing but each other and "
+                   "the math library"));
+static llvm::cl::opt<unsigned> MemoEntries(
+    "memo-entries",
+    llvm::cl::desc("Results cached per function with --memoize, rounded up "
+                   "to a power of two"),
+    llvm::cl::init(4096));
+static llvm::cl::opt<unsigned> MemoWays(
+    "memo-ways",
+    llvm::cl::desc("Slots an argument list may occupy with --memoize: "
+                   "1, 2 or 4"),
+    llvm::cl::init(2));
+static llvm::cl::opt<Memoizer::Eviction> MemoEviction(
+    "memo-eviction",
+    llvm::cl::desc("Which of a full set of slots --memoize replaces"),
+    llvm::cl::values(
+        clEnumValN(Memoizer::Eviction::FIFO, "fifo", "The oldest result"),
+        clEnumValN(Memoizer::Eviction::LRU, "lru",
+                   "The least recently used result")),
+    llvm::cl::init(Memoizer::Eviction::FIFO));
+static llvm::cl::opt<std::string> ProfileGenerate(
+    "profile-generate",
+    llvm::cl::desc("Count calls to each function and from each call site, "
+                   "and write the counts to <file> at exit"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::opt<std::string> ProfileUse(
+    "profile-use",
+    llvm::cl::desc("Optimize with the counts in <file>, written by "
+                   "--profile-generate: hot functions and call sites are "
+                   "hinted to the inliner, functions never called are marked "
+                   "cold. Needs a pipeline that inlines, e.g. -O2"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::opt<bool> Perf(
+    "perf",
+    llvm::cl::desc("Describe JIT-compiled functions to Linux perf: their "
+                   "names in /tmp/perf-<pid>.map, and their code and source "
+                   "lines in jit-<pid>.dump, in $JITDUMPDIR or /tmp, for "
+                   "perf inject --jit"));
+static llvm::cl::opt<std::string> ObjectCacheDir(
+    "object-cache",
+    llvm::cl::desc("Reuse compiled objects across runs, stored in <dir> "
+                   "(default: the user cache directory)"),
+    llvm::cl::value_desc("dir"), llvm::cl::ValueOptional);
+static llvm::cl::opt<unsigned> ObjectCacheMaxMB(
+    "object-cache-max-mb", llvm::cl::desc("Object cache size limit"),
+    llvm::cl::init(512));
+static llvm::cl::opt<bool> Stats(
+    "stats", llvm::cl::desc("Time each compile phase per function and report "
+                            "at exit, or when the program calls printstats()"));
+static llvm::cl::opt<stats::Format> StatsFormat(
+    "stats-format", llvm::cl::desc("Format of the --stats report"),
+    llvm::cl::values(clEnumValN(stats::Format::JSON, "json", "JSON object"),
+                     clEnumValN(stats::Format::CSV, "csv",
+                                "function,phase,count,seconds,allocations")),
+    llvm::cl::init(stats::Format::JSON));
+static llvm::cl::opt<std::string> StatsFile(
+    "stats-file",
+    llvm::cl::desc("Write the --stats report to <file> instead of stderr"),
+    llvm::cl::value_desc("file"));
 
 /******************************
  * global
@@ -15,19 +198,110 @@
 /// defined.
 CodeGenVisitor codegen;
 Parser parser;
+static std::unique_ptr<CompilePipeline> Pipeline;
+static std::unique_ptr<TieredCompiler> Tiers;
+static std::unique_ptr<HotSwapper> Swapper;
+static std::unique_ptr<Memoizer> Memo;
+static std::unique_ptr<ProfileCollector> Collector;
+static std::unique_ptr<Profile> PGO;
+static std::unique_ptr<PerfJITListener> PerfListener;
+static std::unique_ptr<BytecodeVM> VM;
+
+// Write the --stats report so far.
+static void WriteStats() {
+  if (StatsFile.empty()) {
+    stats::Report(llvm::errs(), StatsFormat);
+    return;
+  }
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(StatsFile, EC, llvm::sys::fs::OF_Text);
+  if (EC) {
+    fprintf(stderr, "cannot write %s: %s\n", StatsFile.c_str(),
+            EC.message().c_str());
+    return;
+  }
+  stats::Report(OS, StatsFormat);
+}
+
+// Kaleidoscope programs can print the report mid-session with
+// "extern printstats(); printstats();".
+extern "C" double printstats() {
+  WriteStats();
+  return 0;
+}
+
+// "extern relink(); relink();" compiles the hot definitions made with
+// --hot-swap to call each other directly. That happens once the expression
+// has returned, before the next item is read, since relinking repoints
+// stubs the calling code may be running through. Returns 1 if it will.
+static bool RelinkRequested = false;
+
+extern "C" double relink() {
+  if (!Swapper) {
+    fprintf(stderr, "relink() needs --hot-swap\n");
+    return 0;
+  }
+  RelinkRequested = true;
+  return 1;
+}
+
+static void RelinkIfRequested() {
+  if (!RelinkRequested) return;
+  RelinkRequested = false;
+  Swapper->relink();
+}
 
+// Hand TheModule, holding definitions, to the JIT.
+static void AddDefinitionModule() {
+  ScopedTimer T(Phase::Compile);
+  if (BatchWrappers) {
+    static auto HostTM = codegen.TheJIT->createHostTargetMachine();
+    if (auto BM = MakeBatchModule(*codegen.TheModule, *HostTM,
+                                  codegen.Options))
+      codegen.TheJIT->addModule(std::move(BM));
+  }
+  // After MakeBatchModule: batches run on several threads, so their copies
+  // of the definitions must not share the caches.
+  if (Memo) Memo->instrument(*codegen.TheModule);
+  if (Tiers)
+    Tiers->addModule(std::move(codegen.TheModule));
+  else if (Swapper)
+    Swapper->addModule(std::move(codegen.TheModule));
+  else if (Lazy)
+    codegen.TheJIT->addLazyModule(std::move(codegen.TheModule));
+  else
+    codegen.TheJIT->addModule(std::move(codegen.TheModule));
+  codegen.InitializeModuleAndPassManager();
+}
+
+// With --memoize, reject a definition of a function that a memoized one
+// calls; see Memoizer.
+static bool IsMemoizedCallee(const PrototypeAST &Proto) {
+  if (!Memo || !Memo->isCalledByMemoized(Symbols().name(Proto.Name)))
+    return false;
+  fprintf(stderr, "cannot redefine %s: memoized functions call it\n",
+          Symbols().name(Proto.Name).str().c_str());
+  return true;
+}
 
 static void HandleDefinition() {
   if (auto FnAst = parser.ParseDefinition()) {
     fprintf(stderr, "Parsed a function definition.\n");
+    if (IsMemoizedCallee(*FnAst->Proto)) return;
+    if (VM) VM->clearCache();
+    if (Pipeline) {
+      std::vector<std::unique_ptr<FunctionAST>> Defs;
+      Defs.push_back(std::move(FnAst));
+      Pipeline->submit(std::move(Defs), codegen.FunctionProtos);
+      return;
+    }
     // if(auto *FnIR = FnAst->codegen()){
     if (auto *FnIR = FnAst->Accept(codegen)) {
       fprintf(stderr, "Read function definition.\n");
       FnIR->print(llvm::errs());
       fprintf(stderr, "\n");
 
-      codegen.TheJIT->addModule(std::move(codegen.TheModule));
-      codegen.InitializeModuleAndPassManager();
+      AddDefinitionModule();
     }
   } else {
     // Skip token for error recovery.
@@ -42,34 +316,71 @@ static void HandleExtern() {
     if (auto *FnIR = ProtoAST->Accept(codegen)) {
       fprintf(stderr, "Read function definition.\n");
       FnIR->print(llvm::errs());
-      codegen.FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
+      codegen.FunctionProtos[ProtoAST->Name] = std::move(ProtoAST);
     }
   } else {
     getNextToken();
   }
 }
+// Evaluate FnAST with the bytecode VM if it is selected and can handle it.
+// Returns false if the expression has to go to the JIT instead.
+static bool EvaluateWithVM(FunctionAST &FnAST) {
+  if (!VM) return false;
+  static BytecodeVM::Program Prog;
+  BytecodeVM::Status S;
+  {
+    ScopedTimer T(Phase::Codegen, sym_anon_expr);
+    S = VM->compile(FnAST, Prog);
+  }
+  switch (S) {
+    case BytecodeVM::Compiled: {
+      ScopedTimer T(Phase::Execute, sym_anon_expr);
+      fprintf(stderr, "Evaluated to %f\n", BytecodeVM::run(Prog));
+      return true;
+    }
+    case BytecodeVM::Failed:
+      return true;
+    case BytecodeVM::Unsupported:
+      break;
+  }
+  return false;
+}
+
 static void HandleTopLevelExpression() {
   if (auto FnAST = parser.ParseTopLevelExpr()) {
     fprintf(stderr, "Parsed a top-level expr\n");
+    if (EvaluateWithVM(*FnAST)) return;
     // if(auto *FnIR = FnAST->codegen()){
     if (auto *FnIR = FnAST->Accept(codegen)) {
       // print IR
       fprintf(stderr, "Read function definition.\n");
       FnIR->print(llvm::errs());
 
-      auto H = codegen.TheJIT->addModule(std::move(codegen.TheModule));
+      if (!codegen.OptimizeEachFunction) codegen.OptimizeModule();
+      llvm::orc::VModuleKey H;
+      {
+        ScopedTimer T(Phase::Compile, sym_anon_expr);
+        H = codegen.TheJIT->addModule(std::move(codegen.TheModule));
+      }
       codegen.InitializeModuleAndPassManager();
 
-      auto ExprSymbol = codegen.TheJIT->findSymbol("__anon_expr");
-      assert(ExprSymbol && "function not found");
+      double (*FP)();
+      {
+        ScopedTimer T(Phase::Lookup, sym_anon_expr);
+        auto ExprSymbol = codegen.TheJIT->findSymbol("__anon_expr");
+        assert(ExprSymbol && "function not found");
 
-      auto e = ExprSymbol.getAddress();
-      // error check
-      auto error = e.takeError();
-      if ((bool)error == true) fprintf(stderr, "ERROR!!!\n");
+        auto e = ExprSymbol.getAddress();
+        // error check
+        auto error = e.takeError();
+        if ((bool)error == true) fprintf(stderr, "ERROR!!!\n");
 
-      double (*FP)() = (double (*)())(intptr_t)e.get();
-      fprintf(stderr, "Evaluated to %f\n", FP());
+        FP = (double (*)())(intptr_t)e.get();
+      }
+      {
+        ScopedTimer T(Phase::Execute, sym_anon_expr);
+        fprintf(stderr, "Evaluated to %f\n", FP());
+      }
 
       codegen.TheJIT->removeModule(H);
     }
@@ -80,6 +391,9 @@ static void HandleTopLevelExpression() {
 
 static void MainLoop() {
   while (1) {
+    if (Pipeline) Pipeline->installCompleted();
+    if (Tiers) Tiers->installCompleted();
+    RelinkIfRequested();
     fprintf(stderr, "ready> ");
     switch (getCurrentToken().type) {
       case (int)tok_eof:
@@ -100,11 +414,325 @@ static void MainLoop() {
   }
 }
 
-int main() {
-  fprintf(stderr, "ready> ");
-  getNextToken();
+/******************************
+ * batch mode
+ *******************************/
+// Hand the definitions collected so far to the JIT as one module.
+static void FlushBatchModule() {
+  if (!Lazy && !Tiers) codegen.OptimizeModule();
+  if (PrintIR) codegen.TheModule->print(llvm::errs(), nullptr);
+  AddDefinitionModule();
+}
 
-  MainLoop();
+static void EvaluateBatchExpression(FunctionAST &FnAST) {
+  if (EvaluateWithVM(FnAST)) return;
+  auto *FnIR = FnAST.Accept(codegen);
+  if (!FnIR) return;
+  codegen.OptimizeModule();
+  if (PrintIR) FnIR->print(llvm::errs());
 
+  llvm::orc::VModuleKey H;
+  {
+    ScopedTimer T(Phase::Compile, sym_anon_expr);
+    H = codegen.TheJIT->addModule(std::move(codegen.TheModule));
+  }
+  codegen.InitializeModuleAndPassManager();
+
+  double (*FP)();
+  {
+    ScopedTimer T(Phase::Lookup, sym_anon_expr);
+    auto ExprSymbol = codegen.TheJIT->findSymbol("__anon_expr");
+    assert(ExprSymbol && "function not found");
+    FP = (double (*)())(intptr_t)llvm::cantFail(ExprSymbol.getAddress());
+  }
+  {
+    ScopedTimer T(Phase::Execute, sym_anon_expr);
+    fprintf(stderr, "Evaluated to %f\n", FP());
+  }
+
+  codegen.TheJIT->removeModule(H);
+}
+
+// kaleidoscope -c a.ks,b.ks: parse all of the files, emit their definitions
+// into modules of FunctionsPerModule definitions that are optimized once
+// each, then evaluate the top-level expressions in order. The files behave
+// as if concatenated, except that a definition may call any other, even one
+// that comes later.
+static int RunBatch(const std::vector<std::string> &Paths) {
+  std::vector<SourceItem> Items;
+  unsigned NumThreads =
+      ParseThreads ? ParseThreads
+                   : std::max(1u, std::thread::hardware_concurrency());
+  if (!ParseFiles(Paths, NumThreads, Items)) return 1;
+  codegen.OptimizeEachFunction = false;
+
+  // Every prototype is known before the first body is generated.
+  for (auto &Item : Items)
+    if (Item.Kind != SourceItem::Expression) {
+      auto &Proto = Item.Proto ? *Item.Proto : *Item.Function->Proto;
+      codegen.FunctionProtos[Proto.Name] =
+          std::make_unique<PrototypeAST>(Proto);
+    }
+
+  std::vector<std::unique_ptr<FunctionAST>> TopLevelExprs;
+  std::vector<std::unique_ptr<FunctionAST>> JobDefs;
+  unsigned InModule = 0;
+  for (auto &Item : Items) {
+    switch (Item.Kind) {
+      case SourceItem::Definition:
+        if (Pipeline) {
+          JobDefs.push_back(std::move(Item.Function));
+          if (JobDefs.size() == FunctionsPerJob) {
+            Pipeline->submit(std::move(JobDefs), codegen.FunctionProtos);
+            JobDefs.clear();
+          }
+        } else if (!IsMemoizedCallee(*Item.Function->Proto) &&
+                   Item.Function->Accept(codegen) &&
+                   ++InModule == FunctionsPerModule) {
+          FlushBatchModule();
+          InModule = 0;
+        }
+        break;
+      case SourceItem::Extern:
+        Item.Proto->Accept(codegen);
+        codegen.FunctionProtos[Item.Proto->Name] = std::move(Item.Proto);
+        break;
+      case SourceItem::Expression:
+        TopLevelExprs.push_back(std::move(Item.Function));
+        break;
+    }
+  }
+  if (InModule) FlushBatchModule();
+  if (Pipeline) {
+    Pipeline->submit(std::move(JobDefs), codegen.FunctionProtos);
+    Pipeline->finish();
+  }
+
+  for (auto &FnAST : TopLevelExprs) {
+    EvaluateBatchExpression(*FnAST);
+    RelinkIfRequested();
+  }
   return 0;
 }
+
+int main(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope JIT\n");
+  stats::Enabled = Stats;
+
+  if (MCPU.getNumOccurrences() || MAttrs.getNumOccurrences()) {
+    auto &STI = *codegen.TheJIT->getTargetMachine().getMCSubtargetInfo();
+    if (!MCPU.empty() && MCPU != "native" && !STI.isCPUStringValid(MCPU)) {
+      fprintf(stderr, "unknown CPU %s\n", MCPU.c_str());
+      return 1;
+    }
+    // Nothing has been compiled yet, so the JIT can start over.
+    codegen.Options.Target = {
+        MCPU, std::vector<std::string>(MAttrs.begin(), MAttrs.end())};
+    codegen.TheJIT =
+        std::make_unique<llvm::orc::KaleidoscopeJIT>(codegen.Options.Target);
+  }
+  if (FastMath) {
+    codegen.Options.FastMath = true;
+    codegen.InitializeModuleAndPassManager();
+  }
+  if (Perf) {
+    codegen.Options.LineTables = true;
+    llvm::SmallString<256> CWD;
+    if (!llvm::sys::fs::current_path(CWD))
+      codegen.Options.SourceDir = CWD.str().str();
+    codegen.InitializeModuleAndPassManager();
+    PerfListener = std::make_unique<PerfJITListener>();
+    codegen.TheJIT->addEventListener(PerfListener.get());
+  }
+
+  if (OptLevel.getNumOccurrences() && Passes.getNumOccurrences()) {
+    fprintf(stderr, "-O and --passes cannot be combined\n");
+    return 1;
+  }
+  if (OptLevel.getNumOccurrences()) {
+    static const std::map<std::string, llvm::CodeGenOpt::Level> Levels = {
+        {"0", llvm::CodeGenOpt::None},    {"1", llvm::CodeGenOpt::Less},
+        {"2", llvm::CodeGenOpt::Default}, {"3", llvm::CodeGenOpt::Aggressive},
+        {"s", llvm::CodeGenOpt::Default}, {"z", llvm::CodeGenOpt::Default},
+    };
+    auto L = Levels.find(OptLevel);
+    if (L == Levels.end()) {
+      fprintf(stderr, "unknown optimization level -O%s\n", OptLevel.c_str());
+      return 1;
+    }
+    codegen.SetPipeline("O" + OptLevel);
+    codegen.TheJIT->getTargetMachine().setOptLevel(L->second);
+  }
+  if (Passes.getNumOccurrences() && !codegen.SetPipeline(Passes)) return 1;
+  codegen.Options.VectorMath = VectorMath;
+
+  if (!ProfileUse.empty()) {
+    // The profile only hints the inliner, which the default passes and -O0
+    // leave out.
+    if (!CodeGenVisitor::PipelineInlines(codegen.Options.Pipeline)) {
+      fprintf(stderr,
+              "--profile-use needs a pipeline that inlines, e.g. -O2\n");
+      return 1;
+    }
+    PGO = Profile::read(ProfileUse);
+    if (!PGO) return 1;
+  }
+  if (!ProfileGenerate.empty()) {
+    if (!EmitFile.empty() || Threads) {
+      // The counters live in this process, and compile threads cannot
+      // register them with the JIT.
+      fprintf(stderr,
+              "--profile-generate cannot be combined with --emit or "
+              "--threads\n");
+      return 1;
+    }
+    Collector = std::make_unique<ProfileCollector>(*codegen.TheJIT);
+  }
+  if (PGO || Collector)
+    codegen.Options.DefinitionHook = [](llvm::Function &F) {
+      if (PGO) PGO->annotate(F);
+      if (Collector) Collector->instrument(F);
+    };
+
+  if (!EmitFile.empty()) {
+    if (InputFile.empty()) {
+      fprintf(stderr, "--emit needs an input file\n");
+      return 1;
+    }
+    return CompileAOT(InputFile, EmitFile, codegen.Options,
+                      codegen.TheJIT->getTargetMachine().getOptLevel(),
+                      BatchWrappers);
+  }
+  for (auto &Lib : Preload)
+    if (!PreloadLibrary(Lib, codegen.FunctionProtos)) return 1;
+
+  if (Lazy) {
+    // Definitions are optimized by the JIT when they are first called.
+    codegen.KeepContext = true;
+    codegen.OptimizeEachFunction = false;
+    codegen.TheJIT->setOptimizer(
+        [](llvm::Module &M) {
+          CodeGenVisitor::OptimizeModule(M, codegen.Options,
+                                         &codegen.TheJIT->getTargetMachine());
+        });
+  }
+
+  if (Threads) {
+    if (BatchWrappers) {
+      fprintf(stderr, "--threads cannot be combined with --batch-wrappers\n");
+      return 1;
+    }
+    if (Lazy) {
+      fprintf(stderr, "--threads cannot be combined with --lazy\n");
+      return 1;
+    }
+    if (ObjectCacheDir.getNumOccurrences()) {
+      // Workers compile to objects themselves, without the JIT's cache.
+      fprintf(stderr, "--threads cannot be combined with --object-cache\n");
+      return 1;
+    }
+    Pipeline = std::make_unique<CompilePipeline>(*codegen.TheJIT,
+                                                 codegen.Options, Threads);
+  }
+
+  if (Tiered) {
+    if (Lazy || Threads) {
+      fprintf(stderr,
+              "--tiered cannot be combined with --lazy or --threads\n");
+      return 1;
+    }
+    codegen.OptimizeEachFunction = false;
+    Tiers = std::make_unique<TieredCompiler>(*codegen.TheJIT, codegen.Options,
+                                             TierThreshold);
+  }
+
+  if (HotSwap) {
+    if (Lazy || Threads || Tiered) {
+      // --tiered already calls through stubs that follow redefinitions.
+      fprintf(stderr,
+              "--hot-swap cannot be combined with --lazy, --threads or "
+              "--tiered\n");
+      return 1;
+    }
+    Swapper = std::make_unique<HotSwapper>(*codegen.TheJIT, codegen.Options,
+                                           /*Relinkable=*/true,
+                                           RelinkThreshold);
+  }
+
+  if (Memoize) {
+    if (Lazy || Threads || Tiered || HotSwap) {
+      // These compile definitions out of reach of Memo, or, with --hot-swap,
+      // let a cached function's callees change under it.
+      fprintf(stderr,
+              "--memoize cannot be combined with --lazy, --threads, --tiered "
+              "or --hot-swap\n");
+      return 1;
+    }
+    if (MemoWays != 1 && MemoWays != 2 && MemoWays != 4) {
+      fprintf(stderr, "--memo-ways must be 1, 2 or 4\n");
+      return 1;
+    }
+    Memo = std::make_unique<Memoizer>(*codegen.TheJIT, MemoEntries, MemoWays,
+                                      MemoEviction);
+  }
+
+  if (Engine == EngineKind::VM)
+    VM = std::make_unique<BytecodeVM>(*codegen.TheJIT, codegen.FunctionProtos);
+
+  std::unique_ptr<DiskObjectCache> ObjCache;
+  if (ObjectCacheDir.getNumOccurrences()) {
+    std::string Dir = ObjectCacheDir.empty()
+                          ? DiskObjectCache::defaultDirectory()
+                          : ObjectCacheDir.getValue();
+    ObjCache = std::make_unique<DiskObjectCache>(
+        Dir, (uint64_t)ObjectCacheMaxMB << 20,
+        codegen.TheJIT->getTargetMachine(),
+        codegen.Options.Pipeline);
+    codegen.TheJIT->setObjectCache(ObjCache.get());
+  }
+
+  int RC = 0;
+  if (!BatchFiles.empty()) {
+    RC = RunBatch({BatchFiles.begin(), BatchFiles.end()});
+  } else {
+    // kaleidoscope [file.ks]: lex a memory-mapped file instead of stdin.
+    if (!InputFile.empty()) {
+      auto L = Lexer::fromFile(InputFile);
+      if (!L) return 1;
+      setLexer(std::move(L));
+    }
+
+    fprintf(stderr, "ready> ");
+    getNextToken();
+
+    MainLoop();
+  }
+  Pipeline.reset();
+
+  if (Lazy) {
+    unsigned Defs = codegen.TheJIT->getNumLazyDefinitions();
+    fprintf(stderr, "lazy: %u of %u definitions never materialized\n",
+            Defs - codegen.TheJIT->getNumMaterialized(), Defs);
+  }
+  if (Tiers) {
+    Tiers->printStats(llvm::errs());
+    Tiers.reset();
+  }
+  if (Swapper) Swapper->printStats(llvm::errs());
+  if (Memo) Memo->printStats(llvm::errs());
+  if (Collector && !Collector->write(ProfileGenerate)) RC = 1;
+  if (ObjCache) {
+    ObjCache->printStats(llvm::errs());
+    codegen.TheJIT->setObjectCache(nullptr);
+  }
+  if (Stats) {
+    WriteStats();
+    codegen.TheJIT->getMemoryPool().printStats(llvm::errs());
+  }
+  if (PerfListener) {
+    // The JIT frees everything on exit, which must not retire it all.
+    codegen.TheJIT->removeEventListener(PerfListener.get());
+    PerfListener.reset();
+  }
+  return RC;
+}
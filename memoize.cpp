@@ -0,0 +1,182 @@
+#include "memoize.hpp"
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "codegen.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+
+// Marks an empty slot. Calls whose first argument has this bit pattern, a
+// NaN no arithmetic produces, bypass the cache, so it never matches.
+static const uint64_t EmptySlot = 0x7FF4DEADBEEF0001ull;
+
+Memoizer::Memoizer(llvm::orc::KaleidoscopeJIT &JIT, unsigned Entries,
+                   unsigned Ways, Eviction Evict)
+    : JIT(JIT),
+      Entries(std::max<unsigned>(llvm::PowerOf2Ceil(Entries), Ways)),
+      Ways(Ways),
+      Evict(Evict) {}
+
+void Memoizer::instrument(llvm::Module &M) {
+  std::vector<llvm::Function *> Pure;
+  for (auto &F : M)
+    if (!F.isDeclaration() && CodeGenVisitor::IsPure(F) && F.arg_size() &&
+        F.arg_size() <= MaxArity)
+      Pure.push_back(&F);
+
+  for (auto *F : Pure) {
+    for (auto &I : llvm::instructions(*F))
+      if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I))
+        if (auto *Callee = Call->getCalledFunction())
+          if (Callee != F && !Callee->isIntrinsic())
+            Callees.insert(Callee->getName());
+
+    auto T = std::make_unique<Table>();
+    T->Name = F->getName().str();
+    T->Arity = F->arg_size();
+    size_t Words = (size_t)Entries * llvm::PowerOf2Ceil(T->Arity + 1);
+    // Over-allocate by a cache line less a word to align the slots.
+    T->Storage.reset(new uint64_t[Words + 7]);
+    T->Slots = (uint64_t *)llvm::alignAddr(T->Storage.get(), llvm::Align(64));
+    std::fill(T->Slots, T->Slots + Words, EmptySlot);
+
+    // Versioned: the JIT links a module on its first lookup, which may come
+    // after a redefinition has registered a table of its own.
+    std::string Prefix = T->Name + ".memo" + std::to_string(NextTable++);
+    JIT.addHostSymbol(Prefix, (llvm::JITTargetAddress)(uintptr_t)T->Slots);
+    JIT.addHostSymbol(Prefix + ".hits",
+                      (llvm::JITTargetAddress)(uintptr_t)&T->Hits);
+    JIT.addHostSymbol(Prefix + ".misses",
+                      (llvm::JITTargetAddress)(uintptr_t)&T->Misses);
+    emitWrapper(*F, *T, Prefix);
+    Tables.push_back(std::move(T));
+  }
+}
+
+void Memoizer::emitWrapper(llvm::Function &F, Table &T,
+                           const std::string &Prefix) {
+  auto &Ctx = F.getContext();
+  auto *M = F.getParent();
+  auto *I64 = llvm::Type::getInt64Ty(Ctx);
+  auto *Double = llvm::Type::getDoubleTy(Ctx);
+  const unsigned SlotWords = llvm::PowerOf2Ceil(T.Arity + 1);
+
+  // Calls to F, including its own recursive ones, now go to the wrapper.
+  auto *Wrapper = llvm::Function::Create(
+      F.getFunctionType(), llvm::Function::ExternalLinkage, "", M);
+  F.replaceAllUsesWith(Wrapper);
+  Wrapper->takeName(&F);
+  F.setName(Wrapper->getName() + ".uncached");
+  F.setLinkage(llvm::Function::InternalLinkage);
+
+  auto *Slots = M->getOrInsertGlobal(Prefix, I64);
+  auto *Hits = M->getOrInsertGlobal(Prefix + ".hits", I64);
+  auto *Misses = M->getOrInsertGlobal(Prefix + ".misses", I64);
+
+  auto *Entry = llvm::BasicBlock::Create(Ctx, "entry", Wrapper);
+  auto *Bypass = llvm::BasicBlock::Create(Ctx, "bypass", Wrapper);
+  auto *Lookup = llvm::BasicBlock::Create(Ctx, "lookup", Wrapper);
+  auto *Miss = llvm::BasicBlock::Create(Ctx, "miss", Wrapper);
+  llvm::IRBuilder<> Builder(Entry);
+
+  llvm::SmallVector<llvm::Value *, MaxArity> Args, Key;
+  for (auto &Arg : Wrapper->args()) {
+    Arg.setName(F.getArg(Arg.getArgNo())->getName());
+    Args.push_back(&Arg);
+    Key.push_back(Builder.CreateBitCast(&Arg, I64));
+  }
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(Key[0], Builder.getInt64(EmptySlot)), Bypass,
+      Lookup);
+
+  Builder.SetInsertPoint(Bypass);
+  Builder.CreateRet(Builder.CreateCall(&F, Args));
+
+  // Hash the key to a set, with splitmix64's finalizer.
+  Builder.SetInsertPoint(Lookup);
+  llvm::Value *H = Key[0];
+  for (unsigned I = 1; I < T.Arity; I++)
+    H = Builder.CreateMul(Builder.CreateXor(H, Key[I]),
+                          Builder.getInt64(0x9E3779B97F4A7C15ull));
+  H = Builder.CreateXor(H, Builder.CreateLShr(H, 30));
+  H = Builder.CreateMul(H, Builder.getInt64(0xBF58476D1CE4E5B9ull));
+  H = Builder.CreateXor(H, Builder.CreateLShr(H, 27));
+  H = Builder.CreateMul(H, Builder.getInt64(0x94D049BB133111EBull));
+  H = Builder.CreateXor(H, Builder.CreateLShr(H, 31));
+  auto *Set = Builder.CreateInBoundsGEP(
+      I64, Slots,
+      Builder.CreateMul(Builder.CreateAnd(H, Entries / Ways - 1),
+                        Builder.getInt64(Ways * SlotWords)),
+      "set");
+
+  auto Word = [&](unsigned Way, unsigned I) {
+    return Builder.CreateConstInBoundsGEP1_64(I64, Set, Way * SlotWords + I);
+  };
+  auto Count = [&](llvm::Constant *Counter) {
+    Builder.CreateStore(
+        Builder.CreateAdd(Builder.CreateLoad(I64, Counter),
+                          Builder.getInt64(1)),
+        Counter);
+  };
+  // Move ways [0, Last) down by one and store Key and Result in way 0.
+  auto Insert = [&](unsigned Last, llvm::Value *Result) {
+    for (unsigned W = Last; W > 0; W--)
+      for (unsigned I = 0; I <= T.Arity; I++)
+        Builder.CreateStore(Builder.CreateLoad(I64, Word(W - 1, I)),
+                            Word(W, I));
+    for (unsigned I = 0; I < T.Arity; I++)
+      Builder.CreateStore(Key[I], Word(0, I));
+    Builder.CreateStore(Result, Word(0, T.Arity));
+  };
+
+  for (unsigned W = 0; W < Ways; W++) {
+    llvm::Value *Match = nullptr;
+    for (unsigned I = 0; I < T.Arity; I++) {
+      auto *Eq =
+          Builder.CreateICmpEQ(Builder.CreateLoad(I64, Word(W, I)), Key[I]);
+      Match = Match ? Builder.CreateAnd(Match, Eq) : Eq;
+    }
+    auto *Hit = llvm::BasicBlock::Create(Ctx, "hit", Wrapper, Miss);
+    auto *Next = W + 1 < Ways
+                     ? llvm::BasicBlock::Create(Ctx, "probe", Wrapper, Miss)
+                     : Miss;
+    Builder.CreateCondBr(Match, Hit, Next);
+
+    Builder.SetInsertPoint(Hit);
+    Count(Hits);
+    auto *Result = Builder.CreateLoad(I64, Word(W, T.Arity));
+    if (Evict == Eviction::LRU && W > 0) Insert(W, Result);
+    Builder.CreateRet(Builder.CreateBitCast(Result, Double));
+    Builder.SetInsertPoint(Next);
+  }
+
+  Count(Misses);
+  auto *Result = Builder.CreateCall(&F, Args);
+  Insert(Ways - 1, Builder.CreateBitCast(Result, I64));
+  Builder.CreateRet(Result);
+}
+
+void Memoizer::printStats(llvm::raw_ostream &OS) {
+  std::vector<const Table *> Called;
+  for (auto &T : Tables)
+    if (T->Hits + T->Misses) Called.push_back(T.get());
+  std::sort(Called.begin(), Called.end(), [](const Table *A, const Table *B) {
+    return A->Hits + A->Misses > B->Hits + B->Misses;
+  });
+
+  OS << "memoize: " << Tables.size() << " functions, " << Entries
+     << " entries in " << Ways << "-way sets, "
+     << (Evict == Eviction::LRU ? "lru" : "fifo") << " eviction\n";
+  for (auto *T : Called) {
+    uint64_t Calls = T->Hits + T->Misses;
+    OS << llvm::format("%14" PRIu64 " calls  %5.1f%% hits  %s\n", Calls,
+                       100.0 * T->Hits / Calls, T->Name.c_str());
+  }
+}
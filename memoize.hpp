@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Result caches for pure functions (see CodeGenVisitor::IsPure).
+//
+// Each memoized function gets a table of Entries slots, grouped into sets of
+// Ways consecutive slots. A slot holds the bit patterns of the arguments and
+// the result, padded to a power of two of 8-byte words so that slots never
+// straddle a cache line; tables are cache-line aligned. A call hashes its
+// arguments to a set, compares them against each slot there and, on a miss,
+// calls the function and puts the result in the first slot of the set,
+// evicting the last one.
+//
+// The lookup is emitted in the function itself: the definition is renamed
+// <name>.uncached and <name> becomes the caching wrapper, so recursive calls
+// are cached as well. Tables and hit counters live on the host.
+//
+// Purity is decided when a definition is generated, but the JIT binds its
+// calls when the module is linked, on its first lookup. A function that a
+// memoized one calls must therefore not be redefined: the memoized code
+// could yet bind to the new version, which may not be pure.
+//
+// Tables are not synchronized, so memoized code must only run on one thread
+// at a time. Like the TieredCompiler, this is used on the thread that owns
+// the JIT.
+class Memoizer {
+ public:
+  enum class Eviction {
+    FIFO,  // a hit leaves the set as it is
+    LRU,   // a hit moves its slot to the front of the set
+  };
+
+ private:
+  struct Table {
+    std::string Name;
+    unsigned Arity;
+    uint64_t Hits = 0, Misses = 0;  // incremented by the wrapper
+    std::unique_ptr<uint64_t[]> Storage;
+    uint64_t *Slots;  // Storage, aligned to a cache line
+  };
+
+  llvm::orc::KaleidoscopeJIT &JIT;
+  const unsigned Entries, Ways;
+  const Eviction Evict;
+  std::vector<std::unique_ptr<Table>> Tables;
+  unsigned NextTable = 0;
+  llvm::StringSet<> Callees;  // of memoized functions, other than themselves
+
+  void emitWrapper(llvm::Function &F, Table &T, const std::string &Prefix);
+
+ public:
+  // Arguments per function that are memoized; beyond that the key costs
+  // more to compare than most bodies do to run.
+  static const unsigned MaxArity = 3;
+
+  // Entries is rounded up to a power of two, and Ways must be 1, 2 or 4.
+  Memoizer(llvm::orc::KaleidoscopeJIT &JIT, unsigned Entries, unsigned Ways,
+           Eviction Evict);
+
+  // Give every pure definition of M with 1 to MaxArity arguments a result
+  // cache. Call before M is handed to the JIT.
+  void instrument(llvm::Module &M);
+  // Whether a memoized function calls Name, so that it must not be
+  // redefined.
+  bool isCalledByMemoized(llvm::StringRef Name) const {
+    return Callees.count(Name);
+  }
+  // Hit rate of every memoized function called so far.
+  void printStats(llvm::raw_ostream &OS);
+};
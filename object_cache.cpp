@@ -0,0 +1,123 @@
+#include "object_cache.hpp"
+
+#include <utime.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+
+// Bump when the layout of cache entries changes.
+static const char *CacheFormat = "kaleidoscope-objcache-1";
+
+DiskObjectCache::DiskObjectCache(std::string Dir, uint64_t MaxBytes,
+                                 const llvm::TargetMachine &TM,
+                                 llvm::StringRef PipelineID)
+    : Dir(std::move(Dir)), MaxBytes(MaxBytes) {
+  llvm::raw_string_ostream OS(TargetID);
+  OS << CacheFormat << '\n'
+     << LLVM_VERSION_STRING << '\n'
+     << TM.getTargetTriple().str() << '\n'
+     << TM.getTargetCPU() << '\n'
+     << TM.getTargetFeatureString() << '\n'
+     << (int)TM.getOptLevel() << '\n'
+     << PipelineID << '\n';
+  OS.flush();
+
+  if (auto EC = llvm::sys::fs::create_directories(this->Dir))
+    fprintf(stderr, "object cache: cannot create %s: %s\n", this->Dir.c_str(),
+            EC.message().c_str());
+  prune();
+}
+
+DiskObjectCache::~DiskObjectCache() { prune(); }
+
+std::string DiskObjectCache::defaultDirectory() {
+  llvm::SmallString<128> Path;
+  if (!llvm::sys::path::cache_directory(Path)) return ".kaleidoscope-cache";
+  llvm::sys::path::append(Path, "kaleidoscope");
+  return Path.str().str();
+}
+
+std::string DiskObjectCache::keyFor(const llvm::Module &M) {
+  std::string IR;
+  llvm::raw_string_ostream OS(IR);
+  M.print(OS, nullptr);
+  OS.flush();
+
+  llvm::MD5 Hash;
+  Hash.update(TargetID);
+  Hash.update(IR);
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+  return Result.digest().str().str();
+}
+
+std::string DiskObjectCache::pathFor(llvm::StringRef Key) const {
+  llvm::SmallString<128> Path(Dir);
+  llvm::sys::path::append(Path, "llvmcache-" + Key);
+  return Path.str().str();
+}
+
+// Top-level expressions are compiled once and thrown away; not worth a file.
+static bool IsCacheable(const llvm::Module &M) {
+  auto *Anon = M.getFunction("__anon_expr");
+  return !Anon || Anon->isDeclaration();
+}
+
+std::unique_ptr<llvm::MemoryBuffer> DiskObjectCache::getObject(
+    const llvm::Module *M) {
+  if (!IsCacheable(*M)) return nullptr;
+
+  LastModule = M;
+  LastKey = keyFor(*M);
+  std::string Path = pathFor(LastKey);
+  auto BufOrErr = llvm::MemoryBuffer::getFile(Path, /*FileSize=*/-1,
+                                              /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    ++Misses;
+    return nullptr;
+  }
+  ++Hits;
+  utime(Path.c_str(), nullptr);  // recently used, for pruning
+  return std::move(*BufOrErr);
+}
+
+void DiskObjectCache::notifyObjectCompiled(const llvm::Module *M,
+                                           llvm::MemoryBufferRef Obj) {
+  if (!IsCacheable(*M)) return;
+
+  std::string Path = pathFor(M == LastModule ? LastKey : keyFor(*M));
+  LastModule = nullptr;
+
+  // Write to a unique temporary and rename, so that concurrent processes
+  // never see a partial object.
+  int FD;
+  llvm::SmallString<128> TmpPath;
+  if (llvm::sys::fs::createUniqueFile(Path + ".tmp-%%%%%%", FD, TmpPath))
+    return;
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Obj.getBuffer();
+  }
+  if (llvm::sys::fs::rename(TmpPath, Path)) {
+    llvm::sys::fs::remove(TmpPath);
+    return;
+  }
+  ++Stores;
+}
+
+void DiskObjectCache::prune() {
+  llvm::CachePruningPolicy Policy;
+  Policy.Interval = std::chrono::seconds(0);
+  Policy.MaxSizePercentageOfAvailableSpace = 0;
+  Policy.MaxSizeBytes = MaxBytes;
+  llvm::pruneCache(Dir, Policy);
+}
+
+void DiskObjectCache::printStats(llvm::raw_ostream &OS) const {
+  OS << "object cache: " << Hits << " hits, " << Misses << " misses, "
+     << Stores << " stored (" << Dir << ")\n";
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+// On-disk cache of compiled objects, plugged into the JIT's compiler.
+//
+// Objects are keyed by a hash of the optimized IR together with everything
+// else that decides the machine code: target triple, CPU, features, codegen
+// optimization level, the IR optimization pipeline and the LLVM version. A
+// change to any of them simply misses. Files live in Dir as
+// llvmcache-<key> and are pruned least-recently-used first to MaxBytes.
+class DiskObjectCache : public llvm::ObjectCache {
+  std::string Dir;
+  std::string TargetID;  // triple, CPU, features, opt level, versions
+  uint64_t MaxBytes;
+
+  // Key computed by the last getObject. SimpleCompiler reports a compiled
+  // object right after the miss, so the IR need not be hashed twice.
+  const llvm::Module *LastModule = nullptr;
+  std::string LastKey;
+
+  std::string keyFor(const llvm::Module &M);
+  std::string pathFor(llvm::StringRef Key) const;
+
+ public:
+  DiskObjectCache(std::string Dir, uint64_t MaxBytes,
+                  const llvm::TargetMachine &TM, llvm::StringRef PipelineID);
+  ~DiskObjectCache() override;
+
+  void notifyObjectCompiled(const llvm::Module *M,
+                            llvm::MemoryBufferRef Obj) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+
+  // Trim the cache directory to MaxBytes.
+  void prune();
+
+  unsigned Hits = 0, Misses = 0, Stores = 0;
+  void printStats(llvm::raw_ostream &OS) const;
+
+  // $XDG_CACHE_HOME/kaleidoscope or the platform equivalent.
+  static std::string defaultDirectory();
+};
@@ -1,16 +1,18 @@
 #include "parser.hpp"
 
+#include <algorithm>
 #include <iostream>
-#include <map>
 #include <memory>
 #include <vector>
 
 #include "codegen.hpp"
 #include "expressions.hpp"
 #include "lexer.hpp"
+#include "stats.hpp"
+#include "llvm/ADT/SmallVector.h"
 
 // logerror* - these are little helper functions for error handling.
-std::unique_ptr<ExprAST> LogError(const char *str) {
+ExprAST *LogError(const char *str) {
   fprintf(stderr, "logerror: %s\n", str);
   return nullptr;
 }
@@ -30,13 +32,13 @@ Parser::Parser() {
 }
 
 // parse number expression
-std::unique_ptr<ExprAST> Parser::ParseNumberExpr() {
-  auto result = std::make_unique<NumberExprAST>(getCurrentToken().NumVal);
+ExprAST *Parser::ParseNumberExpr() {
+  auto result = make<NumberExprAST>(getCurrentToken().NumVal);
   getNextToken();
-  return std::move(result);
+  return result;
 }
 // parse '(' , ')'
-std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
+ExprAST *Parser::ParseParenExpr() {
   getNextToken();
   auto v = ParseExpression();
   if (!v) return nullptr;
@@ -47,21 +49,25 @@ std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
   return v;
 }
 // parse Identifier expression
-std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr() {
-  std::string IdName = getCurrentToken().IdentifierStr;
+ExprAST *Parser::ParseIdentifierExpr() {
+  SymbolID IdName = getCurrentToken().Sym;
+  unsigned Line = getCurrentToken().Line;
   getNextToken();
 
   // simple variable case
-  if (getCurrentToken().type != '(')  // not function. simple variable
-    return std::make_unique<VariableExprAST>(IdName);
+  if (getCurrentToken().type != '(') {  // not function. simple variable
+    auto *V = make<VariableExprAST>(IdName);
+    V->Line = Line;
+    return V;
+  }
 
   // call faunction
   getNextToken();
-  std::vector<std::unique_ptr<ExprAST>> Args;
+  llvm::SmallVector<ExprAST *, 8> Args;
   if (getCurrentToken().type != ')') {
     while (1) {
       if (auto Arg = ParseExpression())
-        Args.push_back(std::move(Arg));
+        Args.push_back(Arg);
       else
         return nullptr;
 
@@ -75,12 +81,16 @@ std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr() {
 
   getNextToken();
 
-  return std::make_unique<CallExprAST>(IdName, std::move(Args));
+  ExprAST **ArgMem = Arena->Allocate<ExprAST *>(Args.size());
+  std::copy(Args.begin(), Args.end(), ArgMem);
+  auto *Call = make<CallExprAST>(IdName, ArgMem, Args.size());
+  Call->Line = Line;
+  return Call;
 }
 
 // parse primary expression
 // identifier expression, number expression and parent expression
-std::unique_ptr<ExprAST> Parser::ParsePrimary() {
+ExprAST *Parser::ParsePrimary() {
   switch (getCurrentToken().type) {
     default:
       return LogError("unknown token when expecting an expression");
@@ -98,19 +108,19 @@ int Parser::GetTokPrecedence() {
   if (!isascii(getCurrentToken().type)) return -1;
 
   // Make sure it's a declared binop.
-  int TokPrec = BinopPrecedence[getCurrentToken().type];
+  int TokPrec = BinopPrecedence[(unsigned char)getCurrentToken().type];
   if (TokPrec <= 0) return -1;
   return TokPrec;
 }
 // parse binary operator
-std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int ExprPrec,
-                                               std::unique_ptr<ExprAST> LHS) {
+ExprAST *Parser::ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
   while (1) {
     int TokPrec = GetTokPrecedence();
 
     if (TokPrec < ExprPrec) return LHS;
 
     int BinOp = getCurrentToken().type;
+    unsigned Line = getCurrentToken().Line;
     getNextToken();
 
     auto RHS = ParsePrimary();
@@ -118,27 +128,36 @@ std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int ExprPrec,
 
     int NextPrec = GetTokPrecedence();
     if (TokPrec < NextPrec) {
-      RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
+      RHS = ParseBinOpRHS(TokPrec + 1, RHS);
       if (!RHS) return nullptr;
     }
 
-    LHS =
-        std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
+    LHS = make<BinaryExprAST>(BinOp, LHS, RHS);
+    LHS->Line = Line;
   }
 }
 
 // parse expression
-std::unique_ptr<ExprAST> Parser::ParseExpression() {
+ExprAST *Parser::ParseExpression() {
   auto LHS = ParsePrimary();
   if (!LHS) return nullptr;
-  return ParseBinOpRHS(0, std::move(LHS));
+  return ParseBinOpRHS(0, LHS);
 }
 
 std::unique_ptr<FunctionAST> Parser::ParseTopLevelExpr() {
-  if (auto E = ParseExpression()) {
-    auto Proto = std::make_unique<PrototypeAST>("__anon_expr",
-                                                std::vector<std::string>());
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
+  ScopedTimer T(Phase::Parse, sym_anon_expr);
+  unsigned Line = getCurrentToken().Line;
+  ASTArena ItemArena;
+  Arena = &ItemArena;
+  auto E = ParseExpression();
+  Arena = nullptr;
+  if (E) {
+    auto Proto = std::make_unique<PrototypeAST>(sym_anon_expr,
+                                                std::vector<SymbolID>());
+    Proto->File = getSourceName();
+    Proto->Line = Line;
+    return std::make_unique<FunctionAST>(std::move(Proto), E,
+                                         std::move(ItemArena));
   }
   return nullptr;
 }
@@ -148,15 +167,15 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
   if (getCurrentToken().type != (int)::tok_identifier)
     return LogErrorP("Expected function name in prototype");
 
-  std::string FnName = getCurrentToken().IdentifierStr;
+  SymbolID FnName = getCurrentToken().Sym;
   getNextToken();
 
   if (getCurrentToken().type != '(')
     return LogErrorP("Expected '(' in prototype");
 
-  std::vector<std::string> ArgNames;
+  std::vector<SymbolID> ArgNames;
   while (getNextToken() == (int)::tok_identifier)
-    ArgNames.push_back(getCurrentToken().IdentifierStr);
+    ArgNames.push_back(getCurrentToken().Sym);
   if (getCurrentToken().type != ')')
     return LogErrorP("Expected ')' in prototype");
 
@@ -167,17 +186,30 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
 }
 
 std::unique_ptr<FunctionAST> Parser::ParseDefinition() {
+  ScopedTimer T(Phase::Parse);
+  unsigned Line = getCurrentToken().Line;
   getNextToken();
   auto Proto = ParsePrototype();
   if (!Proto) return nullptr;
-
-  if (auto E = ParseExpression()) {
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
+  T.setFunction(Proto->Name);
+  Proto->File = getSourceName();
+  Proto->Line = Line;
+
+  ASTArena ItemArena;
+  Arena = &ItemArena;
+  auto E = ParseExpression();
+  Arena = nullptr;
+  if (E) {
+    return std::make_unique<FunctionAST>(std::move(Proto), E,
+                                         std::move(ItemArena));
   }
   return nullptr;
 }
 
 std::unique_ptr<PrototypeAST> Parser::ParseExtern() {
+  ScopedTimer T(Phase::Parse);
   getNextToken();
-  return ParsePrototype();
+  auto Proto = ParsePrototype();
+  if (Proto) Proto->IsExtern = true;
+  return Proto;
 }
@@ -1,23 +1,29 @@
 #pragma once
 
-#include <map>
 #include <memory>
 #include <vector>
 
 #include "expressions.hpp"
 
 class Parser {
-  std::map<char, int> BinopPrecedence;
+  // Indexed by operator character; 0 for non-operators.
+  int BinopPrecedence[256] = {};
+  // Arena of the top-level item being parsed.
+  ASTArena *Arena = nullptr;
 
-  std::unique_ptr<ExprAST> ParseNumberExpr();
-  std::unique_ptr<ExprAST> ParseParenExpr();
-  std::unique_ptr<ExprAST> ParseIdentifierExpr();
-  std::unique_ptr<ExprAST> ParsePrimary();
+  template <typename T, typename... ArgTs>
+  T *make(ArgTs &&... Args) {
+    return new (*Arena) T(std::forward<ArgTs>(Args)...);
+  }
+
+  ExprAST *ParseNumberExpr();
+  ExprAST *ParseParenExpr();
+  ExprAST *ParseIdentifierExpr();
+  ExprAST *ParsePrimary();
   int GetTokPrecedence();
-  std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
-                                         std::unique_ptr<ExprAST> LHS);
+  ExprAST *ParseBinOpRHS(int ExprPrec, ExprAST *LHS);
   std::unique_ptr<PrototypeAST> ParsePrototype();
-  std::unique_ptr<ExprAST> ParseExpression();
+  ExprAST *ParseExpression();
 
  public:
   Parser();
@@ -0,0 +1,266 @@
+#include "perf_jit.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/DebugInfo/DWARF/DWARFContext.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/Host.h"
+
+// The jitdump format, as in perf's Documentation/jitdump-specification.txt.
+// Everything is in host byte order.
+namespace {
+struct DumpHeader {
+  uint32_t Magic = 0x4A695444;  // "JiTD"
+  uint32_t Version = 1;
+  uint32_t TotalSize = sizeof(DumpHeader);
+  uint32_t ElfMach;
+  uint32_t Pad = 0;
+  uint32_t Pid;
+  uint64_t Timestamp;
+  uint64_t Flags = 0;
+};
+
+enum RecordType : uint32_t { CodeLoad = 0, CodeDebugInfo = 2, CodeClose = 3 };
+
+struct RecordHeader {
+  uint32_t Id;
+  uint32_t TotalSize;
+  uint64_t Timestamp;
+};
+
+// Followed by the function name, NUL-terminated, and its code.
+struct CodeLoadRecord {
+  RecordHeader Header;
+  uint32_t Pid, Tid;
+  uint64_t Vma, CodeAddr, CodeSize, CodeIndex;
+};
+
+// Followed by NumEntries DebugEntry, each followed by its file name,
+// NUL-terminated. Precedes the CodeLoadRecord of the code it describes.
+struct DebugInfoRecord {
+  RecordHeader Header;
+  uint64_t CodeAddr, NumEntries;
+};
+
+struct DebugEntry {
+  uint64_t Addr;
+  int32_t Line, Discriminator;
+};
+}  // namespace
+
+// The clock perf record -k 1 stamps samples with.
+static uint64_t Timestamp() {
+  timespec TS;
+  clock_gettime(CLOCK_MONOTONIC, &TS);
+  return (uint64_t)TS.tv_sec * 1000000000 + TS.tv_nsec;
+}
+
+static uint32_t ElfMachine() {
+  switch (llvm::Triple(llvm::sys::getProcessTriple()).getArch()) {
+    case llvm::Triple::x86_64:
+      return llvm::ELF::EM_X86_64;
+    case llvm::Triple::x86:
+      return llvm::ELF::EM_386;
+    case llvm::Triple::aarch64:
+      return llvm::ELF::EM_AARCH64;
+    case llvm::Triple::arm:
+      return llvm::ELF::EM_ARM;
+    default:
+      return llvm::ELF::EM_NONE;
+  }
+}
+
+template <typename T>
+static void Write(llvm::raw_ostream &OS, const T &Record) {
+  OS.write((const char *)&Record, sizeof(Record));
+}
+
+PerfJITListener::PerfJITListener() {
+  std::string Pid = std::to_string(getpid());
+  MapPath = "/tmp/perf-" + Pid + ".map";
+  Map = fopen(MapPath.c_str(), "w");
+  if (!Map)
+    fprintf(stderr, "cannot write %s: %s\n", MapPath.c_str(),
+            strerror(errno));
+
+  const char *Dir = getenv("JITDUMPDIR");
+  std::string DumpPath =
+      std::string(Dir && *Dir ? Dir : "/tmp") + "/jit-" + Pid + ".dump";
+  int FD = open(DumpPath.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+  if (FD < 0) {
+    fprintf(stderr, "cannot write %s: %s\n", DumpPath.c_str(),
+            strerror(errno));
+    return;
+  }
+  // perf record logs executable mappings, which is how perf inject finds
+  // the dump.
+  MarkerSize = sysconf(_SC_PAGESIZE);
+  Marker =
+      mmap(nullptr, MarkerSize, PROT_READ | PROT_EXEC, MAP_PRIVATE, FD, 0);
+  if (Marker == MAP_FAILED) {
+    fprintf(stderr, "cannot map %s: %s\n", DumpPath.c_str(), strerror(errno));
+    Marker = nullptr;
+    close(FD);
+    return;
+  }
+  Dump = std::make_unique<llvm::raw_fd_ostream>(FD, /*shouldClose=*/true);
+
+  DumpHeader Header;
+  Header.ElfMach = ElfMachine();
+  Header.Pid = getpid();
+  Header.Timestamp = Timestamp();
+  Write(*Dump, Header);
+  Dump->flush();
+}
+
+PerfJITListener::~PerfJITListener() {
+  if (Map && NumRetired) rewriteMap();
+  if (Map) fclose(Map);
+  if (Dump) {
+    Write(*Dump, RecordHeader{CodeClose, sizeof(RecordHeader), Timestamp()});
+    Dump.reset();
+  }
+  if (Marker) munmap(Marker, MarkerSize);
+}
+
+void PerfJITListener::notifyObjectLoaded(
+    ObjectKey K, const llvm::object::ObjectFile &Obj,
+    const llvm::RuntimeDyld::LoadedObjectInfo &L) {
+  // Symbol addresses in the debug object are where its sections were loaded.
+  auto DebugObj = L.getObjectForDebug(Obj);
+  if (!DebugObj.getBinary()) return;
+  const llvm::object::ObjectFile &Loaded = *DebugObj.getBinary();
+  std::unique_ptr<llvm::DIContext> Lines;
+  if (Dump) Lines = llvm::DWARFContext::create(Loaded);
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto &Addrs = Objects[K];
+  for (const auto &P : llvm::object::computeSymbolSizes(Loaded)) {
+    const llvm::object::SymbolRef &Sym = P.first;
+    uint64_t Size = P.second;
+    auto Type = Sym.getType();
+    if (!Type) {
+      llvm::consumeError(Type.takeError());
+      continue;
+    }
+    if (*Type != llvm::object::SymbolRef::ST_Function || !Size) continue;
+    auto Name = Sym.getName();
+    if (!Name) {
+      llvm::consumeError(Name.takeError());
+      continue;
+    }
+    auto Addr = Sym.getAddress();
+    if (!Addr) {
+      llvm::consumeError(Addr.takeError());
+      continue;
+    }
+    auto Section = Sym.getSection();
+    if (!Section) {
+      llvm::consumeError(Section.takeError());
+      continue;
+    }
+    if (*Section == Loaded.section_end()) continue;
+
+    if (Map) {
+      if (overlapsRetired(*Addr, Size)) rewriteMap();
+      if (Map)
+        fprintf(Map, "%" PRIx64 " %" PRIx64 " %s\n", *Addr, Size,
+                Name->str().c_str());
+      Symbols[*Addr] = Symbol{Size, Name->str(), K};
+      Addrs.push_back(*Addr);
+    }
+    if (!Dump) continue;
+
+    auto Table = Lines->getLineInfoForAddressRange(
+        {*Addr, (*Section)->getIndex()}, Size,
+        llvm::DILineInfoSpecifier(
+            llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath));
+    if (!Table.empty()) {
+      DebugInfoRecord Record;
+      Record.Header.Id = CodeDebugInfo;
+      Record.Header.Timestamp = Timestamp();
+      Record.CodeAddr = *Addr;
+      Record.NumEntries = Table.size();
+      size_t TotalSize = sizeof(Record);
+      for (auto &Entry : Table)
+        TotalSize += sizeof(DebugEntry) + Entry.second.FileName.size() + 1;
+      Record.Header.TotalSize = TotalSize;
+      Write(*Dump, Record);
+      for (auto &Entry : Table) {
+        // perf inject places the code after an ELF header of 0x40 bytes and
+        // expects the addresses to account for it.
+        Write(*Dump, DebugEntry{Entry.first + 0x40,
+                                (int32_t)Entry.second.Line, 0});
+        *Dump << Entry.second.FileName << '\0';
+      }
+    }
+
+    CodeLoadRecord Record;
+    Record.Header.Id = CodeLoad;
+    Record.Header.TotalSize = sizeof(Record) + Name->size() + 1 + Size;
+    Record.Header.Timestamp = Timestamp();
+    Record.Pid = getpid();
+    Record.Tid = syscall(SYS_gettid);
+    Record.Vma = Record.CodeAddr = *Addr;
+    Record.CodeSize = Size;
+    Record.CodeIndex = NextCodeIndex++;
+    Write(*Dump, Record);
+    *Dump << *Name << '\0';
+    Dump->write((const char *)(uintptr_t)*Addr, Size);
+  }
+  if (Map) fflush(Map);
+  if (Dump) Dump->flush();
+}
+
+void PerfJITListener::notifyFreeingObject(ObjectKey K) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto O = Objects.find(K);
+  if (O == Objects.end()) return;
+  for (uint64_t Addr : O->second) {
+    auto S = Symbols.find(Addr);
+    if (S != Symbols.end() && S->second.Key == K && !S->second.Retired) {
+      S->second.Retired = true;
+      ++NumRetired;
+    }
+  }
+  Objects.erase(O);
+  if (Map && NumRetired * 2 >= Symbols.size()) rewriteMap();
+}
+
+bool PerfJITListener::overlapsRetired(uint64_t Addr, uint64_t Size) const {
+  auto I = Symbols.lower_bound(Addr);
+  if (I != Symbols.begin()) {
+    auto Prev = std::prev(I);
+    if (Prev->second.Retired && Prev->first + Prev->second.Size > Addr)
+      return true;
+  }
+  for (; I != Symbols.end() && I->first < Addr + Size; ++I)
+    if (I->second.Retired) return true;
+  return false;
+}
+
+void PerfJITListener::rewriteMap() {
+  for (auto I = Symbols.begin(); I != Symbols.end();)
+    I = I->second.Retired ? Symbols.erase(I) : std::next(I);
+  NumRetired = 0;
+
+  Map = freopen(MapPath.c_str(), "w", Map);
+  if (!Map) {
+    fprintf(stderr, "cannot write %s: %s\n", MapPath.c_str(),
+            strerror(errno));
+    return;
+  }
+  for (auto &S : Symbols)
+    fprintf(Map, "%" PRIx64 " %" PRIx64 " %s\n", S.first, S.second.Size,
+            S.second.Name.c_str());
+  fflush(Map);
+}
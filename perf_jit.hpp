@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Describes JIT-compiled functions to Linux perf (--perf), which otherwise
+// sees samples in them as unknown addresses.
+//
+// Every function in an object the JIT links is appended to
+// /tmp/perf-<pid>.map, which perf report reads to name addresses, and
+// written to <dir>/jit-<pid>.dump as a jitdump record, with its code bytes
+// and the line table that CodeGenOptions::LineTables has codegen emit, for
+//
+//   perf record -k 1 ...
+//   perf inject --jit -i perf.data -o perf.jit.data
+//   perf report -i perf.jit.data   # or perf annotate
+//
+// <dir> is $JITDUMPDIR, or /tmp. perf finds the dump through a mapping of it
+// that this keeps for its lifetime.
+//
+// Freed objects are retired: their map lines are dropped when the file is
+// next rewritten, which happens before a new function overlaps one, once
+// they are half of the file, and when this is destroyed. jitdump has no
+// record for freed code; perf attributes an address to the function loaded
+// there most recently, by timestamp, so a reload supersedes it.
+class PerfJITListener : public llvm::JITEventListener {
+  struct Symbol {
+    uint64_t Size;
+    std::string Name;
+    ObjectKey Key;
+    bool Retired = false;
+  };
+
+  std::mutex Mutex;
+  std::string MapPath;
+  FILE *Map = nullptr;
+  std::map<uint64_t, Symbol> Symbols;  // by address, as listed in Map
+  std::map<ObjectKey, std::vector<uint64_t>> Objects;
+  size_t NumRetired = 0;
+
+  std::unique_ptr<llvm::raw_fd_ostream> Dump;
+  void *Marker = nullptr;
+  size_t MarkerSize = 0;
+  uint64_t NextCodeIndex = 0;
+
+  bool overlapsRetired(uint64_t Addr, uint64_t Size) const;
+  void rewriteMap();
+
+ public:
+  // Reports to stderr and goes on without a file that cannot be opened.
+  PerfJITListener();
+  ~PerfJITListener() override;
+
+  void notifyObjectLoaded(
+      ObjectKey K, const llvm::object::ObjectFile &Obj,
+      const llvm::RuntimeDyld::LoadedObjectInfo &L) override;
+  void notifyFreeingObject(ObjectKey K) override;
+};
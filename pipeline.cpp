@@ -0,0 +1,145 @@
+#include "pipeline.hpp"
+
+#include <algorithm>
+
+#include "stats.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+
+CompilePipeline::CompilePipeline(llvm::orc::KaleidoscopeJIT &JIT,
+                                 const CodeGenOptions &Options,
+                                 unsigned NumThreads)
+    : JIT(JIT),
+      DL(JIT.getTargetMachine().createDataLayout()),
+      Options(Options),
+      Names(Symbols()) {
+  for (unsigned i = 0; i < NumThreads; i++)
+    Workers.emplace_back([this] { workerLoop(); });
+  JIT.setSymbolWaiter(
+      [this](const std::string &Name) { return waitFor(Name); });
+}
+
+CompilePipeline::~CompilePipeline() {
+  finish();
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Stopping = true;
+  }
+  WorkReady.notify_all();
+  for (auto &W : Workers) W.join();
+  JIT.setSymbolWaiter(nullptr);
+}
+
+void CompilePipeline::submit(std::vector<std::unique_ptr<FunctionAST>> Defs,
+                             SymbolMap<std::unique_ptr<PrototypeAST>> &Protos) {
+  if (Defs.empty()) return;
+
+  Job J;
+  J.Seq = NextSeq++;
+  llvm::SmallVector<SymbolID, 16> Callees;
+  for (auto &D : Defs) {
+    std::string Name = JIT.mangle(D->Proto->getName().str());
+    // A redefinition has to reach the JIT after the one it replaces.
+    auto S = PendingSymbols.find(Name);
+    if (S != PendingSymbols.end() && S->second != J.Seq) waitFor(Name);
+    PendingSymbols[Name] = J.Seq;
+    PendingJobs[J.Seq].push_back(Name);
+
+    Protos[D->Proto->Name] = std::make_unique<PrototypeAST>(*D->Proto);
+    CollectCallees(D->Body, Callees);
+  }
+
+  std::sort(Callees.begin(), Callees.end());
+  Callees.erase(std::unique(Callees.begin(), Callees.end()), Callees.end());
+  for (SymbolID Callee : Callees)
+    if (auto *P = Protos.find(Callee))
+      J.Callees.push_back(std::make_unique<PrototypeAST>(**P));
+  J.Defs = std::move(Defs);
+
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Jobs.push_back(std::move(J));
+  }
+  WorkReady.notify_one();
+}
+
+void CompilePipeline::workerLoop() {
+  SymbolScope Scope(Names);
+  auto TM = JIT.createTargetMachine();
+  llvm::orc::SimpleCompiler Compile(*TM);
+  CodeGenVisitor CG(DL, Options);
+  CG.OptimizeEachFunction = false;
+
+  while (1) {
+    Job J;
+    {
+      std::unique_lock<std::mutex> Lock(Mutex);
+      WorkReady.wait(Lock, [this] { return Stopping || !Jobs.empty(); });
+      if (Jobs.empty()) return;
+      J = std::move(Jobs.front());
+      Jobs.pop_front();
+    }
+
+    for (auto &P : J.Callees) CG.FunctionProtos[P->Name] = std::move(P);
+    // A definition that fails codegen is dropped from the module, as in the
+    // serial path; the rest of the job still compiles.
+    for (auto &D : J.Defs) D->Accept(CG);
+
+    Result R;
+    R.Seq = J.Seq;
+    if (!CG.TheModule->empty()) {
+      CodeGenVisitor::OptimizeModule(*CG.TheModule, Options, TM.get());
+      ScopedTimer T(Phase::Compile);
+      R.Obj = Compile(*CG.TheModule);
+    }
+    CG.InitializeModuleAndPassManager();
+    J.Defs.clear();
+
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      Results.push_back(std::move(R));
+    }
+    ResultReady.notify_all();
+  }
+}
+
+void CompilePipeline::install(Result &R) {
+  if (R.Obj) JIT.addObject(std::move(R.Obj));
+  auto I = PendingJobs.find(R.Seq);
+  for (auto &Name : I->second) {
+    auto S = PendingSymbols.find(Name);
+    if (S != PendingSymbols.end() && S->second == R.Seq)
+      PendingSymbols.erase(S);
+  }
+  PendingJobs.erase(I);
+}
+
+void CompilePipeline::installNext() {
+  std::vector<Result> Done;
+  {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    ResultReady.wait(Lock, [this] { return !Results.empty(); });
+    Done.swap(Results);
+  }
+  for (auto &R : Done) install(R);
+}
+
+void CompilePipeline::installCompleted() {
+  std::vector<Result> Done;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Done.swap(Results);
+  }
+  for (auto &R : Done) install(R);
+}
+
+bool CompilePipeline::waitFor(const std::string &MangledName) {
+  if (!PendingSymbols.count(MangledName)) return false;
+
+  while (PendingSymbols.count(MangledName)) installNext();
+  return true;
+}
+
+void CompilePipeline::finish() {
+  while (!PendingJobs.empty()) installNext();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "symbols.hpp"
+#include "llvm/Support/MemoryBuffer.h"
+
+// Compiles definitions on a pool of worker threads while the calling thread
+// keeps parsing. Each worker generates IR in its own LLVMContext, optimizes
+// it and compiles it to an object file with its own TargetMachine.
+//
+// The JIT itself is only touched by the thread that owns the pipeline:
+// finished objects are added between top-level items (installCompleted), or
+// from symbol lookup when the name has a definition still in flight, which
+// then blocks until that definition is ready. A redefinition in flight thus
+// hides the one it replaces, and the JIT sees definitions in source order.
+class CompilePipeline {
+  struct Job {
+    std::vector<std::unique_ptr<FunctionAST>> Defs;
+    // Copies of the prototypes the definitions call, so workers never read
+    // the owner's tables.
+    std::vector<std::unique_ptr<PrototypeAST>> Callees;
+    uint64_t Seq;
+  };
+  struct Result {
+    std::unique_ptr<llvm::MemoryBuffer> Obj;  // null if codegen failed
+    uint64_t Seq;
+  };
+
+  llvm::orc::KaleidoscopeJIT &JIT;
+  const llvm::DataLayout DL;
+  const CodeGenOptions Options;  // the owner's, copied for the workers
+  SymbolTable &Names;  // the owner's interner; workers only read names
+
+  std::mutex Mutex;
+  std::condition_variable WorkReady, ResultReady;
+  std::deque<Job> Jobs;
+  std::vector<Result> Results;
+  bool Stopping = false;
+  std::vector<std::thread> Workers;
+
+  // Owner thread only.
+  uint64_t NextSeq = 0;
+  std::map<std::string, uint64_t> PendingSymbols;  // mangled name -> job
+  std::map<uint64_t, std::vector<std::string>> PendingJobs;
+
+  void workerLoop();
+  void install(Result &R);
+  // Block until at least one job finishes, then install what is done.
+  void installNext();
+  bool waitFor(const std::string &MangledName);
+
+ public:
+  CompilePipeline(llvm::orc::KaleidoscopeJIT &JIT,
+                  const CodeGenOptions &Options, unsigned NumThreads);
+  ~CompilePipeline();
+
+  // Queue Defs for compilation as one module. Protos is consulted for the
+  // prototypes of their callees and receives the prototypes of Defs.
+  void submit(std::vector<std::unique_ptr<FunctionAST>> Defs,
+              SymbolMap<std::unique_ptr<PrototypeAST>> &Protos);
+  // Add every finished object to the JIT without waiting.
+  void installCompleted();
+  // Wait for everything submitted so far and add it to the JIT.
+  void finish();
+};
@@ -0,0 +1,167 @@
+#include "profile.hpp"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+// The calls F makes, in the order its body makes them. Calls to intrinsics
+// are arithmetic rather than calls and are left out.
+static std::vector<llvm::CallInst *> CallSites(llvm::Function &F) {
+  std::vector<llvm::CallInst *> Sites;
+  for (auto &I : llvm::instructions(F))
+    if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I))
+      if (auto *Callee = Call->getCalledFunction())
+        if (!Callee->isIntrinsic()) Sites.push_back(Call);
+  return Sites;
+}
+
+void ProfileCollector::instrument(llvm::Function &F) {
+  // Top-level expressions run once and are gone.
+  if (F.getName() == "__anon_expr") return;
+
+  auto C = std::make_unique<Counters>();
+  C->Name = F.getName().str();
+  auto Sites = CallSites(F);
+  for (auto *Call : Sites)
+    C->Callees.push_back(Call->getCalledFunction()->getName().str());
+  C->Counts.reset(new uint64_t[Sites.size() + 1]());
+
+  // Versioned, as a redefinition registers counters of its own.
+  std::string Symbol = C->Name + ".prof" + std::to_string(NextCounters++);
+  JIT.addHostSymbol(Symbol,
+                    (llvm::JITTargetAddress)(uintptr_t)C->Counts.get());
+
+  auto *I64 = llvm::Type::getInt64Ty(F.getContext());
+  auto *Counts = F.getParent()->getOrInsertGlobal(Symbol, I64);
+  // Atomic: batch wrappers copy F, counters and all, and run the copies on
+  // several threads at once.
+  auto Count = [&](llvm::Instruction *Before, unsigned I) {
+    llvm::IRBuilder<> Builder(Before);
+    auto *Counter = Builder.CreateConstInBoundsGEP1_64(I64, Counts, I);
+    Builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, Counter,
+                            Builder.getInt64(1),
+                            llvm::AtomicOrdering::Monotonic);
+  };
+  Count(&*F.getEntryBlock().getFirstInsertionPt(), 0);
+  for (size_t I = 0; I < Sites.size(); I++) Count(Sites[I], I + 1);
+  Functions.push_back(std::move(C));
+}
+
+bool ProfileCollector::write(const std::string &Path) const {
+  struct Totals {
+    uint64_t Calls = 0;
+    const std::vector<std::string> *Callees = nullptr;
+    std::vector<uint64_t> Sites;
+  };
+  llvm::StringMap<Totals> ByName;
+  std::vector<llvm::StringRef> Order;
+  for (auto &C : Functions) {
+    auto Inserted = ByName.try_emplace(C->Name);
+    auto &T = Inserted.first->second;
+    if (Inserted.second) Order.push_back(Inserted.first->first());
+    T.Calls += C->Counts[0];
+    if (!T.Callees || *T.Callees != C->Callees) {
+      T.Callees = &C->Callees;
+      T.Sites.assign(C->Callees.size(), 0);
+    }
+    for (size_t I = 0; I < T.Sites.size(); I++)
+      T.Sites[I] += C->Counts[I + 1];
+  }
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_Text);
+  if (EC) {
+    fprintf(stderr, "cannot write %s: %s\n", Path.c_str(),
+            EC.message().c_str());
+    return false;
+  }
+  OS << "# kaleidoscope profile\n";
+  for (auto Name : Order) {
+    auto &T = ByName[Name];
+    OS << llvm::format("function %s %" PRIu64 "\n", Name.str().c_str(),
+                       T.Calls);
+    for (size_t I = 0; I < T.Sites.size(); I++)
+      OS << llvm::format("call %zu %s %" PRIu64 "\n", I,
+                         (*T.Callees)[I].c_str(), T.Sites[I]);
+  }
+  return true;
+}
+
+std::unique_ptr<Profile> Profile::read(const std::string &Path) {
+  auto Buf = llvm::MemoryBuffer::getFile(Path);
+  if (!Buf) {
+    fprintf(stderr, "cannot read %s: %s\n", Path.c_str(),
+            Buf.getError().message().c_str());
+    return nullptr;
+  }
+
+  auto P = std::make_unique<Profile>();
+  FunctionProfile *Current = nullptr;
+  for (llvm::line_iterator L(**Buf, /*SkipBlanks=*/true, '#'); !L.is_at_end();
+       ++L) {
+    llvm::SmallVector<llvm::StringRef, 4> Fields;
+    L->split(Fields, ' ', -1, /*KeepEmpty=*/false);
+    uint64_t Index, Calls;
+    if (Fields.size() == 3 && Fields[0] == "function" &&
+        !Fields[2].getAsInteger(10, Calls)) {
+      Current = &P->Functions[Fields[1]];
+      *Current = FunctionProfile();
+      Current->Calls = Calls;
+      P->MaxCalls = std::max(P->MaxCalls, Calls);
+    } else if (Fields.size() == 4 && Fields[0] == "call" && Current &&
+               !Fields[1].getAsInteger(10, Index) &&
+               Index == Current->Sites.size() &&
+               !Fields[3].getAsInteger(10, Calls)) {
+      Current->Sites.emplace_back(Fields[2].str(), Calls);
+    } else {
+      fprintf(stderr, "%s:%" PRId64 ": not a profile entry\n", Path.c_str(),
+              L.line_number());
+      return nullptr;
+    }
+  }
+
+  llvm::InstrProfSummaryBuilder Summary(
+      llvm::ProfileSummaryBuilder::DefaultCutoffs);
+  for (auto &F : P->Functions) {
+    // The entry count first, as instrumentation profiles have it.
+    std::vector<uint64_t> Counts{F.second.Calls};
+    for (auto &Site : F.second.Sites) Counts.push_back(Site.second);
+    Summary.addRecord(llvm::InstrProfRecord(std::move(Counts)));
+  }
+  P->Summary = Summary.getSummary();
+  return P;
+}
+
+void Profile::annotate(llvm::Function &F) const {
+  auto P = Functions.find(F.getName());
+  if (P == Functions.end()) return;
+  auto &FP = P->second;
+  auto IsHot = [](uint64_t Calls, uint64_t Max) {
+    return Calls && Calls * HotRatio >= Max;
+  };
+
+  // The inliner only goes by entry counts in a module with a summary.
+  llvm::Module &M = *F.getParent();
+  if (!M.getProfileSummary(/*IsCS=*/false))
+    M.setProfileSummary(Summary->getMD(M.getContext()),
+                        llvm::ProfileSummary::PSK_Instr);
+  F.setEntryCount(FP.Calls);
+  if (!FP.Calls) {
+    F.addFnAttr(llvm::Attribute::Cold);
+    return;
+  }
+  if (IsHot(FP.Calls, MaxCalls)) F.addFnAttr(llvm::Attribute::InlineHint);
+}
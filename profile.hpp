@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/ProfileSummary.h"
+
+// Profile-guided optimization of JIT-compiled code.
+//
+// A ProfileCollector (--profile-generate) has every definition count the
+// calls to it and the calls made at each of its call sites, and writes the
+// totals to a text file:
+//
+//   # kaleidoscope profile
+//   function norm 1000000
+//   call 0 square 1000000
+//   call 1 square 1000000
+//
+// Call sites are numbered in the order the body makes them; intrinsics, such
+// as those the math externs lower to, are not call sites. A later run reads
+// the file into a Profile (--profile-use), which annotates each definition
+// before it is optimized: the entry count, inlinehint on hot functions, and
+// cold on functions never called. Hot means at least 1/HotRatio of the
+// largest entry count. The module also gets the profile's summary, without
+// which the inliner ignores entry counts; with it, calls in hot code are
+// inlined against the inliner's larger threshold for hot call sites, and
+// calls in cold code against its smaller one. These are hints: what gets
+// inlined is still up to the cost model.
+//
+// Call site counts go into the summary but annotate nothing. Bodies have no
+// branches, so each site runs once per call of its function, and the
+// inliner already derives a site's count from the caller's entry count.
+// Functions are matched by name, so a definition that has changed since the
+// profile was taken keeps its entry count.
+
+class ProfileCollector {
+  struct Counters {
+    std::string Name;
+    std::vector<std::string> Callees;    // by call site
+    std::unique_ptr<uint64_t[]> Counts;  // calls, then one per call site
+  };
+
+  llvm::orc::KaleidoscopeJIT &JIT;
+  std::vector<std::unique_ptr<Counters>> Functions;
+  unsigned NextCounters = 0;
+
+ public:
+  explicit ProfileCollector(llvm::orc::KaleidoscopeJIT &JIT) : JIT(JIT) {}
+
+  // Count the calls to and from F, a definition that has just been
+  // generated, before it is optimized so that the counts survive inlining.
+  // Counters live on the host and are updated atomically, as F's batch
+  // wrapper may run on several threads; otherwise, like the Memoizer, this
+  // is used on the thread that owns the JIT.
+  void instrument(llvm::Function &F);
+  // Write the counts so far, summed over redefinitions of a function. Call
+  // sites are summed back to the last redefinition that changed them.
+  // Reports and returns false if Path cannot be written.
+  bool write(const std::string &Path) const;
+};
+
+class Profile {
+  struct FunctionProfile {
+    uint64_t Calls = 0;
+    std::vector<std::pair<std::string, uint64_t>> Sites;  // callee, calls
+  };
+
+  llvm::StringMap<FunctionProfile> Functions;
+  uint64_t MaxCalls = 0;
+  std::unique_ptr<llvm::ProfileSummary> Summary;
+
+ public:
+  static const uint64_t HotRatio = 100;
+
+  // Reports and returns null if Path cannot be read or is not a profile.
+  static std::unique_ptr<Profile> read(const std::string &Path);
+
+  // Annotate F, a definition that has just been generated, from the
+  // profile. F is left alone if the profile has no function of its name.
+  // Safe to call from several threads at once.
+  void annotate(llvm::Function &F) const;
+};
@@ -0,0 +1,189 @@
+#include "stats.hpp"
+
+#include <mutex>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+
+// Bumped by the operator new in alloc_count.cpp, when it is linked in. Per
+// thread so that counting never contends; timers read it on their own thread.
+thread_local size_t ThreadAllocations;
+
+size_t AllocationCount() { return ThreadAllocations; }
+
+const char *PhaseName(Phase P) {
+  static const char *const Names[NumPhases] = {
+      "lex", "parse", "codegen", "optimize", "compile", "lookup", "execute",
+  };
+  return Names[(int)P];
+}
+
+namespace {
+
+struct Totals {
+  uint64_t Count = 0;
+  uint64_t Allocations = 0;
+  std::chrono::steady_clock::duration Time{};
+};
+
+struct FunctionTotals {
+  Totals Phases[NumPhases];
+};
+
+// Written by timers on any thread, so guarded by Lock. Only touched while
+// stats are enabled.
+std::mutex Lock;
+Totals PhaseTotals[NumPhases];
+// By name rather than ID: timers may run under another thread's interner.
+llvm::StringMap<FunctionTotals> PerFunction;
+std::vector<llvm::StringRef> FunctionOrder;  // first-recorded order
+
+// Innermost running timer of this thread.
+thread_local ScopedTimer *Current;
+
+void add(Totals &T, std::chrono::steady_clock::duration Time,
+         size_t Allocs) {
+  T.Count++;
+  T.Time += Time;
+  T.Allocations += Allocs;
+}
+
+void add(Totals &T, const Totals &More) {
+  T.Count += More.Count;
+  T.Time += More.Time;
+  T.Allocations += More.Allocations;
+}
+
+// Tokens this thread lexed outside any timer, not yet in PhaseTotals.
+struct UnownedLex {
+  Totals Lex;
+
+  void flush() {
+    if (!Lex.Count) return;
+    std::lock_guard<std::mutex> L(Lock);
+    add(PhaseTotals[(int)Phase::Lex], Lex);
+    Lex = Totals();
+  }
+  ~UnownedLex() { flush(); }
+};
+thread_local UnownedLex Unowned;
+
+double seconds(const Totals &T) {
+  return std::chrono::duration<double>(T.Time).count();
+}
+
+void writeJSON(llvm::raw_ostream &OS, const Totals (&Phases)[NumPhases],
+               const char *Indent) {
+  bool First = true;
+  for (int I = 0; I < NumPhases; I++) {
+    const Totals &T = Phases[I];
+    if (!T.Count) continue;
+    OS << (First ? "" : ",\n") << Indent << '"' << PhaseName((Phase)I)
+       << "\": {\"count\": " << T.Count
+       << ", \"seconds\": " << llvm::format("%.9f", seconds(T))
+       << ", \"allocations\": " << T.Allocations << '}';
+    First = false;
+  }
+  OS << '\n';
+}
+
+void writeCSV(llvm::raw_ostream &OS, llvm::StringRef Function,
+              const Totals (&Phases)[NumPhases]) {
+  for (int I = 0; I < NumPhases; I++) {
+    const Totals &T = Phases[I];
+    if (!T.Count) continue;
+    OS << Function << ',' << PhaseName((Phase)I) << ',' << T.Count << ','
+       << llvm::format("%.9f", seconds(T)) << ',' << T.Allocations << '\n';
+  }
+}
+
+}  // namespace
+
+namespace stats {
+
+bool Enabled = false;
+
+// Function names are Kaleidoscope identifiers, so they need no escaping in
+// either format.
+void Report(llvm::raw_ostream &OS, Format F) {
+  Unowned.flush();
+  std::lock_guard<std::mutex> L(Lock);
+  if (F == Format::CSV) {
+    // The totals have an empty function column.
+    OS << "function,phase,count,seconds,allocations\n";
+    writeCSV(OS, "", PhaseTotals);
+    for (llvm::StringRef Fn : FunctionOrder)
+      writeCSV(OS, Fn, PerFunction.find(Fn)->second.Phases);
+    return;
+  }
+  OS << "{\n  \"phases\": {\n";
+  writeJSON(OS, PhaseTotals, "    ");
+  OS << "  },\n  \"functions\": {";
+  for (size_t I = 0; I < FunctionOrder.size(); I++) {
+    llvm::StringRef Fn = FunctionOrder[I];
+    OS << (I ? ",\n" : "\n") << "    \"" << Fn << "\": {\n";
+    writeJSON(OS, PerFunction.find(Fn)->second.Phases, "      ");
+    OS << "    }";
+  }
+  OS << (FunctionOrder.empty() ? "}\n}\n" : "\n  }\n}\n");
+}
+
+void Reset() {
+  Unowned.Lex = Totals();
+  std::lock_guard<std::mutex> L(Lock);
+  for (auto &T : PhaseTotals) T = Totals();
+  PerFunction.clear();
+  FunctionOrder.clear();
+}
+
+}  // namespace stats
+
+void ScopedTimer::start() {
+  Parent = Current;
+  Current = this;
+  if (Fn == NoFunction && Parent) Fn = Parent->Fn;
+  StartAllocations = ThreadAllocations;
+  Start = std::chrono::steady_clock::now();
+}
+
+void ScopedTimer::stop() {
+  auto Elapsed = std::chrono::steady_clock::now() - Start;
+  size_t Allocs = ThreadAllocations - StartAllocations;
+  Current = Parent;
+  Totals Lex;
+  Lex.Count = LexTokens;
+  Lex.Time = LexTime;
+  Lex.Allocations = LexAllocations;
+  {
+    std::lock_guard<std::mutex> L(Lock);
+    add(PhaseTotals[(int)P], Elapsed - ChildTime, Allocs - ChildAllocations);
+    add(PhaseTotals[(int)Phase::Lex], Lex);
+    if (Fn != NoFunction) {
+      auto FT = PerFunction.try_emplace(Symbols().name(Fn));
+      if (FT.second) FunctionOrder.push_back(FT.first->getKey());
+      add(FT.first->second.Phases[(int)P], Elapsed - ChildTime,
+          Allocs - ChildAllocations);
+      add(FT.first->second.Phases[(int)Phase::Lex], Lex);
+    }
+  }
+  // Bookkeeping allocations above are not charged to the parent either.
+  if (Parent) {
+    Parent->ChildTime += Elapsed;
+    Parent->ChildAllocations += ThreadAllocations - StartAllocations;
+  }
+}
+
+void LexTimer::stop() {
+  auto Elapsed = std::chrono::steady_clock::now() - Start;
+  size_t Allocs = ThreadAllocations - StartAllocations;
+  if (ScopedTimer *T = Current) {
+    T->LexTokens++;
+    T->LexTime += Elapsed;
+    T->LexAllocations += Allocs;
+    T->ChildTime += Elapsed;
+    T->ChildAllocations += Allocs;
+  } else {
+    add(Unowned.Lex, Elapsed, Allocs);
+  }
+}
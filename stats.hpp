@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+
+#include "llvm/Support/raw_ostream.h"
+#include "symbols.hpp"
+
+// Where the time of a kaleidoscope run goes, recorded with --stats.
+//
+// Phases are timed by ScopedTimer. Nested timers are subtracted from their
+// parent, so each phase reports exclusive wall time: parsing does not include
+// the lexing it triggers, and code generation does not include the
+// optimization it runs. Heap allocations made through operator new are
+// counted the same way.
+enum class Phase {
+  Lex,
+  Parse,
+  Codegen,   // AST to IR, or to bytecode for --engine=vm
+  Optimize,  // IR pass pipeline
+  Compile,   // IR to machine code
+  Lookup,    // symbol lookup, including linking the object that defines it
+  Execute,   // running top-level expressions
+};
+enum { NumPhases = (int)Phase::Execute + 1 };
+
+const char *PhaseName(Phase P);
+
+// No function: timers attribute their phase to the enclosing timer's function
+// or, at the outermost level, to the phase totals only.
+enum : SymbolID { NoFunction = ~0u };
+
+// Operator new calls made by this thread so far. Only counted in programs
+// that link alloc_count.cpp; the library leaves the host's operator new alone.
+size_t AllocationCount();
+
+namespace stats {
+
+// Off by default. When off, a ScopedTimer is a load and a branch.
+extern bool Enabled;
+
+enum class Format { JSON, CSV };
+
+// Write the totals per phase and per function recorded so far.
+void Report(llvm::raw_ostream &OS, Format F);
+
+// Forget everything recorded so far.
+void Reset();
+
+}  // namespace stats
+
+class ScopedTimer {
+  ScopedTimer *Parent;
+  Phase P;
+  SymbolID Fn;
+  bool Active;
+  std::chrono::steady_clock::time_point Start;
+  size_t StartAllocations;
+  // Spent in nested timers.
+  std::chrono::steady_clock::duration ChildTime{};
+  size_t ChildAllocations = 0;
+  // Tokens lexed while this was the innermost timer, recorded when it stops.
+  uint64_t LexTokens = 0;
+  std::chrono::steady_clock::duration LexTime{};
+  size_t LexAllocations = 0;
+
+  void start();
+  void stop();
+
+ public:
+  explicit ScopedTimer(Phase P, SymbolID Fn = NoFunction)
+      : P(P), Fn(Fn), Active(stats::Enabled) {
+    if (Active) start();
+  }
+  ~ScopedTimer() {
+    if (Active) stop();
+  }
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  // For phases that only learn the function's name part way through.
+  void setFunction(SymbolID Name) { Fn = Name; }
+
+  friend class LexTimer;
+};
+
+// Times the lexing of one token. That happens far too often to take a lock
+// each time, so the time is charged to the innermost ScopedTimer, which
+// records it under Phase::Lex when it stops. Tokens read outside any timer
+// are totalled per thread and added when the thread reports or exits.
+class LexTimer {
+  bool Active;
+  std::chrono::steady_clock::time_point Start;
+  size_t StartAllocations;
+
+  void stop();
+
+ public:
+  LexTimer() : Active(stats::Enabled) {
+    if (Active) {
+      StartAllocations = AllocationCount();
+      Start = std::chrono::steady_clock::now();
+    }
+  }
+  ~LexTimer() {
+    if (Active) stop();
+  }
+  LexTimer(const LexTimer &) = delete;
+  LexTimer &operator=(const LexTimer &) = delete;
+};
@@ -0,0 +1,74 @@
+#include "symbol_index.hpp"
+
+#include <algorithm>
+
+#include "llvm/Support/DJB.h"
+
+SymbolIndex::Table::Table(size_t Size)
+    : Mask(Size - 1), Slots(new std::atomic<Entry *>[Size]) {
+  for (size_t I = 0; I < Size; I++)
+    Slots[I].store(nullptr, std::memory_order_relaxed);
+}
+
+SymbolIndex::SymbolIndex() {
+  Tables.emplace_back(new Table(256));
+  Current.store(Tables.back().get(), std::memory_order_release);
+}
+
+void SymbolIndex::grow() {
+  Table *Old = Current.load(std::memory_order_relaxed);
+  Tables.emplace_back(new Table((Old->Mask + 1) * 2));
+  Table *New = Tables.back().get();
+  for (auto &E : Entries) {
+    size_t I = E->Hash & New->Mask;
+    while (New->Slots[I].load(std::memory_order_relaxed))
+      I = (I + 1) & New->Mask;
+    New->Slots[I].store(E.get(), std::memory_order_relaxed);
+  }
+  Current.store(New, std::memory_order_release);
+}
+
+SymbolIndex::Entry *SymbolIndex::find(llvm::StringRef Name) const {
+  uint32_t Hash = llvm::djbHash(Name);
+  const Table *T = Current.load(std::memory_order_acquire);
+  for (size_t I = Hash & T->Mask;; I = (I + 1) & T->Mask) {
+    Entry *E = T->Slots[I].load(std::memory_order_acquire);
+    if (!E) return nullptr;
+    if (E->Hash == Hash && E->Name == Name) return E;
+  }
+}
+
+SymbolIndex::Entry &SymbolIndex::insert(llvm::StringRef Name) {
+  if (Entry *E = find(Name)) return *E;
+  if ((Entries.size() + 1) * 2 > Current.load()->Mask + 1) grow();
+
+  Entries.emplace_back(new Entry);
+  Entry *E = Entries.back().get();
+  E->Name = Name.str();
+  E->Hash = llvm::djbHash(Name);
+  Table *T = Current.load(std::memory_order_relaxed);
+  size_t I = E->Hash & T->Mask;
+  while (T->Slots[I].load(std::memory_order_relaxed)) I = (I + 1) & T->Mask;
+  T->Slots[I].store(E, std::memory_order_release);
+  return *E;
+}
+
+void SymbolIndex::add(Entry &E, uint64_t K) {
+  E.Modules.push_back(K);
+  ++E.Generation;
+  E.Address.store(0, std::memory_order_release);
+}
+
+void SymbolIndex::remove(Entry &E, uint64_t K) {
+  // Usually the newest definition is the one going away.
+  auto I = std::find(E.Modules.rbegin(), E.Modules.rend(), K);
+  if (I == E.Modules.rend()) return;
+  E.Modules.erase(std::next(I).base());
+  ++E.Generation;
+  E.Address.store(0, std::memory_order_release);
+}
+
+void SymbolIndex::publish(Entry &E, uint64_t Generation, uint64_t Addr) {
+  if (E.Generation == Generation)
+    E.Address.store(Addr, std::memory_order_release);
+}
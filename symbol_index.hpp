@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+// Which JIT modules define each symbol, by mangled name, so that the JIT
+// resolves a name by hashing instead of asking every module in turn.
+//
+// Entries are created and updated by the thread that owns the JIT. Once a
+// lookup there has resolved a name, its address is published and address()
+// returns it to any thread without locking, even while that thread goes on
+// adding and removing modules. Entries are never freed before the index, so
+// the pointers find() hands out stay valid; there is one per distinct name.
+class SymbolIndex {
+ public:
+  struct Entry {
+    std::string Name;
+    uint32_t Hash;
+    // Resolved address of the newest definition, 0 until it is looked up.
+    std::atomic<uint64_t> Address{0};
+    // Keys of the modules defining Name, oldest first. Owner thread only.
+    std::vector<uint64_t> Modules;
+    // Bumped whenever Modules changes. Owner thread only.
+    uint64_t Generation = 0;
+  };
+
+  SymbolIndex();
+  SymbolIndex(const SymbolIndex &) = delete;
+  SymbolIndex &operator=(const SymbolIndex &) = delete;
+
+  // Owner thread: the entry for Name, created if there is none.
+  Entry &insert(llvm::StringRef Name);
+  // Module K defines (or, for remove, no longer defines) E's name. Either
+  // way the newest definition changes, so the published address is dropped.
+  void add(Entry &E, uint64_t K);
+  void remove(Entry &E, uint64_t K);
+  // Owner thread: publish Addr, resolved from E's modules as they were at
+  // Generation. Dropped if a module defining the name has been added or
+  // removed since, as Addr may then belong to a replaced definition.
+  void publish(Entry &E, uint64_t Generation, uint64_t Addr);
+
+  // Any thread. Null if Name was never defined.
+  Entry *find(llvm::StringRef Name) const;
+  // Any thread. 0 if Name is not defined or not resolved yet.
+  uint64_t address(llvm::StringRef Name) const {
+    Entry *E = find(Name);
+    return E ? E->Address.load(std::memory_order_acquire) : 0;
+  }
+
+  size_t size() const { return Entries.size(); }
+
+ private:
+  // Open addressing with linear probing. Slots are only ever filled, so a
+  // reader racing with an insert sees the entry or an empty slot. Growing
+  // publishes a new table; readers may still be probing the old ones, so
+  // they are kept until the index is destroyed.
+  struct Table {
+    size_t Mask;
+    std::unique_ptr<std::atomic<Entry *>[]> Slots;
+    explicit Table(size_t Size);
+  };
+
+  std::atomic<Table *> Current;
+  std::vector<std::unique_ptr<Table>> Tables;
+  std::vector<std::unique_ptr<Entry>> Entries;
+
+  void grow();
+};
@@ -0,0 +1,65 @@
+#include "symbols.hpp"
+
+#include <algorithm>
+
+#include "llvm/Support/DJB.h"
+#include "llvm/Support/ErrorHandling.h"
+
+SymbolTable::SymbolTable() {
+  grow();
+  intern("def");
+  intern("extern");
+  intern("__anon_expr");
+}
+
+void SymbolTable::grow() {
+  std::vector<Slot> Old = std::move(Slots);
+  Slots.assign(Old.empty() ? 1024 : Old.size() * 2, Slot{0, Empty});
+  size_t Mask = Slots.size() - 1;
+  for (const Slot &S : Old) {
+    if (S.Sym == Empty) continue;
+    size_t I = S.Hash & Mask;
+    while (Slots[I].Sym != Empty) I = (I + 1) & Mask;
+    Slots[I] = S;
+  }
+}
+
+SymbolID SymbolTable::intern(llvm::StringRef Name) {
+  uint32_t Hash = llvm::djbHash(Name);
+  size_t Mask = Slots.size() - 1;
+  for (size_t I = Hash & Mask;; I = (I + 1) & Mask) {
+    Slot &S = Slots[I];
+    if (S.Sym == Empty) {
+      SymbolID Sym = NumNames++;
+      uint32_t Index = Sym + (1u << FirstChunkBits);
+      unsigned K = llvm::Log2_32(Index);
+      if (Index == 1u << K) {
+        if (K - FirstChunkBits == MaxChunks)
+          llvm::report_fatal_error("too many identifiers");
+        Chunks[K - FirstChunkBits].reset(new llvm::StringRef[1u << K]);
+      }
+      char *Mem = Storage.Allocate<char>(Name.size());
+      std::copy(Name.begin(), Name.end(), Mem);
+      Chunks[K - FirstChunkBits][Index - (1u << K)] =
+          llvm::StringRef(Mem, Name.size());
+      S = Slot{Hash, Sym};
+      if (NumNames * 2 > Slots.size()) grow();
+      return Sym;
+    }
+    if (S.Hash == Hash && name(S.Sym) == Name) return S.Sym;
+  }
+}
+
+static thread_local SymbolTable *CurrentTable;
+
+SymbolTable &Symbols() {
+  if (CurrentTable) return *CurrentTable;
+  static SymbolTable Table;
+  return Table;
+}
+
+SymbolScope::SymbolScope(SymbolTable &Table) : Saved(CurrentTable) {
+  CurrentTable = &Table;
+}
+
+SymbolScope::~SymbolScope() { CurrentTable = Saved; }
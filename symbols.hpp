@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/MathExtras.h"
+
+// Identifiers are interned once by the lexer and referred to by dense IDs
+// from then on.
+using SymbolID = uint32_t;
+
+// Pre-interned symbols, in interning order.
+enum : SymbolID {
+  sym_def,
+  sym_extern,
+  sym_anon_expr,  // "__anon_expr"
+};
+
+// Interning happens on one thread. Names are stored in chunks that never
+// move, so name() may be called from other threads concurrently with intern()
+// for any ID they were handed. Each chunk is twice the size of the one before,
+// so a table that interns a handful of names stays small.
+class SymbolTable {
+  llvm::BumpPtrAllocator Storage;
+  enum : unsigned {
+    FirstChunkBits = 6,
+    MaxChunks = 32 - FirstChunkBits - 1,
+  };
+  // Chunk K holds the 2^(K+FirstChunkBits) IDs whose Sym + 2^FirstChunkBits
+  // has K+FirstChunkBits as its top bit.
+  std::unique_ptr<llvm::StringRef[]> Chunks[MaxChunks];
+  size_t NumNames = 0;
+  // Open addressing. The hash is kept in the slot so that probing only
+  // touches the names on a full hash match.
+  struct Slot {
+    uint32_t Hash;
+    SymbolID Sym;
+  };
+  std::vector<Slot> Slots;
+  enum : SymbolID { Empty = ~0u };
+
+  void grow();
+
+ public:
+  SymbolTable();
+
+  SymbolID intern(llvm::StringRef Name);
+  llvm::StringRef name(SymbolID Sym) const {
+    uint32_t I = Sym + (1u << FirstChunkBits);
+    unsigned K = llvm::Log2_32(I);
+    return Chunks[K - FirstChunkBits][I - (1u << K)];
+  }
+  size_t size() const { return NumNames; }
+};
+
+// The calling thread's interner: the one installed by the innermost
+// SymbolScope, or else the global one.
+SymbolTable &Symbols();
+
+// Makes Table the calling thread's interner until the scope ends, so that
+// independent sessions can intern on threads of their own.
+class SymbolScope {
+  SymbolTable *Saved;
+
+ public:
+  explicit SymbolScope(SymbolTable &Table);
+  ~SymbolScope();
+  SymbolScope(const SymbolScope &) = delete;
+  SymbolScope &operator=(const SymbolScope &) = delete;
+};
+
+// Flat open-addressing map keyed by symbol ID, with linear probing. Entries
+// are never erased one by one; clear() keeps the capacity for reuse.
+template <typename V>
+class SymbolMap {
+  enum : SymbolID { Empty = ~0u };
+  std::vector<SymbolID> Keys;
+  std::vector<V> Values;
+  size_t Count = 0;
+
+  size_t slotFor(SymbolID Sym) const {
+    size_t Mask = Keys.size() - 1;
+    size_t I = (Sym * 0x9E3779B9u) & Mask;
+    while (Keys[I] != Sym && Keys[I] != Empty) I = (I + 1) & Mask;
+    return I;
+  }
+
+  void grow() {
+    std::vector<SymbolID> OldKeys = std::move(Keys);
+    std::vector<V> OldValues = std::move(Values);
+    Keys.assign(OldKeys.empty() ? 16 : OldKeys.size() * 2, Empty);
+    Values.clear();
+    Values.resize(Keys.size());
+    for (size_t I = 0; I < OldKeys.size(); I++) {
+      if (OldKeys[I] == Empty) continue;
+      size_t S = slotFor(OldKeys[I]);
+      Keys[S] = OldKeys[I];
+      Values[S] = std::move(OldValues[I]);
+    }
+  }
+
+ public:
+  // Returns null if Sym is not present.
+  V *find(SymbolID Sym) {
+    if (Keys.empty()) return nullptr;
+    size_t S = slotFor(Sym);
+    return Keys[S] == Empty ? nullptr : &Values[S];
+  }
+
+  V &operator[](SymbolID Sym) {
+    if ((Count + 1) * 4 > Keys.size() * 3) grow();
+    size_t S = slotFor(Sym);
+    if (Keys[S] == Empty) {
+      Keys[S] = Sym;
+      Count++;
+    }
+    return Values[S];
+  }
+
+  void clear() {
+    if (Count == 0) return;
+    std::fill(Keys.begin(), Keys.end(), Empty);
+    for (auto &Val : Values) Val = V();
+    Count = 0;
+  }
+
+  size_t size() const { return Count; }
+};
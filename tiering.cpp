@@ -0,0 +1,259 @@
+#include "tiering.hpp"
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "codegen.hpp"
+#include "stats.hpp"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/Format.h"
+
+void AddCallCounter(llvm::Function &F, const std::string &Name,
+                    uint64_t Threshold) {
+  auto &Ctx = F.getContext();
+  auto *M = F.getParent();
+  auto *I64 = llvm::Type::getInt64Ty(Ctx);
+  auto *Counter = M->getOrInsertGlobal(Name + ".calls", I64);
+  auto *Body = &F.getEntryBlock();
+  auto *Entry = llvm::BasicBlock::Create(Ctx, "count", &F, Body);
+  llvm::IRBuilder<> Builder(Entry);
+  auto *Calls =
+      Builder.CreateAdd(Builder.CreateLoad(I64, Counter), Builder.getInt64(1));
+  Builder.CreateStore(Calls, Counter);
+  if (!Threshold) {
+    Builder.CreateBr(Body);
+    return;
+  }
+
+  auto *Hot = llvm::BasicBlock::Create(Ctx, "hot", &F, Body);
+  Builder.CreateCondBr(
+      Builder.CreateICmpUGE(Calls, Builder.getInt64(Threshold)), Hot, Body);
+  Builder.SetInsertPoint(Hot);
+  auto *Info = M->getOrInsertGlobal(Name + ".info", Builder.getInt8Ty());
+  auto Hook = M->getOrInsertFunction("__tier_up", Builder.getVoidTy(),
+                                     Builder.getInt8PtrTy());
+  Builder.CreateCall(Hook, {Info});
+  Builder.CreateBr(Body);
+}
+
+TieredCompiler::TieredCompiler(llvm::orc::KaleidoscopeJIT &JIT,
+                               const CodeGenOptions &Options,
+                               uint64_t Threshold)
+    : JIT(JIT), Tier1(Options), Threshold(Threshold) {
+  Tier1.Pipeline = "O3";
+  // Tier 0 is about compile time, down to instruction selection.
+  JIT.getTargetMachine().setOptLevel(llvm::CodeGenOpt::None);
+  JIT.addHostSymbol("__tier_up", (llvm::JITTargetAddress)(uintptr_t)&onHot);
+  Worker = std::thread([this] { workerLoop(); });
+}
+
+TieredCompiler::~TieredCompiler() {
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Stopping = true;
+  }
+  WorkReady.notify_all();
+  Worker.join();
+}
+
+void TieredCompiler::addModule(std::unique_ptr<llvm::Module> M) {
+  auto BC = std::make_shared<Bitcode>();
+  {
+    llvm::raw_svector_ostream OS(*BC);
+    llvm::WriteBitcodeToFile(*M, OS);
+  }
+
+  std::vector<llvm::Function *> Defs;
+  for (auto &F : *M)
+    if (!F.isDeclaration()) Defs.push_back(&F);
+
+  std::vector<FunctionInfo *> Added;
+  for (auto *F : Defs) {
+    auto Info = std::make_unique<FunctionInfo>();
+    Info->Owner = this;
+    Info->Name = F->getName().str();
+    Info->Sym = Symbols().intern(Info->Name);
+    Info->Module = BC;
+    for (auto &I : llvm::instructions(*F))
+      if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I))
+        if (auto *Callee = Call->getCalledFunction())
+          if (Callee != F)
+            Info->Callees.push_back(Symbols().intern(Callee->getName()));
+    std::sort(Info->Callees.begin(), Info->Callees.end());
+    Info->Callees.erase(
+        std::unique(Info->Callees.begin(), Info->Callees.end()),
+        Info->Callees.end());
+
+    JIT.addHostSymbol(Info->Name + ".calls",
+                      (llvm::JITTargetAddress)(uintptr_t)&Info->Calls);
+    JIT.addHostSymbol(Info->Name + ".info",
+                      (llvm::JITTargetAddress)(uintptr_t)Info.get());
+    // Linking the module below resolves calls to the stub, so it has to
+    // exist already; it is pointed at the new code right after.
+    if (!Current.find(Info->Sym)) JIT.setStub(Info->Name, 0);
+
+    // Move the body aside as <Name>.tier0, leaving calls to Name, including
+    // those within this module, to go through the stub.
+    AddCallCounter(*F, Info->Name, Threshold);
+    F->setName(Info->Name + ".tier0");
+    auto *Decl =
+        llvm::Function::Create(F->getFunctionType(),
+                               llvm::Function::ExternalLinkage, Info->Name, *M);
+    F->replaceAllUsesWith(Decl);
+
+    Current[Info->Sym] = Info.get();
+    Added.push_back(Info.get());
+    Infos.push_back(std::move(Info));
+  }
+
+  JIT.addModule(std::move(M));
+  for (auto *Info : Added) {
+    auto Sym = JIT.findSymbol(Info->Name + ".tier0");
+    JIT.setStub(Info->Name, llvm::cantFail(Sym.getAddress()));
+  }
+}
+
+void TieredCompiler::onHot(FunctionInfo *Info) {
+  auto *Self = Info->Owner;
+  if (!Info->Queued && Self->isCurrent(*Info)) {
+    Info->Queued = true;
+    Self->enqueue(*Info);
+  }
+  if (Self->HaveResults.load(std::memory_order_acquire))
+    Self->installCompleted();
+}
+
+void TieredCompiler::enqueue(FunctionInfo &Info) {
+  Job J;
+  J.Info = &Info;
+  J.Name = Info.Name;
+  auto AddSource = [&J](const FunctionInfo &Def) {
+    for (auto &S : J.Sources)
+      if (S.Module == Def.Module) {
+        S.Defs.push_back(Def.Name);
+        return;
+      }
+    J.Sources.push_back({Def.Module, {Def.Name}});
+  };
+  AddSource(Info);
+  // Callees bind to their newest definition through the stubs, so that is
+  // the one to inline.
+  for (SymbolID Callee : Info.Callees)
+    if (auto *C = Current.find(Callee)) AddSource(**C);
+
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Jobs.push_back(std::move(J));
+  }
+  WorkReady.notify_one();
+}
+
+void TieredCompiler::workerLoop() {
+  auto TM = JIT.createTargetMachine();
+  TM->setOptLevel(llvm::CodeGenOpt::Aggressive);
+
+  while (1) {
+    Job J;
+    {
+      std::unique_lock<std::mutex> Lock(Mutex);
+      WorkReady.wait(Lock, [this] { return Stopping || !Jobs.empty(); });
+      if (Stopping) return;
+      J = std::move(Jobs.front());
+      Jobs.pop_front();
+    }
+
+    Result R;
+    R.Info = J.Info;
+    R.Obj = compile(J, *TM);
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      Results.push_back(std::move(R));
+    }
+    HaveResults.store(true, std::memory_order_release);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> TieredCompiler::compile(
+    Job &J, llvm::TargetMachine &TM) {
+  llvm::LLVMContext Ctx;
+  std::unique_ptr<llvm::Module> M;
+  for (auto &S : J.Sources) {
+    llvm::MemoryBufferRef Buf(
+        llvm::StringRef(S.Module->data(), S.Module->size()), J.Name);
+    auto Src = llvm::cantFail(llvm::getLazyBitcodeModule(Buf, Ctx));
+    // Only load the bodies needed: the function itself, and its callees as
+    // available_externally so they can be inlined but are not emitted.
+    for (auto &F : *Src) {
+      if (!F.isMaterializable()) continue;
+      if (std::find(S.Defs.begin(), S.Defs.end(), F.getName()) ==
+          S.Defs.end()) {
+        F.deleteBody();
+        continue;
+      }
+      llvm::cantFail(F.materialize());
+      if (F.getName() != J.Name)
+        F.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+    }
+    llvm::cantFail(Src->materializeAll());
+    if (!M)
+      M = std::move(Src);
+    else if (llvm::Linker::linkModules(*M, std::move(Src)))
+      return nullptr;
+  }
+
+  auto *F = M->getFunction(J.Name);
+  AddCallCounter(*F, J.Name, 0);
+  F->setName(J.Name + ".tier1");
+
+  CodeGenVisitor::OptimizeModule(*M, Tier1, &TM);
+
+  ScopedTimer T(Phase::Compile);
+  return llvm::orc::SimpleCompiler(TM)(*M);
+}
+
+void TieredCompiler::install(Result &R) {
+  auto &Info = *R.Info;
+  // A redefinition replaced the function while it was being compiled.
+  if (!R.Obj || !isCurrent(Info)) return;
+  JIT.addObject(std::move(R.Obj));
+  auto Sym = JIT.findSymbol(Info.Name + ".tier1");
+  JIT.setStub(Info.Name, llvm::cantFail(Sym.getAddress()));
+  Info.Tier = 1;
+}
+
+void TieredCompiler::installCompleted() {
+  std::vector<Result> Done;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Done.swap(Results);
+    HaveResults.store(false, std::memory_order_relaxed);
+  }
+  for (auto &R : Done) install(R);
+}
+
+void TieredCompiler::printStats(llvm::raw_ostream &OS) {
+  std::vector<const FunctionInfo *> Called;
+  unsigned Promoted = 0;
+  for (auto &Info : Infos) {
+    if (Info->Calls) Called.push_back(Info.get());
+    if (Info->Tier) ++Promoted;
+  }
+  std::sort(Called.begin(), Called.end(),
+            [](const FunctionInfo *A, const FunctionInfo *B) {
+              return A->Calls > B->Calls;
+            });
+
+  OS << "tiered: " << Promoted << " of " << Infos.size()
+     << " definitions promoted to tier 1\n";
+  for (auto *Info : Called)
+    OS << llvm::format("%14" PRIu64 " calls  tier %u  %s%s\n", Info->Calls,
+                       Info->Tier, Info->Name.c_str(),
+                       isCurrent(*Info) ? "" : " (redefined)");
+}
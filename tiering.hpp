@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "codegen.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "symbols.hpp"
+
+// Count calls to F in the i64 host symbol "<Name>.calls". With a Threshold,
+// every call from the Threshold-th on also passes the host symbol
+// "<Name>.info" to the tier-up hook.
+void AddCallCounter(llvm::Function &F, const std::string &Name,
+                    uint64_t Threshold);
+
+// Two-tier compilation. Definitions are first compiled without optimization,
+// with a call counter at the top of each function, and are called through a
+// stub. Once a function has been called Threshold times it is recompiled at
+// O3 on a background thread, with the bodies of its callees available for
+// inlining, and its stub is pointed at the new code.
+//
+// Like CompilePipeline, only the thread that owns the TieredCompiler touches
+// the JIT; that is also the thread running the generated code.
+class TieredCompiler {
+  using Bitcode = llvm::SmallVector<char, 0>;
+
+  struct FunctionInfo {
+    uint64_t Calls = 0;  // incremented by the function's own code
+    TieredCompiler *Owner;
+    std::string Name;
+    SymbolID Sym;
+    // Unoptimized bitcode of the module that defines the function.
+    std::shared_ptr<const Bitcode> Module;
+    std::vector<SymbolID> Callees;
+    unsigned Tier = 0;
+    bool Queued = false;
+  };
+
+  // Definitions to take from one module's bitcode.
+  struct Source {
+    std::shared_ptr<const Bitcode> Module;
+    std::vector<std::string> Defs;
+  };
+  struct Job {
+    FunctionInfo *Info;
+    std::string Name;
+    std::vector<Source> Sources;  // the first one defines Name
+  };
+  struct Result {
+    FunctionInfo *Info;
+    std::unique_ptr<llvm::MemoryBuffer> Obj;  // null if linking failed
+  };
+
+  llvm::orc::KaleidoscopeJIT &JIT;
+  CodeGenOptions Tier1;  // the owner's options, at O3
+  const uint64_t Threshold;
+
+  // Owner thread only. Old versions of redefined functions stay in Infos
+  // because their code may still be running.
+  std::vector<std::unique_ptr<FunctionInfo>> Infos;
+  SymbolMap<FunctionInfo *> Current;
+
+  std::mutex Mutex;
+  std::condition_variable WorkReady;
+  std::deque<Job> Jobs;
+  std::vector<Result> Results;
+  std::atomic<bool> HaveResults{false};
+  bool Stopping = false;
+  std::thread Worker;
+
+  static void onHot(FunctionInfo *Info);
+  bool isCurrent(const FunctionInfo &Info) {
+    auto *C = Current.find(Info.Sym);
+    return C && *C == &Info;
+  }
+  void enqueue(FunctionInfo &Info);
+  void workerLoop();
+  std::unique_ptr<llvm::MemoryBuffer> compile(Job &J, llvm::TargetMachine &TM);
+  void install(Result &R);
+
+ public:
+  TieredCompiler(llvm::orc::KaleidoscopeJIT &JIT,
+                 const CodeGenOptions &Options, uint64_t Threshold);
+  ~TieredCompiler();
+
+  // Compile the definitions in M at tier 0 and route calls to them through
+  // stubs. M must not have been optimized.
+  void addModule(std::unique_ptr<llvm::Module> M);
+  // Switch every function whose tier 1 code is ready over to it.
+  void installCompleted();
+  // Tier and call count of every function called so far.
+  void printStats(llvm::raw_ostream &OS);
+};
@@ -0,0 +1,41 @@
+#include "vector_math.hpp"
+
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Support/DynamicLibrary.h"
+
+bool VectorMathAvailable() {
+  static const bool Loaded =
+      !llvm::sys::DynamicLibrary::LoadLibraryPermanently("libmvec.so.1");
+  return Loaded;
+}
+
+// libmvec's names follow the x86 vector function ABI: _ZGV, the instruction
+// set (b: SSE2, c: AVX, d: AVX2, e: AVX-512), N for unmasked, the number of
+// lanes and a v per vector argument.
+#define LIBMVEC_VARIANT(Scalar, Args, ISA, VF) \
+  {#Scalar, "_ZGV" ISA "N" #VF Args "_" #Scalar, VF}, \
+  {"llvm." #Scalar ".f64", "_ZGV" ISA "N" #VF Args "_" #Scalar, VF}
+#define LIBMVEC_VARIANTS(ISA, VF)                                        \
+  LIBMVEC_VARIANT(sin, "v", ISA, VF), LIBMVEC_VARIANT(cos, "v", ISA, VF), \
+  LIBMVEC_VARIANT(exp, "v", ISA, VF), LIBMVEC_VARIANT(log, "v", ISA, VF), \
+  LIBMVEC_VARIANT(pow, "vv", ISA, VF)
+
+static const llvm::VecDesc SSE2[] = {LIBMVEC_VARIANTS("b", 2)};
+static const llvm::VecDesc AVX[] = {LIBMVEC_VARIANTS("c", 4)};
+static const llvm::VecDesc AVX2[] = {LIBMVEC_VARIANTS("d", 4)};
+static const llvm::VecDesc AVX512[] = {LIBMVEC_VARIANTS("e", 8)};
+
+void AddVectorMathFunctions(llvm::TargetLibraryInfoImpl &TLII,
+                            const llvm::TargetMachine &TM) {
+  if (!VectorMathAvailable() ||
+      TM.getTargetTriple().getArch() != llvm::Triple::x86_64)
+    return;
+
+  const llvm::MCSubtargetInfo &STI = *TM.getMCSubtargetInfo();
+  TLII.addVectorizableFunctions(SSE2);
+  if (STI.checkFeatures("+avx2"))
+    TLII.addVectorizableFunctions(AVX2);
+  else if (STI.checkFeatures("+avx"))
+    TLII.addVectorizableFunctions(AVX);
+  if (STI.checkFeatures("+avx512f")) TLII.addVectorizableFunctions(AVX512);
+}
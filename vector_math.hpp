@@ -0,0 +1,27 @@
+#pragma once
+
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Target/TargetMachine.h"
+
+// SIMD variants of the math functions for the vectorizers, from glibc's
+// libmvec. With them, vectorized code computes sin, cos, exp, log and pow
+// of a whole vector in one call, e.g. to _ZGVdN4v_sin for four lanes on
+// AVX2, rather than calling the scalar function once per lane. sqrt, fabs
+// and fma need no library, as they have vector instructions.
+//
+// The calls are to the intrinsics CodeGenVisitor lowers math externs to;
+// the JIT resolves the variants in the process, where libmvec is loaded.
+//
+// glibc documents up to 4 ulp of error for the variants, where the scalar
+// functions stay within an ulp or so. Vectorized loops, such as the batch
+// wrappers, would then give slightly different results from the same
+// definition called once per row. So, like clang without -fveclib, code
+// generation only offers them when CodeGenOptions::VectorMath asks for it.
+
+// Whether libmvec loads in this process. Where it does not, the variants are
+// never offered, whatever CodeGenOptions::VectorMath says.
+bool VectorMathAvailable();
+// Declare the variants that TM's instruction set can call to TLII. Code
+// optimized with them may call libmvec, which must then be linked in.
+void AddVectorMathFunctions(llvm::TargetLibraryInfoImpl &TLII,
+                            const llvm::TargetMachine &TM);
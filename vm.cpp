@@ -0,0 +1,153 @@
+#include "vm.hpp"
+
+#include <algorithm>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/ErrorHandling.h"
+
+void BytecodeVM::fail(Status S, const char *Error) {
+  if (Result != Compiled) return;
+  if (Error) LogError(Error);
+  Result = S;
+}
+
+// Compile E so that its value ends up in register Dst, using the registers
+// above Dst as temporaries.
+void BytecodeVM::emit(const ExprAST *E, unsigned Dst) {
+  if (Dst > UINT8_MAX) return fail(Unsupported);
+  P->NumRegs = std::max(P->NumRegs, Dst + 1);
+  uint8_t A = Dst;
+
+  switch (E->getKind()) {
+    case ExprAST::EK_Number: {
+      size_t K = P->Constants.size();
+      if (K > UINT16_MAX) return fail(Unsupported);
+      P->Constants.push_back(llvm::cast<NumberExprAST>(E)->Val);
+      P->Code.push_back({OP_Const, A, uint8_t(K), uint8_t(K >> 8)});
+      return;
+    }
+    case ExprAST::EK_Variable:
+      // Top-level expressions have no parameters.
+      return fail(Failed, "Unknown variable name");
+    case ExprAST::EK_Binary: {
+      auto *B = llvm::cast<BinaryExprAST>(E);
+      emit(B->LHS, Dst);
+      emit(B->RHS, Dst + 1);
+      Opcode Op;
+      switch (B->Op) {
+        case '+':
+          Op = OP_Add;
+          break;
+        case '-':
+          Op = OP_Sub;
+          break;
+        case '*':
+          Op = OP_Mul;
+          break;
+        case '<':
+          Op = OP_Less;
+          break;
+        default:
+          return fail(Failed, "invalid binary operator");
+      }
+      P->Code.push_back({Op, A, A, uint8_t(Dst + 1)});
+      return;
+    }
+    case ExprAST::EK_Call: {
+      auto *C = llvm::cast<CallExprAST>(E);
+      auto *Proto = Protos.find(C->Callee);
+      if (!Proto) return fail(Failed, "Unknown function referenced");
+      if ((*Proto)->Args.size() != C->NumArgs)
+        return fail(Failed, "Incorrect #arguments passed");
+      if (C->NumArgs > MaxCallArgs) return fail(Unsupported);
+
+      auto *Addr = Resolved.find(C->Callee);
+      if (!Addr) {
+        auto Sym = JIT.findSymbol(Symbols().name(C->Callee).str());
+        if (!Sym) return fail(Failed, "Unresolved function referenced");
+        auto Address = Sym.getAddress();
+        if (auto Err = Address.takeError()) {
+          llvm::consumeError(std::move(Err));
+          return fail(Failed, "Unresolved function referenced");
+        }
+        Addr = &(Resolved[C->Callee] = *Address);
+      }
+      size_t Index = std::find(P->Callees.begin(), P->Callees.end(), *Addr) -
+                     P->Callees.begin();
+      if (Index == P->Callees.size()) {
+        if (Index > UINT8_MAX) return fail(Unsupported);
+        P->Callees.push_back(*Addr);
+      }
+
+      for (unsigned i = 0; i < C->NumArgs; i++) emit(C->Args[i], Dst + i);
+      P->Code.push_back({OP_Call, A, uint8_t(C->NumArgs), uint8_t(Index)});
+      return;
+    }
+  }
+  llvm_unreachable("unknown expression kind");
+}
+
+BytecodeVM::Status BytecodeVM::compile(const FunctionAST &F, Program &Out) {
+  Out.Code.clear();
+  Out.Constants.clear();
+  Out.Callees.clear();
+  Out.NumRegs = 0;
+  P = &Out;
+  Result = Compiled;
+  emit(F.Body, 0);
+  Out.Code.push_back({OP_Ret, 0, 0, 0});
+  return Result;
+}
+
+static double CallNative(llvm::JITTargetAddress Addr, const double *A,
+                         unsigned N) {
+  using D = double;
+  switch (N) {
+    case 0:
+      return ((D(*)())Addr)();
+    case 1:
+      return ((D(*)(D))Addr)(A[0]);
+    case 2:
+      return ((D(*)(D, D))Addr)(A[0], A[1]);
+    case 3:
+      return ((D(*)(D, D, D))Addr)(A[0], A[1], A[2]);
+    case 4:
+      return ((D(*)(D, D, D, D))Addr)(A[0], A[1], A[2], A[3]);
+    case 5:
+      return ((D(*)(D, D, D, D, D))Addr)(A[0], A[1], A[2], A[3], A[4]);
+    case 6:
+      return ((D(*)(D, D, D, D, D, D))Addr)(A[0], A[1], A[2], A[3], A[4], A[5]);
+  }
+  llvm_unreachable("arity is checked by compile");
+}
+
+double BytecodeVM::run(const Program &P) {
+  llvm::SmallVector<double, 32> Regs(P.NumRegs);
+  double *R = Regs.data();
+  const double *K = P.Constants.data();
+  for (const Instr *I = P.Code.data();; ++I) {
+    switch (I->Op) {
+      case OP_Const:
+        R[I->A] = K[I->B | I->C << 8];
+        break;
+      case OP_Add:
+        R[I->A] = R[I->B] + R[I->C];
+        break;
+      case OP_Sub:
+        R[I->A] = R[I->B] - R[I->C];
+        break;
+      case OP_Mul:
+        R[I->A] = R[I->B] * R[I->C];
+        break;
+      case OP_Less:
+        // Unordered, like the JIT's fcmp ult: NaN compares less.
+        R[I->A] = !(R[I->B] >= R[I->C]);
+        break;
+      case OP_Call:
+        R[I->A] = CallNative(P.Callees[I->C], &R[I->A], I->B);
+        break;
+      case OP_Ret:
+        return R[I->A];
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "KaleidoscopeJIT.h"
+#include "codegen.hpp"
+#include "expressions.hpp"
+#include "symbols.hpp"
+
+// Evaluates top-level expressions without LLVM: the body is compiled to a
+// register-based bytecode and run by a dispatch loop. Calls go by address to
+// JIT-compiled definitions and host functions, so only the expression itself
+// is interpreted.
+class BytecodeVM {
+ public:
+  enum Opcode : uint8_t {
+    OP_Const,  // A = Constants[B | C << 8]
+    OP_Add,    // A = B + C
+    OP_Sub,    // A = B - C
+    OP_Mul,    // A = B * C
+    OP_Less,   // A = B < C ? 1.0 : 0.0
+    OP_Call,   // A = Callees[C](A, ..., A + B - 1)
+    OP_Ret,    // return A
+  };
+  struct Instr {
+    Opcode Op;
+    uint8_t A, B, C;
+  };
+  struct Program {
+    std::vector<Instr> Code;
+    std::vector<double> Constants;
+    std::vector<llvm::JITTargetAddress> Callees;
+    unsigned NumRegs = 0;
+  };
+
+  enum Status {
+    Compiled,
+    Failed,       // an error in the expression, already reported
+    Unsupported,  // valid, but beyond the VM; use the JIT instead
+  };
+
+  // Calls are native, so their arity is bounded by CallNative.
+  static const unsigned MaxCallArgs = 6;
+
+  BytecodeVM(llvm::orc::KaleidoscopeJIT &JIT,
+             SymbolMap<std::unique_ptr<PrototypeAST>> &Protos)
+      : JIT(JIT), Protos(Protos) {}
+
+  // Compile the body of a top-level expression into P.
+  Status compile(const FunctionAST &F, Program &P);
+  static double run(const Program &P);
+
+  // Forget resolved callee addresses; call after a function is (re)defined.
+  void clearCache() { Resolved.clear(); }
+
+ private:
+  llvm::orc::KaleidoscopeJIT &JIT;
+  SymbolMap<std::unique_ptr<PrototypeAST>> &Protos;
+  SymbolMap<llvm::JITTargetAddress> Resolved;
+  Program *P = nullptr;
+  Status Result;
+
+  void emit(const ExprAST *E, unsigned Dst);
+  void fail(Status S, const char *Error = nullptr);
+};